@@ -0,0 +1,97 @@
+/**
+ * Circuit Playground - Small-Signal AC Analysis
+ *
+ * The circuit is linearized once at its DC operating point: the Jacobian of
+ * a load there gives the conductances (resistors, sources, the small-signal
+ * models of diodes and transistors), and the companion-model records of that
+ * load (ReactiveState) give every capacitance and inductance. At angular
+ * frequency w each reactive element is an admittance jwC / (1 + jwC r) in
+ * place of its companion conductance, so the complex MNA system is
+ * (G + jB) x = e, with e a unit excitation at the AC source.
+ *
+ * The complex system is solved in its real-equivalent form
+ *
+ *     [ G  -B ] [ Re x ]   [ Re e ]
+ *     [ B   G ] [ Im x ] = [ Im e ]
+ *
+ * through the sparse LU: its pattern is the same at every frequency, so it
+ * is analyzed at the first point and only refactored numerically after.
+ */
+
+#ifndef AC_H
+#define AC_H
+
+#include "types.h"
+#include "circuit.h"
+#include "matrix.h"
+#include "sparse.h"
+
+// A capacitance or inductance of the linearized circuit (one companion-model
+// record). Node reactances stamp an admittance between p and m; branch
+// reactances (inductors, relay coils) enter the branch equation of row p.
+typedef struct {
+    int p, m;               // 0-based unknowns (-1 = ground)
+    bool branch;            // p is a branch current row
+    double c;               // Capacitance or inductance
+    double r;               // Series resistance folded into the record
+    double geq;             // Companion conductance stamped in the Jacobian
+} ACReactance;
+
+// Linearized circuit, read-only while frequencies are solved
+typedef struct {
+    int n;                  // Unknowns of the MNA system
+    int num_nodes;          // Node voltage rows
+    int excite_row;         // Row of the unit excitation (AC source branch)
+
+    // Jacobian at the operating point (compressed columns)
+    int *col_ptr;
+    int *row_idx;
+    double *values;
+    int nnz;
+
+    ACReactance *reactances;
+    int num_reactances;
+} ACSystem;
+
+// Solver state for one frequency at a time: the real-equivalent matrix with
+// compiled stamp handles, its LU, the solution (Re x, then Im x) and the
+// adjoint solution in the same layout
+typedef struct {
+    SparseMatrix *matrix;
+    SparseLU *lu;
+    Vector *rhs;
+    Vector *x;
+    Vector *adjoint;
+} ACSolver;
+
+// Linearize from a load at the operating point: jacobian is the loaded MNA
+// matrix (compressed) and the circuit's components hold the reactive records
+// of the same load. Returns NULL if out of memory.
+ACSystem *ac_system_create(SparseMatrix *jacobian, Circuit *circuit,
+                           int num_nodes, int excite_row);
+void ac_system_free(ACSystem *sys);
+
+ACSolver *ac_solver_create(const ACSystem *sys);
+void ac_solver_free(ACSolver *solver);
+
+// Solve the system at freq (Hz) into solver->x
+bool ac_solve(const ACSystem *sys, ACSolver *solver, double freq);
+
+// Complex response of unknown idx after ac_solve (0 for ground, idx < 0)
+void ac_solver_response(const ACSystem *sys, const ACSolver *solver, int idx,
+                        double *re, double *im);
+
+// Adjoint of unknown idx after ac_solve at the same frequency: solves
+// Y^T lambda = e_idx into solver->adjoint with the factors of Y, so that
+// lambda^T dY x is the change of x[idx] (times -1) for a change dY
+bool ac_solve_adjoint(const ACSystem *sys, ACSolver *solver, int idx);
+
+// u^T Y_c x for one component's part Y_c of the complex system: stamp holds
+// the triplets of the component's load at the operating point (recorded,
+// not compiled) and rs its companion-model records of that load. u and x
+// are complex vectors in the solver's layout.
+void ac_component_product(const SparseMatrix *stamp, const ReactiveState *rs,
+                          int num_nodes, double freq, const Vector *u, const Vector *x,
+                          double *re, double *im);
+
+#endif // AC_H
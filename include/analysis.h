@@ -5,6 +5,7 @@
  * - Temperature analysis with component temperature coefficients
  * - Parametric sweep analysis
  * - Monte Carlo statistical analysis
+ * - Adjoint sensitivity analysis
  * - FFT spectrum analysis
  * - Advanced waveform measurements
  */
@@ -17,9 +18,20 @@
 #include "simulation.h"
 #include <stdbool.h>
 
-// Maximum sweep/Monte Carlo points
-#define MAX_SWEEP_POINTS 100
+// Default sweep point limit (ParametricSweep.max_points) and Monte Carlo runs
+#define SWEEP_DEFAULT_MAX_POINTS 100
 #define MAX_MONTE_CARLO_RUNS 1000
+#define MAX_MC_TOLERANCES 64
+
+// Monte Carlo: components sampled from the Sobol sequence, and runs
+// between two early-stopping checks
+#define MC_SOBOL_DIMS 32
+#define MC_CHECK_RUNS 32
+#define MAX_SENSITIVITIES 256
+
+// Consecutive sweep points solved by one worker, each warm-starting from
+// the operating point of the one before
+#define SWEEP_CHUNK 8
 #define FFT_SIZE 1024
 #define MAX_PERSISTENCE_FRAMES 32
 
@@ -78,6 +90,13 @@ typedef enum {
     SWEEP_PARAM_COUNT
 } SweepParamType;
 
+// Analysis run at each sweep point
+typedef enum {
+    SWEEP_ANALYSIS_DC = 0,      // Operating point
+    SWEEP_ANALYSIS_TRANSIENT,   // transient_steps steps from the operating point
+    SWEEP_ANALYSIS_AC           // Small-signal response at ac_frequency
+} SweepAnalysisType;
+
 // Sweep result
 typedef struct {
     double param_value;       // Parameter value at this point
@@ -85,45 +104,154 @@ typedef struct {
     double output_min;        // Min during this sweep point
     double output_max;        // Max during this sweep point
     double output_rms;        // RMS value
+    double output_phase;      // AC: phase (degrees)
+    bool valid;               // The point's simulation succeeded
 } SweepPoint;
 
 // Parametric sweep configuration
 typedef struct {
     bool active;
-    int component_id;         // Component being swept
+    int component_id;         // Component being swept (-1: all, for temperature)
     SweepParamType param_type;
+    SweepAnalysisType analysis_type;
     double start_value;
     double end_value;
     int num_points;
+    int max_points;           // Limit on num_points
     bool log_scale;           // Use logarithmic spacing
+    int transient_steps;
+    double time_step;         // Transient step (0 = automatic)
+    EnvironmentState environment;  // Light and temperature of the points
+    double ac_frequency;      // AC analysis frequency (Hz) unless swept
+
+    // Background execution
+    bool running;
+    bool cancel;
 
     // Results
-    SweepPoint results[MAX_SWEEP_POINTS];
+    SweepPoint *results;      // num_points entries
     int num_results;
-    int current_point;        // Current sweep point (for progress)
+    int num_failed;           // Points whose simulation failed
+    int current_point;        // Points finished (for progress)
+    long newton_iterations;   // DC Newton iterations over all points
     bool complete;
 } ParametricSweep;
 
+// Monte Carlo trial: what each run simulates to get its output value
+typedef enum {
+    MC_TRIAL_DC = 0,          // Probe voltage at the operating point
+    MC_TRIAL_TRANSIENT        // RMS probe voltage over transient_steps steps
+} MCTrialType;
+
+// Sampling of the Monte Carlo component values
+typedef enum {
+    MC_SAMPLING_RANDOM = 0,   // Independent draws
+    MC_SAMPLING_LHS,          // Latin hypercube: num_runs strata per component
+    MC_SAMPLING_SOBOL         // Sobol sequence with a random digital shift
+} MCSampling;
+
+// Distribution of a component value within its tolerance
+typedef enum {
+    MC_DIST_GAUSSIAN = 0,     // 3 sigma at the tolerance
+    MC_DIST_UNIFORM,          // Flat over +-tolerance
+    MC_DIST_BINNED            // Gaussian cut at +-tolerance, without the parts
+                              // within +-bin_tolerance (sold as a tighter grade)
+} MCDistribution;
+
+// Tolerance of one component, in place of the analysis defaults
+typedef struct {
+    int component_id;
+    double tolerance;         // %
+    MCDistribution distribution;
+    double bin_tolerance;     // MC_DIST_BINNED: % of the tighter grade
+} MCTolerance;
+
 // Monte Carlo configuration
 typedef struct {
     bool active;
     int num_runs;
-    int current_run;
-    bool use_component_tolerance;  // Use each component's tolerance
-    double global_tolerance;       // Or use global tolerance (%)
+    int current_run;          // Runs finished (for progress)
+    bool use_component_tolerance;  // Resistors use their own tolerance
+    double global_tolerance;       // Default tolerance (%)
+    MCTrialType trial_type;
+    int transient_steps;
+    double time_step;         // Transient step (0 = automatic)
+    EnvironmentState environment;  // Light and temperature of the trials
+    uint64_t seed;            // Draws are a function of (seed, run, component)
+
+    // Sampling: components past MC_SOBOL_DIMS are drawn independently
+    // under MC_SAMPLING_SOBOL. Latin hypercube strata span num_runs, so
+    // with early stopping only Sobol keeps its balance at every check.
+    MCSampling sampling;
+    MCDistribution distribution;    // Default distribution
+    double bin_tolerance;           // Default tighter grade for MC_DIST_BINNED (%)
+    MCTolerance tolerances[MAX_MC_TOLERANCES];
+    int num_tolerances;
+
+    // Early stopping: from min_runs on, every MC_CHECK_RUNS runs, stop once
+    // the 95% confidence intervals of the mean and of sigma are within
+    // ci_target (relative) of their estimates. 0 = always num_runs runs.
+    double ci_target;
+    int min_runs;
+
+    // Background execution
+    bool running;
+    bool cancel;
 
     // Results
     double output_values[MAX_MONTE_CARLO_RUNS];
     int num_results;
+    int num_failed;           // Runs whose simulation failed (not in results)
     double mean;
     double std_dev;
     double min_val;
     double max_val;
     double percentile_1;      // 1% worst case
     double percentile_99;     // 99% worst case
+    double mean_ci;           // 95% confidence half-width of the mean
+    double std_dev_ci;        // 95% confidence half-width of std_dev
+    bool stopped_early;       // ci_target was reached before num_runs
     bool complete;
 } MonteCarloAnalysis;
 
+// Component parameter of a sensitivity entry
+typedef enum {
+    SENS_RESISTANCE = 0,
+    SENS_CAPACITANCE,
+    SENS_INDUCTANCE,
+    SENS_VOLTAGE,             // DC voltage source
+    SENS_CURRENT,             // DC current source
+    SENS_DIODE_IS,
+    SENS_BJT_BF,
+    SENS_BJT_IS,
+    SENS_MOSFET_VTH,
+    SENS_MOSFET_KP,
+    SENS_PARAM_COUNT
+} SensParamType;
+
+// Sensitivity of the output to one component parameter
+typedef struct {
+    int component_id;
+    SensParamType param;
+    double value;             // Nominal parameter value
+    double derivative;        // d(output) / d(value)
+    double normalized;        // (value / |output|) d(output) / d(value)
+    double phase_derivative;  // AC: d(phase) / d(value) (degrees per unit)
+} SensitivityEntry;
+
+// Sensitivity analysis of one probe
+typedef struct {
+    double frequency;         // 0: operating point, else AC response at this frequency (Hz)
+    int probe_idx;
+    double output;            // Probe voltage, or |H| of the AC response
+    double output_phase;      // AC: phase of H (degrees)
+    SensitivityEntry entries[MAX_SENSITIVITIES];  // Largest |normalized| first
+    int num_entries;
+    double default_tolerance; // Tolerance (%) of parameters without their own
+    double worst_case_delta;  // Sum of |d(output)/d(value) * value * tolerance|
+    bool complete;
+} SensitivityAnalysis;
+
 // FFT result
 typedef struct {
     double frequency[FFT_SIZE / 2];
@@ -135,6 +263,17 @@ typedef struct {
     double snr;               // Signal-to-Noise Ratio (dB)
 } FFTResult;
 
+// FFT tables and workspace: twiddle factors and bit-reversal indices,
+// built by the first transform, and the complex array transformed in place
+typedef struct {
+    double cos_table[FFT_SIZE];
+    double sin_table[FFT_SIZE];
+    int bit_rev[FFT_SIZE];
+    bool tables_ready;
+    double real[FFT_SIZE];
+    double imag[FFT_SIZE];
+} FFTWorkspace;
+
 // Waveform measurements
 typedef struct {
     // Voltage measurements
@@ -183,10 +322,14 @@ typedef struct {
     // Monte Carlo
     MonteCarloAnalysis monte_carlo;
 
+    // Sensitivity
+    SensitivityAnalysis sensitivity;
+
     // FFT
     FFTResult fft_results[MAX_PROBES];
     bool fft_enabled;
     int fft_window_type;      // 0=rectangular, 1=Hanning, 2=Hamming, 3=Blackman
+    FFTWorkspace fft_work;
 
     // Math channels (computed from probe channels)
     MathChannel math_channels[MAX_PROBES];
@@ -221,14 +364,22 @@ double analysis_apply_temperature(double base_value, double tempco_ppm,
 // Get temperature coefficient for component type
 double analysis_get_tempco(ComponentType type, int material_type);
 
-// Parametric sweep
-void analysis_sweep_init(AnalysisState *state, int component_id,
+// Parametric sweep. Init allocates the results (false if out of memory);
+// reset frees them.
+bool analysis_sweep_init(AnalysisState *state, int component_id,
                          SweepParamType param, double start, double end,
                          int num_points, bool log_scale);
-void analysis_sweep_step(AnalysisState *state, Circuit *circuit,
-                         Simulation *sim, int probe_idx);
 void analysis_sweep_reset(AnalysisState *state);
 
+// Run every sweep point on replicas of circuit, in chunks of SWEEP_CHUNK
+// points on the pool's workers (on the calling thread if pool is NULL).
+// The swept value is set on the replica and the analysis_type analysis is
+// run; circuit itself is only read. Points are stored in state->sweep and
+// running is cleared on return. Returns false if cancelled, out of memory
+// or the swept component does not exist.
+bool analysis_sweep_execute(AnalysisState *state, const Circuit *circuit,
+                            int probe_idx, ThreadPool *pool);
+
 // Monte Carlo analysis
 void analysis_monte_carlo_init(AnalysisState *state, int num_runs,
                                bool use_tolerance, double global_tol);
@@ -237,27 +388,31 @@ void analysis_monte_carlo_run(AnalysisState *state, Circuit *circuit,
 void analysis_monte_carlo_stats(AnalysisState *state);
 void analysis_monte_carlo_reset(AnalysisState *state);
 
-// Monte Carlo component value manipulation
-// Backup arrays for component values during MC analysis
-typedef struct {
-    double values[MAX_COMPONENTS];    // Original component primary values
-    int num_backed_up;
-} MCBackup;
-
-// Save original component values before MC run
-void analysis_mc_backup_values(Circuit *circuit, MCBackup *backup);
-
-// Restore original component values after MC run
-void analysis_mc_restore_values(Circuit *circuit, MCBackup *backup);
-
-// Apply random Gaussian variation to component values
-// tolerance_pct: tolerance percentage (e.g., 10.0 for 10%)
-void analysis_mc_randomize_values(Circuit *circuit, double tolerance_pct);
-
-// Complete Monte Carlo analysis - runs all iterations
-// Returns true when complete
-bool analysis_monte_carlo_step(AnalysisState *state, Circuit *circuit,
-                               Simulation *sim, int probe_idx, MCBackup *backup);
+// Tolerance and distribution of one component (replaces an earlier one for
+// the same component). Returns false if the table is full.
+bool analysis_monte_carlo_set_tolerance(AnalysisState *state, int component_id,
+                                        double tolerance, MCDistribution distribution,
+                                        double bin_tolerance);
+
+// Run the Monte Carlo trials on replicas of circuit, in parallel on the
+// pool's workers (on the calling thread if pool is NULL). Each worker
+// simulates its own copy; circuit itself is only read. Results and
+// statistics are stored in state->monte_carlo, and running is cleared on
+// return. The results depend only on the configuration and the seed, not
+// on the number of workers. Returns false if cancelled or out of memory.
+bool analysis_monte_carlo_execute(AnalysisState *state, const Circuit *circuit,
+                                  int probe_idx, ThreadPool *pool);
+
+// Sensitivity of a probe's voltage at the operating point (frequency 0) or
+// of its AC response at frequency to every resistor, reactance, DC source,
+// diode, BJT and MOSFET parameter of sim's circuit. One adjoint solve with
+// the factors of the linearized circuit serves all parameters; each one
+// costs two re-stamps of its component. AC sensitivities hold the
+// operating point fixed. Results are stored in state->sensitivity, ranked;
+// the simulation keeps its state. Returns false if the circuit cannot be
+// linearized.
+bool analysis_sensitivity_run(AnalysisState *state, Simulation *sim, int probe_idx,
+                              double frequency);
 
 // FFT analysis
 void analysis_fft_compute(AnalysisState *state, double *samples,
@@ -47,6 +47,10 @@ typedef struct {
     SDL_Thread *freq_sweep_thread;
     bool freq_sweep_thread_running;
 
+    // Background thread for Monte Carlo analysis
+    SDL_Thread *mc_thread;
+    bool mc_thread_running;
+
     // Thread pool for parallel processing
     ThreadPool thread_pool;
     int num_threads;
@@ -108,6 +108,9 @@ Circuit *circuit_create(void);
 void circuit_free(Circuit *circuit);
 void circuit_clear(Circuit *circuit);
 
+// Independent copy of a circuit (for analyses that run on replicas)
+Circuit *circuit_clone(const Circuit *circuit);
+
 // Component operations
 int circuit_add_component(Circuit *circuit, Component *comp);
 void circuit_remove_component(Circuit *circuit, int comp_id);
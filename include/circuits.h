@@ -71,6 +71,8 @@ typedef enum {
     // Signal Processing Circuits
     CIRCUIT_CLAMPER,            // Positive clamper (DC restorer)
     CIRCUIT_PHASE_SHIFT_OSC,    // RC phase shift oscillator
+    // Large Networks
+    CIRCUIT_RC_MESH,            // 16x16 RC diffusion mesh
     CIRCUIT_TYPE_COUNT
 } CircuitTemplateType;
 
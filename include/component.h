@@ -7,6 +7,7 @@
 
 #include "types.h"
 #include "matrix.h"
+#include "sparse.h"
 
 // Maximum terminals per component
 #define MAX_TERMINALS 16
@@ -181,6 +182,8 @@ typedef union {
         double cj;         // CJ - Junction capacitance (F/m²), default: 1e-4
 
         // State variables for capacitor integration
+        // (unused: the history is kept in Component.reactive; the fields
+        // stay so saved circuits keep their layout)
         double vgs_prev;   // Previous Vgs for capacitor integration
         double vgd_prev;   // Previous Vgd for capacitor integration
         double i_cgs;      // Gate-source capacitor current
@@ -680,6 +683,13 @@ typedef struct Component {
     int voltage_var_idx;
     bool needs_voltage_var;
 
+    // Resolved by component_setup once per topology (not saved)
+    int matrix_nodes[MAX_TERMINALS];  // 1-based matrix node per terminal, 0 = ground
+    int stamp_first;                  // First stamp handle of this component
+    int subcircuit_base;              // COMP_SUBCIRCUIT: first 1-based index of its private block
+    bool ideal_switch;                // Piecewise-linear model (component_set_ideal_switch)
+    bool switch_on;                   // Its committed state (diodes, analog switches)
+
     // Properties
     ComponentProps props;
 
@@ -688,6 +698,16 @@ typedef struct Component {
 
     // Thermal state (for power dissipation / magic smoke)
     ThermalState thermal;
+
+    // Newton bypass cache and step limiting state (diodes, BJTs, MOSFETs);
+    // accepted_limit is the limiting state of the last accepted step, which
+    // a rejected attempt returns to
+    DeviceBypass bypass;
+    DeviceLimit limit;
+    DeviceLimit accepted_limit;
+
+    // Integration history of capacitors, inductors and device capacitances
+    ReactiveState reactive;
 } Component;
 
 // Component type info
@@ -725,10 +745,97 @@ bool component_contains_point(Component *comp, float px, float py);
 // Check if point is near a terminal
 int component_get_terminal_at(Component *comp, float px, float py, float threshold);
 
-// Stamp component into MNA matrix
-void component_stamp(Component *comp, Matrix *A, Vector *b,
-                     int *node_map, int num_nodes,
-                     double time, Vector *prev_solution, double dt);
+// Device bypass: a diode, BJT or MOSFET whose controlling voltages moved
+// less than RELTOL * |v| + VNTOL since its last evaluation (with unchanged
+// parameters and temperature) stamps its cached linearized model instead of
+// re-evaluating it. Much tighter than SPICE's reltol because Newton
+// convergence here is an absolute 1e-9 V.
+#define BYPASS_RELTOL 1e-6
+#define BYPASS_VNTOL 1e-6
+
+// Resolve terminal node IDs to matrix indices (after the node map is built)
+// and clear the bypass cache, limiting state and integration history
+void component_setup(Component *comp, const int *node_map);
+
+// True if the component's matrix stamp depends only on its properties and
+// dt (not on the solution or time), so a circuit made only of such
+// components is linear and needs a single solve per step
+bool component_is_linear(const Component *comp);
+
+// Device evaluation is two-phase. component_stamp is the load: it reads the
+// device state of the last accepted step and writes nothing but its own
+// per-load scratch (bypass and limiting state, companion coefficients), so
+// it may run any number of times per step and for steps that are thrown
+// away. State that advances with time - integration history, switch and
+// latch states, fuse i²t, battery charge, motor speed, displayed currents,
+// the wireless channels - changes only in component_accept_step.
+
+// Stamp component into the sparse MNA matrix (component_setup must have run).
+// prev_solution is the latest Newton iterate (linearization point), history
+// the solution at the last accepted time point. Reactive elements build
+// their companion models from integ and their own integration history, and
+// from history until they have one. ctx is the simulation's environment and
+// wireless channels.
+void component_stamp(Component *comp, SparseMatrix *A, Vector *b, int num_nodes,
+                     double time, Vector *prev_solution, Vector *history,
+                     const Integrator *integ, const SimContext *ctx);
+
+// Commit the solution of an accepted step of dt ending at `time` (dt = 0 for
+// the DC operating point): integration history, device state and switching
+// events (component_event_commit). TX antennas add their voltage to the
+// channels of ctx. Returns true if the device switched.
+bool component_accept_step(Component *comp, const Vector *solution, int num_nodes,
+                           double time, double dt, SimContext *ctx);
+
+// Discard the loads of a rejected step attempt: the next attempt starts
+// from the state of the last accepted step
+void component_reject_step(Component *comp);
+
+// Largest step that keeps the local truncation error of the component's
+// reactive states within tol, estimated from the step just solved
+// (solution) and the accepted history. INFINITY if there is no estimate.
+double component_truncation_step(const Component *comp, const Vector *solution,
+                                 const Integrator *integ, const TruncationTolerance *tol);
+
+// Next time after `time` at which the component's source waveform has a
+// corner or a jump, INFINITY if it has none scheduled. Times closer than
+// BREAKPOINT_RESOLUTION count as the same instant.
+#define BREAKPOINT_RESOLUTION 1e-12
+double component_next_breakpoint(const Component *comp, double time);
+
+// Zero-crossing events. Relays, fuses, the 555 comparators, SCRs, TRIACs and
+// Schmitt triggers switch state when a quantity crosses a threshold. Each
+// reports a guard for the switch it can make next, which fires when the
+// guard goes from negative to zero or above. Guards are evaluated on a
+// solution `elapsed` seconds after the last accepted one (0 for the
+// accepted solution itself). The simulator can then locate the crossing
+// inside a step before the state changes.
+#define MAX_EVENT_GUARDS 1
+int component_event_guards(const Component *comp, const Vector *solution, int num_nodes,
+                           double elapsed, double *guards);
+
+// Commit the state of an accepted solution: switch every guard that fired
+// and update running quantities (fuse i²t, relay coil current). Returns
+// true if the device switched.
+bool component_event_commit(Component *comp, const Vector *solution, int num_nodes,
+                            double time, double elapsed);
+
+// Ideal-switch mode (simulation_enable_ideal_switches): SPST switches,
+// relays, analog switches and diodes with the ideal flag stamp a fixed on or
+// off model and change state only through their event guards, between time
+// steps, so the MNA matrix takes one value per combination of switch
+// states. A conducting ideal diode is IDEAL_DIODE_VF in series with
+// IDEAL_DIODE_R_ON and turns off when its current reverses.
+#define IDEAL_DIODE_VF 0.7
+#define IDEAL_DIODE_R_ON 0.01
+#define IDEAL_SWITCH_R_OFF 1e9
+
+// Select the model at setup. Returns true if the component is modeled as
+// an ideal switch; diodes and analog switches start off.
+bool component_set_ideal_switch(Component *comp, bool enable);
+
+// Committed state of an ideal switch (closed, energized or conducting)
+bool component_ideal_switch_on(const Component *comp);
 
 // Get display value string
 void component_get_value_string(Component *comp, char *buf, size_t buf_size);
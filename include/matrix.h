@@ -5,6 +5,7 @@
 #ifndef MATRIX_H
 #define MATRIX_H
 
+#include <stddef.h>
 #include "types.h"
 
 // Matrix structure
@@ -39,6 +40,20 @@ void vector_add(Vector *v, int idx, double val);
 Vector *vector_clone(Vector *v);
 double vector_norm(Vector *v);
 
+// Vector over caller-owned storage (no allocation, never vector_free it)
+void vector_init(Vector *v, double *data, int size);
+
+// Copy src into dst without allocating (sizes must match)
+void vector_copy(Vector *dst, const Vector *src);
+
+// Counted heap allocation for the solver modules (matrix.c, sparse.c and
+// the simulation workspace). The count is per thread, so the allocations
+// made by one simulation step can be measured while other threads run.
+void *solver_malloc(size_t size);
+void *solver_calloc(size_t count, size_t size);
+void *solver_realloc(void *ptr, size_t size);
+unsigned long solver_alloc_count(void);
+
 // Linear solver - solves Ax = b, returns x
 Vector *linear_solve(Matrix *A, Vector *b);
 
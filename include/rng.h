@@ -0,0 +1,46 @@
+/**
+ * Circuit Playground - Counter-Based Random Numbers
+ *
+ * Every number is a pure function of a key and a counter: the seed, a
+ * stream (a component, a Monte Carlo run, ...) and the position in that
+ * stream (a time point, a dimension, ...). There is no generator state, so
+ * draws are reproducible whatever order they are made in, and any number
+ * of threads can draw at once. The mixing function is the splitmix64
+ * finalizer applied to the key, then to the counter.
+ */
+
+#ifndef RNG_H
+#define RNG_H
+
+#include <stdint.h>
+
+// Use of the generator for one object: the domain keeps different uses of
+// the same id apart
+typedef enum {
+    RNG_DOMAIN_SOURCE = 1,      // Random sources (noise, rand() terms), per component
+    RNG_DOMAIN_SMOKE            // Smoke particles, per component
+} RngDomain;
+
+#define RNG_STREAM(domain, id) (((uint64_t)(domain) << 32) | (uint32_t)(id))
+
+// 64 random bits
+uint64_t rng_bits(uint64_t seed, uint64_t stream, uint64_t counter);
+
+// Uniform in (0, 1)
+double rng_uniform(uint64_t seed, uint64_t stream, uint64_t counter);
+
+// Standard normal. Counters 2k and 2k+1 are the two halves of one
+// Box-Muller pair.
+double rng_gaussian(uint64_t seed, uint64_t stream, uint64_t counter);
+
+// The draws of counters counter .. counter + count - 1, as the single
+// draws above return them
+void rng_uniform_batch(uint64_t seed, uint64_t stream, uint64_t counter,
+                       double *out, int count);
+void rng_gaussian_batch(uint64_t seed, uint64_t stream, uint64_t counter,
+                        double *out, int count);
+
+// Inverse of the standard normal CDF (Acklam, relative error < 1.2e-9)
+double rng_normal_quantile(double p);
+
+#endif // RNG_H
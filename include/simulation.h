@@ -8,13 +8,44 @@
 #include "types.h"
 #include "circuit.h"
 #include "matrix.h"
+#include "sparse.h"
+#include "threadpool.h"
 
 // Simulation configuration
 #define DEFAULT_TIME_STEP 1e-7    // 100 nanoseconds - good for observing transients
 #define MIN_TIME_STEP 1e-9        // 1 nanosecond minimum
 #define MAX_TIME_STEP 0.01        // 10 milliseconds maximum
 #define MAX_ITERATIONS 50
-#define CONVERGENCE_TOL 1e-9
+
+// Newton convergence, per unknown as in SPICE: an update has converged when
+// every node voltage moved by at most reltol * |v| + vntol and every branch
+// current by at most reltol * |i| + abstol (reltol and abstol are those of
+// the truncation error), and the load at the result then satisfies each
+// equation to within reltol of its largest term plus the same floor
+#define NEWTON_VNTOL 1e-6
+
+// Vectors in the solver workspace: rhs, solution, prev_solution,
+// saved_solution, Newton trial, iterate, residual, residual scale and the
+// two accepted solutions before the current one
+#define SIM_WORKSPACE_VECTORS 10
+
+// Modified Newton: the LU factors of an earlier iteration (or time step) are
+// kept while successive updates shrink by at least this ratio, and only the
+// residual is reloaded. A slower contraction, a new dt or a changed matrix
+// pattern triggers a refactorization. Factors are only reused where a
+// refactor costs at least NEWTON_REUSE_COST_RATIO times a load and a pair of
+// triangular solves; below that the extra iterations reuse needs cost more
+// than the factorizations it saves. Built-in circuits stay under 0.5, the RC
+// mesh template is above 2.5.
+#define NEWTON_REFACTOR_RATE 0.5
+#define NEWTON_FIRST_UPDATE_RATIO 2.0   // First update of a step vs. the previous step's
+#define NEWTON_MAX_REUSE 8              // Iterations on one set of factors before refactoring
+#define NEWTON_REUSE_COST_RATIO 2.0     // Refactor vs. load + solve work at which reuse pays
+
+// Damped Newton: an update that increases the residual is halved, at most
+// this many times in a row
+#define NEWTON_MAX_BACKTRACKS 4
+#define NEWTON_DAMP_FLOOR 1e-9          // Residuals below this never trigger damping
 
 // Oscilloscope history point
 typedef struct {
@@ -32,12 +63,46 @@ typedef struct {
 // Maximum points in frequency sweep
 #define MAX_FREQ_POINTS 1000
 
-// Adaptive time-stepping configuration
-#define ADAPTIVE_ERROR_TOL 0.05       // 5% relative error tolerance
-#define ADAPTIVE_SAFETY_FACTOR 0.9    // Safety factor for step sizing
-#define ADAPTIVE_MIN_FACTOR 0.5       // Minimum step reduction factor
+// Frequency points a sweep worker claims at a time
+#define AC_SWEEP_CHUNK 16
+
+// Adaptive time-stepping configuration: the step follows the local
+// truncation error of capacitor charges and inductor fluxes (see
+// TruncationTolerance; the defaults are SPICE's)
+#define LTE_RELTOL 1e-3
+#define LTE_ABSTOL 1e-12
+#define LTE_CHGTOL 1e-14
+#define LTE_TRTOL 7.0
+#define ADAPTIVE_REJECT_RATIO 0.9     // Redo steps longer than allowed / this ratio
+#define ADAPTIVE_MIN_FACTOR 0.125     // Largest step reduction per retry
+#define ADAPTIVE_SAFETY 0.9           // Retried steps aim this far below the allowed one
 #define ADAPTIVE_MAX_FACTOR 2.0       // Maximum step increase factor
-#define ADAPTIVE_STEADY_THRESHOLD 0.001  // Threshold for "steady" circuit (0.1%)
+
+// Source breakpoints: adaptive steps land exactly on waveform edges and
+// restart after one with a step this fraction of the step the error allowed
+#define MAX_BREAKPOINTS 64
+#define BREAKPOINT_RESTART_FACTOR 0.1
+
+// Zero-crossing events (component_event_guards) are located to this
+// fraction of the nominal step, redoing the step at most this many times
+#define EVENT_TIME_RESOLUTION 1e-3
+#define EVENT_MAX_ITERATIONS 8
+
+// Ideal-switch mode: with switches, relays and ideal diodes piecewise
+// linear, the MNA matrix takes one value per combination of their states
+// (the switch configuration). The LU factors of the most recently used
+// configurations are kept, so a configuration seen before costs a lookup
+// instead of a refactor. The operating point is solved again after the
+// switches it implies are committed, at most this many times.
+#define LU_CACHE_SIZE 8
+#define IDEAL_SWITCH_MAX_DC_PASSES 16
+
+typedef struct {
+    bool used;
+    uint64_t topology;              // Switch states the entry belongs to, one bit per switch
+    unsigned long last_use;         // LRU clock at the last selection
+    SparseLU *lu;
+} LUCacheEntry;
 
 // Simulation engine
 typedef struct Simulation {
@@ -53,20 +118,80 @@ typedef struct Simulation {
     bool adaptive_enabled;          // Enable adaptive stepping
     double dt_target;               // Target/nominal time step
     double dt_actual;               // Actual time step used this iteration
-    double error_estimate;          // Estimated local truncation error
+    double error_estimate;          // Last step relative to the step its truncation error allows
+    TruncationTolerance lte;        // Truncation error tolerances
     int step_rejections;            // Number of rejected steps (for UI)
     int total_step_rejections;      // Total rejections since start
     double adaptive_factor;         // Current step size multiplier (for UI)
     Vector *saved_solution;         // Saved solution for step rejection/retry
 
-    // Solution vectors
+    // Upcoming breakpoints in time order (see simulation_add_breakpoint)
+    double breakpoints[MAX_BREAKPOINTS];
+    int num_breakpoints;
+
+    // Solution vectors (point into the workspace; NULL until DC analysis)
     Vector *solution;
     Vector *prev_solution;
     int solution_size;
 
+    // Solver workspace arena: one block, sized when the topology is compiled,
+    // backs the RHS and all solution vectors. Together with the persistent
+    // matrix and LU this keeps the steady-state step loop allocation-free.
+    double *workspace;
+    Vector workspace_vectors[SIM_WORKSPACE_VECTORS];
+    Vector *trial;                  // Newton result for the step being attempted
+    Vector *iterate;                // Previous Newton iterate
+    Vector *residual;               // Modified Newton residual
+    Vector *residual_scale;         // Term size of each equation (convergence test)
+    Vector *past_solution[2];       // Accepted solutions one and two steps back
+    unsigned long step_alloc_count; // Solver heap allocations in the last simulation_step
+
+    // Sparse LU of the MNA matrix: the symbolic analysis is redone only when
+    // the topology changes, and the pivot sequence is reused between solves
+    SparseLU *lu;
+
+    // Factors per switch configuration: lu points into the entry of the
+    // current one. Without ideal switches only entry 0 is used.
+    bool ideal_switches;            // Ideal-switch mode (off by default)
+    int num_ideal_switches;         // Components modeled as ideal switches
+    LUCacheEntry lu_cache[LU_CACHE_SIZE];
+    int lu_active;                  // Entry lu belongs to
+    unsigned long lu_cache_clock;
+    unsigned long lu_cache_hits;    // Configuration changes served by a cached entry
+    unsigned long lu_cache_misses;  // Configuration changes that took a new entry
+
+    // MNA system, kept across loads: its stamp handles are compiled on the
+    // first load after simulation_dc_analysis resolves the topology
+    SparseMatrix *matrix;
+    Vector *rhs;                    // Points into the workspace
+    int gmin_first;                 // Stamp handle of the first GMIN entry
+    int num_compiled_components;    // Component count the handles were built for
+    bool linear_circuit;            // Every component is linear: one solve per step
+
+    // Modified Newton (Jacobian reuse across iterations and time steps)
+    bool modified_newton;           // Enabled (default)
+    double jacobian_ag0;            // Leading integration coefficient of the current factors
+    int jacobian_age;               // Iterations solved with the current factors
+    double newton_first_change;     // Size of the first Newton update of the last step
+
+    // Companion-model integration of capacitors and inductors
+    Integrator integrator;
+
+    // Environment and wireless channels of this simulation's components
+    SimContext context;
+
     // Convergence tracking
-    int iteration_count;
-    bool converged;
+    bool newton_limited;            // The last load limited a junction voltage
+    int iteration_count;            // Newton iterations in the last simulation_step
+    int dc_iteration_count;         // Newton iterations of the last operating point
+    int step_factorizations;        // LU factorizations in the last simulation_step
+    bool converged;                 // The last Newton solve of a step converged
+    double vntol;                   // Absolute voltage tolerance (NEWTON_VNTOL)
+    int first_block;                // First unknown after the branch currents
+
+    // Newton predictor: accepted solutions since the last discontinuity
+    // (sim->solution and past_solution; at most 3)
+    int predictor_points;
 
     // History for oscilloscope
     HistoryPoint history[MAX_HISTORY];
@@ -77,6 +202,10 @@ typedef struct Simulation {
     int history_decimate_counter;   // Counter for decimation
     int history_decimate_factor;    // Current decimation factor (record every Nth sample)
 
+    // Debug: append probe values to probe_debug.log every 1000 samples
+    bool probe_log;
+    int probe_log_count;
+
     // Error message
     char error_msg[256];
     bool has_error;
@@ -120,6 +249,14 @@ void simulation_reset(Simulation *sim);
 // Run DC analysis (operating point)
 bool simulation_dc_analysis(Simulation *sim);
 
+// Operating point again after component values changed but not the
+// topology (the caller guarantees it): the compiled MNA system and the
+// symbolic analysis of its factors are reused. Newton starts from guess (a
+// copy of an earlier solution of the same system), or from zero if it is
+// NULL like simulation_dc_analysis, which it falls back to when nothing is
+// compiled.
+bool simulation_dc_resolve(Simulation *sim, const Vector *guess);
+
 // Run single time step
 bool simulation_step(Simulation *sim);
 
@@ -128,17 +265,61 @@ void simulation_set_speed(Simulation *sim, double speed);
 void simulation_set_time_step(Simulation *sim, double dt);
 
 // Auto-adjust time step based on circuit's highest frequency signal
-// Returns the new time step that ensures adequate sampling (at least 50 samples/cycle)
+// Returns the new time step that ensures adequate sampling (at least 50 samples/cycle,
+// fewer with a second-order integration method than with backward Euler)
 double simulation_auto_time_step(Simulation *sim);
 
-// Adaptive time-stepping control
+// Adaptive time-stepping control (off by default). With it on, steps vary
+// in length: history samples are no longer evenly spaced in time.
 void simulation_enable_adaptive(Simulation *sim, bool enable);
 bool simulation_is_adaptive_enabled(Simulation *sim);
 
 // Get adaptive stepping statistics for UI display
 double simulation_get_adaptive_factor(Simulation *sim);  // Current dt multiplier (1.0 = target)
 int simulation_get_step_rejections(Simulation *sim);     // Rejections this frame
-double simulation_get_error_estimate(Simulation *sim);   // Estimated error (0-1)
+double simulation_get_error_estimate(Simulation *sim);   // Step / allowed step (<= 1 when accepted)
+
+// Truncation error tolerances of the adaptive step control
+void simulation_set_tolerances(Simulation *sim, double reltol, double abstol, double chgtol);
+
+// Absolute voltage tolerance of the Newton convergence test (NEWTON_VNTOL).
+// Newton shares reltol and abstol with the truncation error.
+void simulation_set_voltage_tolerance(Simulation *sim, double vntol);
+
+// Schedule a time the adaptive stepper must land on exactly. Sources publish
+// their own edges every step; this is for other discontinuities. Returns
+// false if the time has passed or the queue is full.
+bool simulation_add_breakpoint(Simulation *sim, double time);
+
+// Modified Newton control (on by default)
+void simulation_enable_modified_newton(Simulation *sim, bool enable);
+bool simulation_is_modified_newton_enabled(Simulation *sim);
+
+// Integration method of capacitors and inductors (Gear-2 by default)
+void simulation_set_integration(Simulation *sim, IntegrationMethod method);
+IntegrationMethod simulation_get_integration(Simulation *sim);
+
+// Ideal-switch mode (see LU_CACHE_SIZE and component_set_ideal_switch).
+// Takes effect at the next DC analysis.
+void simulation_enable_ideal_switches(Simulation *sim, bool enable);
+bool simulation_is_ideal_switches_enabled(Simulation *sim);
+
+// Switch configuration changes since the last DC analysis that found their
+// factors in the LU cache, and those that did not
+void simulation_get_lu_cache_stats(Simulation *sim, unsigned long *hits,
+                                   unsigned long *misses);
+
+// Newton iterations and LU factorizations (full or refactor) of the last step
+int simulation_get_step_iterations(Simulation *sim);
+int simulation_get_step_factorizations(Simulation *sim);
+
+// Newton iterations of the last operating point (all ideal-switch passes)
+int simulation_get_dc_iterations(Simulation *sim);
+
+// Device bypass totals over the circuit's diodes, BJTs and MOSFETs (each
+// component also keeps its own counts in comp->bypass)
+void simulation_get_bypass_stats(Simulation *sim, unsigned long *hits,
+                                 unsigned long *evaluations);
 
 // Get results
 double simulation_get_node_voltage(Simulation *sim, int node_id);
@@ -153,14 +334,42 @@ const char *simulation_get_error(Simulation *sim);
 void simulation_clear_error(Simulation *sim);
 
 // Frequency response / Bode plot
-// Run frequency sweep from start_freq to stop_freq (in Hz)
-// Uses source_node as input reference, probe_node as output
+// Small-signal AC analysis from start_freq to stop_freq (in Hz, log spaced):
+// the circuit is linearized at its DC operating point and probe_node's
+// response to the first AC voltage source is solved at each frequency (see
+// ac.h). The simulation state is left as it was. source_node is recorded
+// for the plot only. The points are solved in chunks on the pool's workers
+// (serially if pool is NULL), and freq_response is filled when the sweep
+// completes.
 bool simulation_freq_sweep(Simulation *sim, double start_freq, double stop_freq,
-                           int source_node, int probe_node, int num_points);
+                           int source_node, int probe_node, int num_points,
+                           ThreadPool *pool);
 
 // Cancel running frequency sweep
 void simulation_cancel_freq_sweep(Simulation *sim);
 
+// Small-signal response of probe_node at one frequency, at the current
+// operating point (solved first if there is none); like the sweep it leaves
+// the simulation state as it was
+bool simulation_ac_response(Simulation *sim, double freq, int probe_node,
+                            FreqResponsePoint *point);
+
+// Adjoint sensitivity of probe_node's voltage at the operating point (freq
+// 0) or of its small-signal response at freq. Begin linearizes once, as
+// AC analysis does, and solves the adjoint system with the factors of the
+// linearized circuit; after that the weight of any component is one
+// re-stamp of that component alone: lambda^T F_c(x) at DC (F_c its
+// residual), lambda^T Y_c x in AC (Y_c its admittance stamp, with the
+// operating point held). The change of the output for a parameter change
+// is minus the change of this weight. The simulation keeps its state.
+typedef struct SimSensitivity SimSensitivity;
+
+SimSensitivity *simulation_sensitivity_begin(Simulation *sim, int probe_node, double freq);
+void simulation_sensitivity_output(const SimSensitivity *sens, double *re, double *im);
+bool simulation_sensitivity_component(Simulation *sim, SimSensitivity *sens,
+                                      Component *comp, double *re, double *im);
+void simulation_sensitivity_end(Simulation *sim, SimSensitivity *sens);
+
 // Get frequency response data
 int simulation_get_freq_response(Simulation *sim, FreqResponsePoint *points, int max_points);
 
@@ -0,0 +1,201 @@
+/**
+ * Circuit Playground - Sparse Matrix Storage for the MNA Solver
+ *
+ * Components stamp into a triplet list (row, col, value) through sparse_add,
+ * which has the same semantics as matrix_add. Before solving, the triplets are
+ * compressed into compressed-sparse-column (CSC) form with duplicates summed.
+ * Memory and solve time scale with the number of nonzeros instead of n^2.
+ *
+ * Stamp handles: the sequence of sparse_add calls made by one full load of
+ * the circuit is the same on every Newton iteration. sparse_compile records
+ * it once and maps the k-th call to its slot in the CSC value array, so later
+ * loads write straight into that slot (sparse_begin_load / sparse_end_load).
+ */
+
+#ifndef SPARSE_H
+#define SPARSE_H
+
+#include "types.h"
+#include "matrix.h"
+
+// Pivots smaller than this are treated as singular (matches linear_solve)
+#define SPARSE_PIVOT_EPS 1e-15
+
+// Sparse square matrix: triplet builder + compressed-column store
+typedef struct {
+    int n;                  // Dimension (n x n)
+
+    // Triplet builder (filled by sparse_add)
+    int *trip_row;
+    int *trip_col;
+    double *trip_val;
+    int trip_count;
+    int trip_capacity;
+
+    // Compressed sparse column store (filled by sparse_compress)
+    int *col_ptr;           // Column start offsets, size n+1
+    int *row_idx;           // Row index of each entry, sorted within a column
+    double *values;         // Value of each entry
+    int nnz;                // Number of stored entries
+    int nnz_capacity;
+    bool compressed;        // CSC store is up to date with the triplets
+
+    bool alloc_failed;      // A triplet could not be stored
+
+    // Stamp handles (valid once compiled): the recorded triplet sequence is
+    // kept as the key, handles[k] is the value slot of the k-th sparse_add
+    bool compiled;
+    int *handles;
+    int num_handles;        // 0 until compiled, so sparse_add records triplets
+    int cursor;             // Handle expected by the next sparse_add
+
+    // Entries stamped during a compiled load that are outside the pattern;
+    // sparse_end_load folds them into a grown pattern
+    int *extra_row;
+    int *extra_col;
+    double *extra_val;
+    int extra_count;
+    int extra_capacity;
+    bool pattern_changed;
+} SparseMatrix;
+
+// Create/destroy (nnz_hint may be 0)
+SparseMatrix *sparse_create(int n, int nnz_hint);
+void sparse_free(SparseMatrix *A);
+
+// Drop all entries but keep the allocated storage
+void sparse_clear(SparseMatrix *A);
+
+// Out-of-line part of sparse_add: recording, range checks and entries that
+// do not match the next handle
+void sparse_add_slow(SparseMatrix *A, int row, int col, double val);
+
+// Accumulate val into A(row, col); out-of-range indices are ignored.
+// When compiled, a call that matches the recorded sequence is a single
+// store through its handle.
+static inline void sparse_add(SparseMatrix *A, int row, int col, double val) {
+    int k = A->cursor;
+    if (k < A->num_handles && A->trip_row[k] == row && A->trip_col[k] == col) {
+        A->values[A->handles[k]] += val;
+        A->cursor = k + 1;
+        return;
+    }
+    sparse_add_slow(A, row, col, val);
+}
+
+// Freeze the pattern of the recorded triplets and build the stamp handles
+bool sparse_compile(SparseMatrix *A);
+
+// Start a load: zero the values (compiled) or the triplets (recording)
+void sparse_begin_load(SparseMatrix *A);
+
+// Finish a load: compiles a recorded load, and grows the pattern if a
+// compiled load stamped entries outside it (sets pattern_changed)
+bool sparse_end_load(SparseMatrix *A);
+
+// Handle position of the next sparse_add. Saving it before a component
+// stamps while recording and restoring it on later loads keeps a component
+// whose stamp sequence varied from misaligning the ones after it.
+int sparse_get_cursor(SparseMatrix *A);
+void sparse_set_cursor(SparseMatrix *A, int pos);
+
+// Convert the triplets to CSC form, summing duplicate entries
+bool sparse_compress(SparseMatrix *A);
+
+// Read A(row, col) from the compressed store (0 if not present)
+double sparse_get(SparseMatrix *A, int row, int col);
+
+// Residual r = b - Ax from the compressed store (r must not alias x)
+bool sparse_residual(SparseMatrix *A, const Vector *x, const Vector *b, Vector *r);
+
+// Size of the terms of each equation of Ax = b at x, for scaling its
+// residual: m[i] = |b[i]| + sum over j of |A(i, j) x[j]|
+bool sparse_residual_scale(SparseMatrix *A, const Vector *x, const Vector *b, Vector *m);
+
+// Solve Ax = b with a one-off sparse LU factorization, returns x
+Vector *sparse_solve(SparseMatrix *A, Vector *b);
+
+// Threshold partial pivoting: any row within this fraction of the largest
+// candidate may be chosen; the preferred (matched) row first, otherwise the
+// sparsest row (Markowitz criterion) to limit fill
+#define SPARSE_PIVOT_THRESHOLD 0.1
+
+// Pivot acceptance threshold for sparse_lu_refactor: a reused pivot must be
+// at least this fraction of the largest entry in its column
+#define SPARSE_REFACTOR_PIVOT_TOL 1e-3
+
+// Sparse LU factorization PAQ = LU, split into three phases like KLU:
+//   sparse_lu_analyze   - symbolic: zero-free diagonal matching, minimum
+//                         degree column ordering and storage for the fill
+//                         pattern; once per matrix pattern (topology)
+//   sparse_lu_factor    - numeric with partial pivoting; records the pivot
+//                         sequence and the L/U nonzero pattern
+//   sparse_lu_refactor  - numeric only, reusing the pivot sequence and L/U
+//                         pattern of the last sparse_lu_factor
+typedef struct {
+    int n;
+
+    // Symbolic analysis
+    bool analyzed;
+    int *col_perm;          // Column ordering Q: column col_perm[k] is eliminated at step k
+    int *pref_row;          // Preferred pivot row for step k (structurally nonzero), or -1
+    int *row_count;         // Nonzeros per row of the analyzed matrix (Markowitz cost)
+    int *pattern_col_ptr;   // Pattern of the analyzed matrix (to detect changes)
+    int *pattern_row_idx;
+    int pattern_nnz;
+
+    // Numeric factors: L is unit lower triangular (diagonal stored first),
+    // U is upper triangular (diagonal stored last), both column-compressed
+    bool factored;
+    int *Lp, *Li;
+    double *Lx;
+    int *Up, *Ui;
+    double *Ux;
+    int lnz_capacity, unz_capacity;
+    int *pinv;              // pinv[row] = pivot step of that row
+    int *perm;              // perm[k] = row chosen as pivot at step k
+    double *factor_values;  // Matrix values the current factors were computed from
+
+    // Workspace
+    double *x;
+    int *xi, *stack, *pstack, *mark;
+
+    // Statistics
+    int fill_nnz;           // Nonzeros in L + U after the last full factorization
+    int refactor_ops;       // Multiply-adds of a numeric refactor with those pivots
+    int factor_count;       // Full factorizations (with pivot search)
+    int refactor_count;     // Numeric refactorizations that reused the pivots
+    int reuse_count;        // Solves that reused the factors of an identical matrix
+} SparseLU;
+
+SparseLU *sparse_lu_create(void);
+void sparse_lu_free(SparseLU *lu);
+
+// Forget the symbolic analysis and factors (call when the topology changes)
+void sparse_lu_invalidate(SparseLU *lu);
+
+// True if A has exactly the pattern that was analyzed
+bool sparse_lu_pattern_matches(SparseLU *lu, SparseMatrix *A);
+
+// True if the current factors were computed from exactly A (pattern and
+// values), so a solve can reuse them without refactoring
+bool sparse_lu_values_match(SparseLU *lu, SparseMatrix *A);
+
+// Phase 1: symbolic analysis of A's pattern
+bool sparse_lu_analyze(SparseLU *lu, SparseMatrix *A);
+
+// Phase 2: numeric factorization with partial pivoting
+bool sparse_lu_factor(SparseLU *lu, SparseMatrix *A);
+
+// Phase 3: numeric refactorization with the previous pivot sequence.
+// Returns false if the pattern differs or a reused pivot became too small;
+// the caller should then fall back to sparse_lu_factor.
+bool sparse_lu_refactor(SparseLU *lu, SparseMatrix *A);
+
+// Solve LUx = b using the current factors (x may alias b)
+bool sparse_lu_solve(SparseLU *lu, Vector *b, Vector *x);
+
+// Solve A^T x = b with the factors of A (adjoint systems; x may alias b)
+bool sparse_lu_solve_transpose(SparseLU *lu, Vector *b, Vector *x);
+
+#endif // SPARSE_H
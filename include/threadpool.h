@@ -55,6 +55,8 @@ typedef struct {
     atomic_int_t active_tasks;
     atomic_int_t pending_tasks;
 
+    int next_thread_id;     // Id of the next worker to start (0..num_threads-1)
+
     bool shutdown;
     bool initialized;
 } ThreadPool;
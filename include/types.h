@@ -401,18 +401,19 @@ static inline int snap_to_grid(float val) {
 }
 
 // ============================================================================
-// Global Environment Settings
+// Environment Settings
 // ============================================================================
-// These affect LDR (photoresistor) and thermistor components globally
+// These affect LDR (photoresistor), thermistor and semiconductor models.
+// Each simulation has its own (SimContext).
+
+#define ENVIRONMENT_DEFAULT_LIGHT        0.5
+#define ENVIRONMENT_DEFAULT_TEMPERATURE  25.0
 
 typedef struct {
-    double light_level;     // Global light level (0.0=dark to 1.0=bright), default: 0.5
-    double temperature;     // Global ambient temperature (°C), default: 25.0
+    double light_level;     // Light level (0.0=dark to 1.0=bright), default: 0.5
+    double temperature;     // Ambient temperature (°C), default: 25.0
 } EnvironmentState;
 
-// Global environment instance (defined in component.c)
-extern EnvironmentState g_environment;
-
 // ============================================================================
 // Thermal & Failure State (for destructive component failure / magic smoke)
 // ============================================================================
@@ -446,6 +447,89 @@ typedef struct {
     int num_smoke;                // Active smoke particle count
 } ThermalState;
 
+// Newton bypass cache for a nonlinear device: the controlling voltages and
+// model parameters (including temperature) of its last full evaluation, and
+// the linearized model (conductances and equivalent currents) computed there
+#define BYPASS_MAX_PARAMS 10
+
+typedef struct {
+    bool valid;
+    double v[2];                  // Controlling voltages (Vd / Vbe, Vbc / Vgs, Vds)
+    double params[BYPASS_MAX_PARAMS];
+    double g[4];                  // Linearized conductances
+    double i[3];                  // Equivalent currents and other cached results
+    unsigned long evaluations;    // Full model evaluations
+    unsigned long hits;           // Loads that reused the cached model
+} DeviceBypass;
+
+// Newton step limiting state for a junction device (pnjlim/fetlim): the
+// limited controlling voltages of its previous load
+typedef struct {
+    bool valid;
+    double v[2];                  // Vd / Vbe, Vbc / Vgs, Vds
+    bool limited;                 // The last load changed a voltage by limiting
+} DeviceLimit;
+
+// Integration method for the companion models of capacitors and inductors
+typedef enum {
+    INTEGRATE_EULER,              // Backward Euler: first order, heavily damped
+    INTEGRATE_TRAPEZOIDAL,        // Trapezoidal rule: second order, no damping
+    INTEGRATE_GEAR2,              // Gear-2 (BDF2): second order, damps ringing
+    INTEGRATE_METHOD_COUNT
+} IntegrationMethod;
+
+// Integration coefficients of the step being solved. The derivative of a
+// state x is approximated as
+//   dx/dt = ag[0]*x + ag[1]*x1 + ag[2]*x2 + ab1*(dx/dt)1
+// with x1, x2 its values one and two accepted steps back and (dx/dt)1 its
+// derivative at the last accepted step (scaled by C or L like the others)
+typedef struct {
+    IntegrationMethod method;     // Method selected by the user
+    int order;                    // Order used this step (1 right after DC or a breakpoint)
+    int points;                   // Accepted points behind this step (0 during DC and
+                                  // past a breakpoint, at most 3)
+    bool restart;                 // This step follows a breakpoint: first order
+    double dt;                    // Step being solved
+    double dt_prev;               // Previous accepted step
+    double dt_prev2;              // Accepted step before that
+    double ag[3];
+    double ab1;
+} Integrator;
+
+// Integration history of a reactive element, one entry per energy storage
+// state (capacitor voltage or inductor current). Each state is read from
+// the solution as sol[p] - sol[m] minus r times the element's own derivative
+// term (the voltage drop across a series resistance).
+#define REACTIVE_MAX_STATES 2
+
+typedef struct {
+    bool valid;                   // History holds an accepted point
+    double x1[REACTIVE_MAX_STATES];   // State at the last accepted step
+    double x2[REACTIVE_MAX_STATES];   // State one step before that
+    double x3[REACTIVE_MAX_STATES];   // And one more (truncation error of Gear-2/trapezoidal)
+    double d1[REACTIVE_MAX_STATES];   // Current (capacitor) or voltage (inductor) at x1
+
+    // Companion model stamped for the step being solved: the derivative
+    // term is geq * y + ieq, with y = sol[p] - sol[m]
+    int count;
+    int p[REACTIVE_MAX_STATES], m[REACTIVE_MAX_STATES];
+    double r[REACTIVE_MAX_STATES];
+    double c[REACTIVE_MAX_STATES];    // Capacitance or inductance (charge or flux = c * x)
+    double geq[REACTIVE_MAX_STATES];
+    double ieq[REACTIVE_MAX_STATES];
+} ReactiveState;
+
+// Local truncation error tolerances of the adaptive step control. A state's
+// error is compared with abstol + reltol * |current| (capacitor current or
+// inductor voltage) and reltol * max(|charge|, chgtol) / dt, whichever is
+// larger, scaled by trtol (how much the estimate overstates the true error).
+typedef struct {
+    double reltol;
+    double abstol;                // A (V for inductors)
+    double chgtol;                // C (Wb for inductors)
+    double trtol;
+} TruncationTolerance;
+
 // ============================================================================
 // SUB-CIRCUIT / IC DEFINITION
 // ============================================================================
@@ -525,7 +609,16 @@ typedef struct {
     int tx_count[WIRELESS_CHANNEL_COUNT];     // Number of TX antennas on each channel
 } WirelessState;
 
-// Global wireless state (defined in simulation.c)
-extern WirelessState g_wireless;
+// ============================================================================
+// SIMULATION CONTEXT
+// ============================================================================
+
+// What the components of one simulation share besides their nodes: the
+// environment their models read and the channels their antennas broadcast
+// on. Each Simulation owns one, so simulations do not see each other.
+typedef struct {
+    EnvironmentState environment;
+    WirelessState wireless;
+} SimContext;
 
 #endif // TYPES_H
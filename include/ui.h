@@ -361,6 +361,7 @@ typedef struct {
     int spotlight_selected;                 // Currently highlighted result index
 
     // Environment sliders (for LDR and Thermistor)
+    EnvironmentState environment;   // Slider values, copied to the simulation by ui_update
     Rect env_light_slider;          // Light level slider bounds
     Rect env_temp_slider;           // Temperature slider bounds
     bool dragging_light;            // Currently dragging light slider
@@ -0,0 +1,256 @@
+/**
+ * Circuit Playground - Small-Signal AC Analysis Implementation
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "ac.h"
+#include "component.h"
+
+// Reactance k of a component's companion-model records
+static void ac_reactance_from_record(ACReactance *x, const ReactiveState *rs, int k,
+                                     int num_nodes) {
+    x->p = rs->p[k];
+    x->m = rs->m[k];
+    x->branch = rs->p[k] >= num_nodes;
+    x->c = rs->c[k];
+    x->r = rs->r[k];
+    x->geq = rs->geq[k];
+}
+
+// Admittance that replaces the companion conductance of a reactance at
+// angular frequency w: jwc / (1 + jwc r) = (w^2 c^2 r + jwc) / (1 + (wcr)^2)
+static void ac_reactance_admittance(const ACReactance *x, double w, double *re, double *im) {
+    double wc = w * x->c;
+    double d = 1.0 + (wc * x->r) * (wc * x->r);
+    *re = wc * wc * x->r / d - x->geq;
+    *im = wc / d;
+}
+
+ACSystem *ac_system_create(SparseMatrix *jacobian, Circuit *circuit,
+                           int num_nodes, int excite_row) {
+    if (!jacobian || !circuit) return NULL;
+    if (!jacobian->compressed && !sparse_compress(jacobian)) return NULL;
+
+    int n = jacobian->n;
+    if (excite_row < 0 || excite_row >= n) return NULL;
+
+    ACSystem *sys = solver_calloc(1, sizeof(ACSystem));
+    if (!sys) return NULL;
+
+    sys->n = n;
+    sys->num_nodes = num_nodes;
+    sys->excite_row = excite_row;
+    sys->nnz = jacobian->col_ptr[n];
+
+    int num_reactances = 0;
+    for (int i = 0; i < circuit->num_components; i++) {
+        num_reactances += circuit->components[i]->reactive.count;
+    }
+
+    sys->col_ptr = solver_malloc((n + 1) * sizeof(int));
+    sys->row_idx = solver_malloc((sys->nnz + 1) * sizeof(int));
+    sys->values = solver_malloc((sys->nnz + 1) * sizeof(double));
+    sys->reactances = solver_calloc(num_reactances + 1, sizeof(ACReactance));
+    if (!sys->col_ptr || !sys->row_idx || !sys->values || !sys->reactances) {
+        ac_system_free(sys);
+        return NULL;
+    }
+
+    memcpy(sys->col_ptr, jacobian->col_ptr, (n + 1) * sizeof(int));
+    memcpy(sys->row_idx, jacobian->row_idx, sys->nnz * sizeof(int));
+    memcpy(sys->values, jacobian->values, sys->nnz * sizeof(double));
+
+    // Subcircuit instances stamp their internal parts from per-stamp copies,
+    // so only top-level reactive elements have records here
+    for (int i = 0; i < circuit->num_components; i++) {
+        const ReactiveState *rs = &circuit->components[i]->reactive;
+        for (int k = 0; k < rs->count; k++) {
+            ac_reactance_from_record(&sys->reactances[sys->num_reactances++], rs, k, num_nodes);
+        }
+    }
+
+    return sys;
+}
+
+void ac_system_free(ACSystem *sys) {
+    if (!sys) return;
+
+    free(sys->col_ptr);
+    free(sys->row_idx);
+    free(sys->values);
+    free(sys->reactances);
+    free(sys);
+}
+
+ACSolver *ac_solver_create(const ACSystem *sys) {
+    if (!sys) return NULL;
+
+    ACSolver *solver = solver_calloc(1, sizeof(ACSolver));
+    if (!solver) return NULL;
+
+    // Each Jacobian entry appears twice and each reactance adds up to four
+    // complex stamps of four entries
+    int nnz_hint = 2 * sys->nnz + 16 * sys->num_reactances;
+    solver->matrix = sparse_create(2 * sys->n, nnz_hint);
+    solver->lu = sparse_lu_create();
+    solver->rhs = vector_create(2 * sys->n);
+    solver->x = vector_create(2 * sys->n);
+    solver->adjoint = vector_create(2 * sys->n);
+    if (!solver->matrix || !solver->lu || !solver->rhs || !solver->x || !solver->adjoint) {
+        ac_solver_free(solver);
+        return NULL;
+    }
+
+    return solver;
+}
+
+void ac_solver_free(ACSolver *solver) {
+    if (!solver) return;
+
+    sparse_free(solver->matrix);
+    sparse_lu_free(solver->lu);
+    vector_free(solver->rhs);
+    vector_free(solver->x);
+    vector_free(solver->adjoint);
+    free(solver);
+}
+
+// Add the complex value (re + j im) at (row, col) of the complex system.
+// Both parts are always stamped, so every frequency makes the same sequence
+// of sparse_add calls and the compiled handles stay valid.
+static void ac_stamp(SparseMatrix *A, int n, int row, int col, double re, double im) {
+    if (row < 0 || col < 0) return;
+    sparse_add(A, row, col, re);
+    sparse_add(A, row + n, col + n, re);
+    sparse_add(A, row, col + n, -im);
+    sparse_add(A, row + n, col, im);
+}
+
+bool ac_solve(const ACSystem *sys, ACSolver *solver, double freq) {
+    if (!sys || !solver) return false;
+
+    SparseMatrix *A = solver->matrix;
+    int n = sys->n;
+    double w = 2.0 * M_PI * freq;
+
+    sparse_begin_load(A);
+
+    for (int col = 0; col < n; col++) {
+        for (int k = sys->col_ptr[col]; k < sys->col_ptr[col + 1]; k++) {
+            int row = sys->row_idx[k];
+            double v = sys->values[k];
+            sparse_add(A, row, col, v);
+            sparse_add(A, row + n, col + n, v);
+        }
+    }
+
+    // Replace each companion conductance by the element's admittance
+    for (int i = 0; i < sys->num_reactances; i++) {
+        const ACReactance *x = &sys->reactances[i];
+        double re, im;
+        ac_reactance_admittance(x, w, &re, &im);
+
+        if (x->branch) {
+            // Branch equation: ... - Y (x[p] - x[m]) = ...
+            ac_stamp(A, n, x->p, x->p, -re, -im);
+            ac_stamp(A, n, x->p, x->m, re, im);
+        } else {
+            ac_stamp(A, n, x->p, x->p, re, im);
+            ac_stamp(A, n, x->m, x->m, re, im);
+            ac_stamp(A, n, x->p, x->m, -re, -im);
+            ac_stamp(A, n, x->m, x->p, -re, -im);
+        }
+    }
+
+    if (!sparse_end_load(A)) return false;
+
+    // The pattern is analyzed at the first frequency; later ones refactor
+    // with its pivot sequence unless a pivot became too small
+    if (!sparse_lu_pattern_matches(solver->lu, A)) {
+        if (!sparse_lu_analyze(solver->lu, A)) return false;
+    }
+    if (!sparse_lu_refactor(solver->lu, A) && !sparse_lu_factor(solver->lu, A)) {
+        return false;
+    }
+
+    vector_zero(solver->rhs);
+    solver->rhs->data[sys->excite_row] = 1.0;
+    return sparse_lu_solve(solver->lu, solver->rhs, solver->x);
+}
+
+void ac_solver_response(const ACSystem *sys, const ACSolver *solver, int idx,
+                        double *re, double *im) {
+    if (!sys || !solver || idx < 0 || idx >= sys->n) {
+        *re = 0;
+        *im = 0;
+        return;
+    }
+    *re = solver->x->data[idx];
+    *im = solver->x->data[idx + sys->n];
+}
+
+bool ac_solve_adjoint(const ACSystem *sys, ACSolver *solver, int idx) {
+    if (!sys || !solver || idx < 0 || idx >= sys->n) return false;
+
+    // The transpose of the real-equivalent matrix is the real-equivalent of
+    // the conjugate transpose: its solution z gives lambda = conj(z)
+    vector_zero(solver->rhs);
+    solver->rhs->data[idx] = 1.0;
+    if (!sparse_lu_solve_transpose(solver->lu, solver->rhs, solver->adjoint)) return false;
+
+    double *im = solver->adjoint->data + sys->n;
+    for (int i = 0; i < sys->n; i++) {
+        im[i] = -im[i];
+    }
+    return true;
+}
+
+void ac_component_product(const SparseMatrix *stamp, const ReactiveState *rs,
+                          int num_nodes, double freq, const Vector *u, const Vector *x,
+                          double *re, double *im) {
+    int n = u->size / 2;
+    const double *ur = u->data, *ui = u->data + n;
+    const double *xr = x->data, *xi = x->data + n;
+    double w = 2.0 * M_PI * freq;
+    double sum_re = 0, sum_im = 0;
+
+    // Jacobian entries of the component's load (triplets, duplicates apart)
+    for (int k = 0; k < stamp->trip_count; k++) {
+        int row = stamp->trip_row[k], col = stamp->trip_col[k];
+        if (row < 0 || col < 0 || row >= n || col >= n) continue;
+        double g = stamp->trip_val[k];
+        sum_re += g * (ur[row] * xr[col] - ui[row] * xi[col]);
+        sum_im += g * (ur[row] * xi[col] + ui[row] * xr[col]);
+    }
+
+    // Reactances, stamped as ac_solve does
+    for (int k = 0; k < rs->count; k++) {
+        ACReactance react;
+        ac_reactance_from_record(&react, rs, k, num_nodes);
+        double yr, yi;
+        ac_reactance_admittance(&react, w, &yr, &yi);
+
+        // Branch: row p gets -Y (x[p] - x[m]); node: Y between p and m
+        int p = react.p, m = react.m;
+        double dxr = (p >= 0 ? xr[p] : 0) - (m >= 0 ? xr[m] : 0);
+        double dxi = (p >= 0 ? xi[p] : 0) - (m >= 0 ? xi[m] : 0);
+        double lr, li;
+        if (react.branch) {
+            lr = -ur[p];
+            li = -ui[p];
+        } else {
+            lr = (p >= 0 ? ur[p] : 0) - (m >= 0 ? ur[m] : 0);
+            li = (p >= 0 ? ui[p] : 0) - (m >= 0 ? ui[m] : 0);
+        }
+        // (lr + j li) * (yr + j yi) * (dxr + j dxi)
+        double yxr = yr * dxr - yi * dxi;
+        double yxi = yr * dxi + yi * dxr;
+        sum_re += lr * yxr - li * yxi;
+        sum_im += lr * yxi + li * yxr;
+    }
+
+    *re = sum_re;
+    *im = sum_im;
+}
@@ -3,26 +3,61 @@
  */
 
 #include "analysis.h"
+#include "rng.h"
 #include <stdlib.h>
 #include <string.h>
 #include <math.h>
 #include <float.h>
 #include <stdio.h>
 
-// Simple random number generator for Monte Carlo
-static unsigned int rand_seed = 12345;
-static double rand_uniform(void) {
-    rand_seed = rand_seed * 1103515245 + 12345;
-    return (double)(rand_seed & 0x7fffffff) / (double)0x7fffffff;
+// Standard normal CDF
+static double mc_normal_cdf(double x) {
+    return 0.5 * erfc(-x / sqrt(2.0));
 }
 
-// Box-Muller transform for Gaussian random numbers
-static double rand_gaussian(double mean, double std_dev) {
-    double u1 = rand_uniform();
-    double u2 = rand_uniform();
-    if (u1 < 1e-10) u1 = 1e-10;
-    double z = sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
-    return mean + z * std_dev;
+// Sobol direction numbers (Joe and Kuo): degree s and coefficients a of
+// the primitive polynomial of dimensions 2.., and their initial m values.
+// Dimension 1 is the van der Corput sequence.
+static const struct {
+    int s, a;
+    int m[7];
+} sobol_params[MC_SOBOL_DIMS - 1] = {
+    {1, 0, {1}},                           {2, 1, {1, 3}},
+    {3, 1, {1, 3, 1}},                     {3, 2, {1, 1, 1}},
+    {4, 1, {1, 1, 3, 3}},                  {4, 4, {1, 3, 5, 13}},
+    {5, 2, {1, 1, 5, 5, 17}},              {5, 4, {1, 1, 5, 5, 5}},
+    {5, 7, {1, 1, 7, 11, 19}},             {5, 11, {1, 1, 5, 1, 1}},
+    {5, 13, {1, 1, 1, 3, 11}},             {5, 14, {1, 3, 5, 5, 31}},
+    {6, 1, {1, 3, 3, 9, 7, 49}},           {6, 13, {1, 1, 1, 15, 21, 21}},
+    {6, 16, {1, 3, 1, 13, 27, 49}},        {6, 19, {1, 1, 1, 15, 7, 5}},
+    {6, 22, {1, 3, 1, 15, 13, 25}},        {6, 25, {1, 1, 5, 5, 19, 61}},
+    {7, 1, {1, 3, 7, 11, 23, 15, 103}},    {7, 4, {1, 3, 7, 13, 13, 15, 69}},
+    {7, 7, {1, 1, 3, 13, 7, 35, 63}},      {7, 8, {1, 3, 5, 9, 1, 25, 53}},
+    {7, 14, {1, 3, 1, 13, 9, 35, 107}},    {7, 19, {1, 3, 1, 5, 27, 61, 31}},
+    {7, 21, {1, 1, 5, 11, 19, 41, 61}},    {7, 28, {1, 3, 5, 3, 3, 13, 69}},
+    {7, 31, {1, 1, 7, 13, 1, 19, 1}},      {7, 32, {1, 3, 7, 5, 13, 19, 59}},
+    {7, 37, {1, 1, 3, 9, 25, 29, 41}},     {7, 41, {1, 3, 5, 13, 23, 1, 55}},
+    {7, 42, {1, 3, 7, 3, 13, 59, 17}},
+};
+
+// Direction numbers v[0..31] of Sobol dimension dim (0-based)
+static void sobol_directions(int dim, uint32_t v[32]) {
+    if (dim == 0) {
+        for (int k = 0; k < 32; k++) v[k] = 1u << (31 - k);
+        return;
+    }
+
+    int s = sobol_params[dim - 1].s;
+    int a = sobol_params[dim - 1].a;
+    for (int k = 0; k < s; k++) {
+        v[k] = (uint32_t)sobol_params[dim - 1].m[k] << (31 - k);
+    }
+    for (int k = s; k < 32; k++) {
+        v[k] = v[k - s] ^ (v[k - s] >> s);
+        for (int j = 1; j < s; j++) {
+            if ((a >> (s - 1 - j)) & 1) v[k] ^= v[k - j];
+        }
+    }
 }
 
 void analysis_init(AnalysisState *state) {
@@ -33,9 +68,26 @@ void analysis_init(AnalysisState *state) {
 
     state->sweep.active = false;
     state->sweep.complete = false;
+    state->sweep.max_points = SWEEP_DEFAULT_MAX_POINTS;
+    state->sweep.analysis_type = SWEEP_ANALYSIS_DC;
+    state->sweep.transient_steps = 200;
+    state->sweep.ac_frequency = 1000.0;
+    state->sweep.environment.light_level = ENVIRONMENT_DEFAULT_LIGHT;
+    state->sweep.environment.temperature = ENVIRONMENT_DEFAULT_TEMPERATURE;
 
     state->monte_carlo.active = false;
     state->monte_carlo.complete = false;
+    state->monte_carlo.trial_type = MC_TRIAL_DC;
+    state->monte_carlo.transient_steps = 200;
+    state->monte_carlo.environment.light_level = ENVIRONMENT_DEFAULT_LIGHT;
+    state->monte_carlo.environment.temperature = ENVIRONMENT_DEFAULT_TEMPERATURE;
+    state->monte_carlo.seed = 12345;
+    state->monte_carlo.sampling = MC_SAMPLING_SOBOL;
+    state->monte_carlo.distribution = MC_DIST_GAUSSIAN;
+    state->monte_carlo.bin_tolerance = 1.0;
+    state->monte_carlo.min_runs = 64;
+
+    state->sensitivity.default_tolerance = 5.0;
 
     state->fft_enabled = false;
     state->fft_window_type = 1;  // Hanning window default
@@ -94,80 +146,334 @@ double analysis_get_tempco(ComponentType type, int material_type) {
 }
 
 // Parametric sweep functions
-void analysis_sweep_init(AnalysisState *state, int component_id,
+bool analysis_sweep_init(AnalysisState *state, int component_id,
                          SweepParamType param, double start, double end,
                          int num_points, bool log_scale) {
-    state->sweep.active = true;
-    state->sweep.component_id = component_id;
-    state->sweep.param_type = param;
-    state->sweep.start_value = start;
-    state->sweep.end_value = end;
-    state->sweep.num_points = (num_points > MAX_SWEEP_POINTS) ?
-                              MAX_SWEEP_POINTS : num_points;
-    state->sweep.log_scale = log_scale;
+    ParametricSweep *sweep = &state->sweep;
+
+    int max_points = (sweep->max_points > 0) ? sweep->max_points : SWEEP_DEFAULT_MAX_POINTS;
+    if (num_points > max_points) num_points = max_points;
+    if (num_points < 2) num_points = 2;
+
+    SweepPoint *results = realloc(sweep->results, num_points * sizeof(SweepPoint));
+    if (!results) return false;
+    memset(results, 0, num_points * sizeof(SweepPoint));
+
+    sweep->results = results;
+    sweep->active = true;
+    sweep->component_id = component_id;
+    sweep->param_type = param;
+    sweep->start_value = start;
+    sweep->end_value = end;
+    sweep->num_points = num_points;
+    sweep->log_scale = log_scale;
+    sweep->num_results = 0;
+    sweep->num_failed = 0;
+    sweep->current_point = 0;
+    sweep->newton_iterations = 0;
+    sweep->complete = false;
+    sweep->cancel = false;
+    sweep->running = true;
+    return true;
+}
+
+void analysis_sweep_reset(AnalysisState *state) {
+    free(state->sweep.results);
+    state->sweep.results = NULL;
+    state->sweep.active = false;
+    state->sweep.complete = false;
+    state->sweep.num_points = 0;
     state->sweep.num_results = 0;
     state->sweep.current_point = 0;
-    state->sweep.complete = false;
 }
 
-void analysis_sweep_step(AnalysisState *state, Circuit *circuit,
-                         Simulation *sim, int probe_idx) {
-    if (!state->sweep.active || state->sweep.complete) return;
-
-    ParametricSweep *sweep = &state->sweep;
-
-    // Calculate current parameter value
-    double param_val;
+// Parameter value of sweep point i
+static double sweep_point_value(const ParametricSweep *sweep, int i) {
+    double t = (double)i / (sweep->num_points - 1);
     if (sweep->log_scale && sweep->start_value > 0 && sweep->end_value > 0) {
         double log_start = log10(sweep->start_value);
         double log_end = log10(sweep->end_value);
-        double log_val = log_start + (log_end - log_start) *
-                         sweep->current_point / (sweep->num_points - 1);
-        param_val = pow(10, log_val);
-    } else {
-        param_val = sweep->start_value +
-                    (sweep->end_value - sweep->start_value) *
-                    sweep->current_point / (sweep->num_points - 1);
+        return pow(10, log_start + (log_end - log_start) * t);
     }
+    return sweep->start_value + (sweep->end_value - sweep->start_value) * t;
+}
 
-    // Store result (actual measurement would be done by caller)
-    sweep->results[sweep->current_point].param_value = param_val;
+// Set the swept parameter of comp. Returns false if comp has no such
+// parameter.
+static bool sweep_set_param(Component *comp, SweepParamType param, double value) {
+    switch (param) {
+        case SWEEP_RESISTANCE:
+            if (comp->type == COMP_RESISTOR) {
+                comp->props.resistor.resistance = value;
+            } else if (comp->type == COMP_POTENTIOMETER) {
+                comp->props.potentiometer.resistance = value;
+            } else {
+                return false;
+            }
+            return true;
 
-    // Get measurement from simulation history
-    if (sim && probe_idx >= 0 && probe_idx < MAX_PROBES) {
-        double times[MAX_HISTORY], values[MAX_HISTORY];
-        int count = simulation_get_history(sim, probe_idx, times, values, 100);
+        case SWEEP_CAPACITANCE:
+            if (comp->type != COMP_CAPACITOR && comp->type != COMP_CAPACITOR_ELEC) return false;
+            comp->props.capacitor.capacitance = value;
+            return true;
 
-        if (count > 0) {
-            double min_v = values[0], max_v = values[0];
-            double sum = 0, sum_sq = 0;
-            for (int i = 0; i < count; i++) {
-                if (values[i] < min_v) min_v = values[i];
-                if (values[i] > max_v) max_v = values[i];
-                sum += values[i];
-                sum_sq += values[i] * values[i];
+        case SWEEP_INDUCTANCE:
+            if (comp->type != COMP_INDUCTOR) return false;
+            comp->props.inductor.inductance = value;
+            return true;
+
+        case SWEEP_VOLTAGE:
+            switch (comp->type) {
+                case COMP_DC_VOLTAGE:    comp->props.dc_voltage.voltage = value; return true;
+                case COMP_AC_VOLTAGE:    comp->props.ac_voltage.amplitude = value; return true;
+                case COMP_SQUARE_WAVE:   comp->props.square_wave.amplitude = value; return true;
+                case COMP_TRIANGLE_WAVE: comp->props.triangle_wave.amplitude = value; return true;
+                case COMP_SAWTOOTH_WAVE: comp->props.sawtooth_wave.amplitude = value; return true;
+                default: return false;
             }
-            sweep->results[sweep->current_point].output_min = min_v;
-            sweep->results[sweep->current_point].output_max = max_v;
-            sweep->results[sweep->current_point].output_value = (max_v + min_v) / 2;
-            sweep->results[sweep->current_point].output_rms =
-                sqrt(sum_sq / count);
+
+        case SWEEP_FREQUENCY:
+            switch (comp->type) {
+                case COMP_AC_VOLTAGE:    comp->props.ac_voltage.frequency = value; return true;
+                case COMP_AC_CURRENT:    comp->props.ac_current.frequency = value; return true;
+                case COMP_SQUARE_WAVE:   comp->props.square_wave.frequency = value; return true;
+                case COMP_TRIANGLE_WAVE: comp->props.triangle_wave.frequency = value; return true;
+                case COMP_SAWTOOTH_WAVE: comp->props.sawtooth_wave.frequency = value; return true;
+                case COMP_CLOCK:         comp->props.clock.frequency = value; return true;
+                default: return false;
+            }
+
+        default:
+            return false;
+    }
+}
+
+// Temperature of comp: resistors and capacitors follow their temperature
+// coefficient from the nominal value at 25 C. Returns false if comp has
+// none.
+static bool sweep_set_temperature(Component *comp, const Component *nominal, double temp) {
+    switch (comp->type) {
+        case COMP_RESISTOR:
+            if (comp->props.resistor.ideal) return false;
+            comp->props.resistor.resistance =
+                analysis_apply_temperature(nominal->props.resistor.resistance,
+                                           nominal->props.resistor.temp_coeff, 25.0, temp);
+            comp->props.resistor.temp = temp;
+            return true;
+        case COMP_CAPACITOR:
+        case COMP_CAPACITOR_ELEC:
+            comp->props.capacitor.capacitance =
+                analysis_apply_temperature(nominal->props.capacitor.capacitance,
+                                           analysis_get_tempco(comp->type, 0), 25.0, temp);
+            return true;
+        default:
+            return false;
+    }
+}
+
+// Shared state of a parametric sweep: workers claim chunks of SWEEP_CHUNK
+// points in order and write each point to its own slot
+typedef struct {
+    ParametricSweep *sweep;
+    const Circuit *circuit;
+    int comp_index;             // Swept component (-1: all, for temperature)
+    int probe_idx;
+    int *iterations;            // DC Newton iterations per point
+    atomic_int_t next_chunk;
+    atomic_int_t done;
+    atomic_int_t out_of_memory;
+} SweepContext;
+
+// Apply point i's parameter value to the replica
+static void sweep_apply(SweepContext *ctx, Circuit *replica, double value) {
+    ParametricSweep *sweep = ctx->sweep;
+    for (int k = 0; k < replica->num_components; k++) {
+        if (ctx->comp_index >= 0 && k != ctx->comp_index) continue;
+        if (sweep->param_type == SWEEP_TEMPERATURE) {
+            sweep_set_temperature(replica->components[k], ctx->circuit->components[k], value);
+        } else {
+            sweep_set_param(replica->components[k], sweep->param_type, value);
         }
     }
+}
 
-    sweep->num_results = sweep->current_point + 1;
-    sweep->current_point++;
+// Run the sweep's analysis on the replica simulated by sim. The operating
+// point starts from guess (NULL: from zero) and is stored back into it.
+static bool sweep_point(SweepContext *ctx, Simulation *sim, Vector *guess, bool warm,
+                        double value, SweepPoint *point, int *iterations) {
+    ParametricSweep *sweep = ctx->sweep;
+    Circuit *replica = sim->circuit;
+    int probe = (ctx->probe_idx >= 0 && ctx->probe_idx < replica->num_probes) ?
+                ctx->probe_idx : 0;
 
-    if (sweep->current_point >= sweep->num_points) {
-        sweep->complete = true;
+    simulation_reset(sim);
+    bool ok = simulation_dc_resolve(sim, warm ? guess : NULL);
+    *iterations = simulation_get_dc_iterations(sim);
+    if (!ok) return false;
+    if (guess) vector_copy(guess, sim->solution);
+
+    double v = replica->probes[probe].voltage;
+    switch (sweep->analysis_type) {
+        case SWEEP_ANALYSIS_DC:
+            point->output_value = v;
+            point->output_min = v;
+            point->output_max = v;
+            point->output_rms = fabs(v);
+            break;
+
+        case SWEEP_ANALYSIS_TRANSIENT: {
+            double min_v = v, max_v = v, sum_sq = 0;
+            int steps = MAX(sweep->transient_steps, 1);
+            for (int i = 0; i < steps; i++) {
+                if (!simulation_step(sim)) return false;
+                v = replica->probes[probe].voltage;
+                if (v < min_v) min_v = v;
+                if (v > max_v) max_v = v;
+                sum_sq += v * v;
+            }
+            point->output_min = min_v;
+            point->output_max = max_v;
+            point->output_value = (max_v + min_v) / 2;
+            point->output_rms = sqrt(sum_sq / steps);
+            break;
+        }
+
+        case SWEEP_ANALYSIS_AC: {
+            double freq = (sweep->param_type == SWEEP_FREQUENCY) ? value : sweep->ac_frequency;
+            FreqResponsePoint response;
+            if (!simulation_ac_response(sim, freq, replica->probes[probe].node_id, &response)) {
+                return false;
+            }
+            point->output_value = response.magnitude_db;
+            point->output_min = response.magnitude_db;
+            point->output_max = response.magnitude_db;
+            point->output_rms = pow(10.0, response.magnitude_db / 20.0) / sqrt(2.0);
+            point->output_phase = response.phase_deg;
+            break;
+        }
     }
+    return true;
 }
 
-void analysis_sweep_reset(AnalysisState *state) {
-    state->sweep.active = false;
-    state->sweep.complete = false;
-    state->sweep.num_results = 0;
-    state->sweep.current_point = 0;
+// Sweep worker: solves chunks until none are left, on its own replica of
+// the circuit. Within a chunk each operating point starts from the one of
+// the point before (continuation); the first starts from zero.
+static void sweep_worker_task(void *arg, int thread_id) {
+    (void)thread_id;
+    SweepContext *ctx = (SweepContext *)arg;
+    ParametricSweep *sweep = ctx->sweep;
+
+    Circuit *replica = circuit_clone(ctx->circuit);
+    Simulation *sim = replica ? simulation_create(replica) : NULL;
+    if (!sim) {
+        atomic_store(&ctx->out_of_memory, 1);
+        circuit_free(replica);
+        return;
+    }
+    sim->context.environment = sweep->environment;
+    if (sweep->analysis_type == SWEEP_ANALYSIS_TRANSIENT) {
+        // Min, max and RMS are taken over transient_steps: every point
+        // must cover the same time window with equal steps
+        simulation_enable_adaptive(sim, false);
+        if (sweep->time_step > 0) {
+            simulation_set_time_step(sim, sweep->time_step);
+        } else {
+            simulation_auto_time_step(sim);
+        }
+    }
+
+    Vector *guess = NULL;
+    while (!sweep->cancel && !atomic_load(&ctx->out_of_memory)) {
+        int first = (atomic_inc(&ctx->next_chunk) - 1) * SWEEP_CHUNK;
+        if (first >= sweep->num_points) break;
+        int last = MIN(first + SWEEP_CHUNK, sweep->num_points);
+
+        bool warm = false;
+        for (int i = first; i < last && !sweep->cancel; i++) {
+            double value = sweep_point_value(sweep, i);
+            SweepPoint *point = &sweep->results[i];
+            sweep_apply(ctx, replica, value);
+            point->param_value = value;
+            point->valid = sweep_point(ctx, sim, guess, warm, value, point,
+                                       &ctx->iterations[i]);
+
+            // The guess is sized once the replica's system is compiled
+            if (point->valid && !guess) {
+                guess = vector_create(sim->solution->size);
+                if (guess) vector_copy(guess, sim->solution);
+            }
+            warm = point->valid && guess != NULL;
+
+            sweep->current_point = atomic_inc(&ctx->done);
+        }
+    }
+
+    vector_free(guess);
+    simulation_free(sim);
+    circuit_free(replica);
+}
+
+bool analysis_sweep_execute(AnalysisState *state, const Circuit *circuit,
+                            int probe_idx, ThreadPool *pool) {
+    ParametricSweep *sweep = &state->sweep;
+    if (!circuit || !sweep->active || !sweep->results || circuit->num_probes == 0) {
+        sweep->running = false;
+        return false;
+    }
+
+    // Swept component by id; a temperature sweep may cover the whole circuit
+    int comp_index = -1;
+    for (int k = 0; k < circuit->num_components; k++) {
+        if (circuit->components[k]->id == sweep->component_id) comp_index = k;
+    }
+    if (comp_index < 0 && !(sweep->param_type == SWEEP_TEMPERATURE && sweep->component_id < 0)) {
+        sweep->running = false;
+        return false;
+    }
+
+    SweepContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.sweep = sweep;
+    ctx.circuit = circuit;
+    ctx.comp_index = comp_index;
+    ctx.probe_idx = probe_idx;
+    ctx.iterations = calloc(sweep->num_points, sizeof(int));
+    if (!ctx.iterations) {
+        sweep->running = false;
+        return false;
+    }
+
+    // One task per worker, as many as there are chunks; without a pool (or
+    // if a task cannot be queued) the calling thread does the work
+    int num_chunks = (sweep->num_points + SWEEP_CHUNK - 1) / SWEEP_CHUNK;
+    int num_tasks = (pool && pool->initialized) ? MIN(pool->num_threads, num_chunks) : 0;
+    for (int i = 0; i < num_tasks; i++) {
+        if (!threadpool_submit(pool, sweep_worker_task, &ctx)) {
+            sweep_worker_task(&ctx, 0);
+        }
+    }
+    if (num_tasks > 0) {
+        threadpool_wait(pool);
+    } else {
+        sweep_worker_task(&ctx, 0);
+    }
+
+    bool ok = !sweep->cancel && !atomic_load(&ctx.out_of_memory);
+    if (ok) {
+        sweep->num_failed = 0;
+        sweep->newton_iterations = 0;
+        for (int i = 0; i < sweep->num_points; i++) {
+            if (!sweep->results[i].valid) sweep->num_failed++;
+            sweep->newton_iterations += ctx.iterations[i];
+        }
+        sweep->num_results = sweep->num_points;
+        sweep->current_point = sweep->num_points;
+        sweep->complete = true;
+    }
+    free(ctx.iterations);
+
+    sweep->running = false;
+    return ok;
 }
 
 // Monte Carlo functions
@@ -180,7 +486,10 @@ void analysis_monte_carlo_init(AnalysisState *state, int num_runs,
     state->monte_carlo.use_component_tolerance = use_tolerance;
     state->monte_carlo.global_tolerance = global_tol;
     state->monte_carlo.num_results = 0;
+    state->monte_carlo.num_failed = 0;
     state->monte_carlo.complete = false;
+    state->monte_carlo.cancel = false;
+    state->monte_carlo.running = true;
 }
 
 void analysis_monte_carlo_run(AnalysisState *state, Circuit *circuit,
@@ -237,6 +546,11 @@ void analysis_monte_carlo_stats(AnalysisState *state) {
     }
     mc->std_dev = sqrt(sum_sq / mc->num_results);
 
+    // 95% confidence half-widths of the mean and of sigma
+    mc->mean_ci = 1.96 * mc->std_dev / sqrt((double)mc->num_results);
+    mc->std_dev_ci = (mc->num_results > 1) ?
+                     1.96 * mc->std_dev / sqrt(2.0 * (mc->num_results - 1)) : mc->std_dev;
+
     // Sort for min/max and percentiles
     double sorted[MAX_MONTE_CARLO_RUNS];
     memcpy(sorted, mc->output_values, mc->num_results * sizeof(double));
@@ -251,6 +565,7 @@ void analysis_monte_carlo_stats(AnalysisState *state) {
 void analysis_monte_carlo_reset(AnalysisState *state) {
     state->monte_carlo.active = false;
     state->monte_carlo.complete = false;
+    state->monte_carlo.stopped_early = false;
     state->monte_carlo.num_results = 0;
     state->monte_carlo.current_run = 0;
 }
@@ -362,122 +677,507 @@ static bool mc_component_has_value(ComponentType type) {
     }
 }
 
-void analysis_mc_backup_values(Circuit *circuit, MCBackup *backup) {
-    if (!circuit || !backup) return;
-
-    backup->num_backed_up = 0;
-    for (int i = 0; i < circuit->num_components && i < MAX_COMPONENTS; i++) {
+// Keys of the draws that belong to no run (above any run index)
+#define MC_KEY_SOBOL  0xFFFFFFFFFFFFFFFFULL
+#define MC_KEY_LHS    0xFFFFFFFFFFFFFFFEULL
+
+// Variation of one component: its Monte Carlo dimension (-1 if it is not
+// varied) and its tolerance
+typedef struct {
+    int dim;
+    double tolerance;         // %
+    double bin_tolerance;     // %
+    MCDistribution distribution;
+} MCVary;
+
+// Replica of one worker, kept over the batches of an analysis
+typedef struct {
+    Circuit *replica;
+    Simulation *sim;
+    double *draws;            // Random numbers of the current run, one per dimension
+} MCWorker;
+
+// Shared state of a Monte Carlo analysis: workers claim runs in order and
+// write each result to its own slot
+typedef struct {
+    MonteCarloAnalysis *mc;
+    const Circuit *circuit;
+    int probe_idx;
+    MCVary *vary;             // Per component of circuit
+    int num_dims;
+    int *lhs;                 // LHS: stratum of run r in dimension d at [d * num_runs + r]
+    uint32_t (*sobol)[32];    // Sobol: direction numbers per dimension
+    MCWorker *workers;
+    double values[MAX_MONTE_CARLO_RUNS];
+    bool ok[MAX_MONTE_CARLO_RUNS];
+    int batch_end;            // Runs below it are claimed in this batch
+    atomic_int_t next_run;
+    atomic_int_t next_worker;
+    atomic_int_t done;
+    atomic_int_t out_of_memory;
+} MCContext;
+
+// Tolerances of every component of circuit. Returns the number of varied
+// components (dimensions of the sampling).
+static int mc_setup_variations(const MonteCarloAnalysis *mc, const Circuit *circuit,
+                               MCVary *vary) {
+    int num_dims = 0;
+    for (int i = 0; i < circuit->num_components; i++) {
         Component *comp = circuit->components[i];
-        if (!comp) continue;
-
-        if (mc_component_has_value(comp->type)) {
-            backup->values[i] = mc_get_component_value(comp);
-        } else {
-            backup->values[i] = 0.0;
+        MCVary *v = &vary[i];
+        v->dim = -1;
+        if (!mc_component_has_value(comp->type) || mc_get_component_value(comp) == 0.0) continue;
+
+        v->dim = num_dims++;
+        v->tolerance = mc->global_tolerance;
+        v->bin_tolerance = mc->bin_tolerance;
+        v->distribution = mc->distribution;
+        if (mc->use_component_tolerance) {
+            double own = 0;
+            if (comp->type == COMP_RESISTOR) own = comp->props.resistor.tolerance;
+            if (comp->type == COMP_POTENTIOMETER) own = comp->props.potentiometer.tolerance;
+            if (own > 0) v->tolerance = own;
+        }
+        for (int k = 0; k < mc->num_tolerances; k++) {
+            if (mc->tolerances[k].component_id == comp->id) {
+                v->tolerance = mc->tolerances[k].tolerance;
+                v->bin_tolerance = mc->tolerances[k].bin_tolerance;
+                v->distribution = mc->tolerances[k].distribution;
+                break;
+            }
         }
-        backup->num_backed_up = i + 1;
     }
+    return num_dims;
 }
 
-void analysis_mc_restore_values(Circuit *circuit, MCBackup *backup) {
-    if (!circuit || !backup) return;
+// Sampling tables of the analysis. Returns false if out of memory.
+static bool mc_setup_sampling(MCContext *ctx) {
+    MonteCarloAnalysis *mc = ctx->mc;
+    int n = mc->num_runs;
+
+    if (mc->sampling == MC_SAMPLING_LHS && ctx->num_dims > 0) {
+        // An independent random permutation of the strata per dimension
+        ctx->lhs = malloc((size_t)ctx->num_dims * n * sizeof(int));
+        if (!ctx->lhs) return false;
+        for (int d = 0; d < ctx->num_dims; d++) {
+            int *perm = ctx->lhs + (size_t)d * n;
+            for (int r = 0; r < n; r++) perm[r] = r;
+            for (int r = n - 1; r > 0; r--) {
+                int j = (int)(rng_bits(mc->seed, MC_KEY_LHS - d, r) % (uint64_t)(r + 1));
+                int t = perm[r];
+                perm[r] = perm[j];
+                perm[j] = t;
+            }
+        }
+    } else if (mc->sampling == MC_SAMPLING_SOBOL && ctx->num_dims > 0) {
+        int dims = MIN(ctx->num_dims, MC_SOBOL_DIMS);
+        ctx->sobol = malloc(dims * sizeof(*ctx->sobol));
+        if (!ctx->sobol) return false;
+        for (int d = 0; d < dims; d++) sobol_directions(d, ctx->sobol[d]);
+    }
+    return true;
+}
 
-    for (int i = 0; i < backup->num_backed_up && i < circuit->num_components; i++) {
-        Component *comp = circuit->components[i];
-        if (!comp) continue;
+// Sample of run in dimension dim, uniform in (0, 1). jitter is the run's
+// random number of the dimension: draw dim of stream run, so draws do not
+// depend on which worker makes them or in what order.
+static double mc_sample(const MCContext *ctx, int run, int dim, double jitter) {
+    const MonteCarloAnalysis *mc = ctx->mc;
 
-        if (mc_component_has_value(comp->type)) {
-            mc_set_component_value(comp, backup->values[i]);
+    if (mc->sampling == MC_SAMPLING_LHS) {
+        // A random point in the run's stratum
+        return (ctx->lhs[(size_t)dim * mc->num_runs + run] + jitter) / mc->num_runs;
+    }
+    if (mc->sampling == MC_SAMPLING_SOBOL && dim < MC_SOBOL_DIMS) {
+        // Point run of the sequence, with a random digital shift per dimension
+        uint32_t x = (uint32_t)(rng_bits(mc->seed, MC_KEY_SOBOL, (uint64_t)dim) >> 32);
+        for (int k = 0; (run >> k) != 0; k++) {
+            if ((run >> k) & 1) x ^= ctx->sobol[dim][k];
         }
+        return (x + 0.5) / 4294967296.0;
     }
+    return jitter;
 }
 
-void analysis_mc_randomize_values(Circuit *circuit, double tolerance_pct) {
-    if (!circuit) return;
+// Relative deviation of a value with variation vary for the sample u
+static double mc_deviation(const MCVary *vary, double u) {
+    double tol = vary->tolerance / 100.0;
+    double sigma = tol / 3.0;
+
+    switch (vary->distribution) {
+        case MC_DIST_UNIFORM:
+            return tol * (2.0 * u - 1.0);
+
+        case MC_DIST_BINNED: {
+            // Gaussian cut at +-tol, without the parts within +-bin that
+            // were sold as the tighter grade: each half of u maps onto one
+            // side of the remaining band
+            double bin = vary->bin_tolerance / 100.0;
+            if (bin <= 0 || bin >= tol) break;
+            double side = (u < 0.5) ? -1.0 : 1.0;
+            double v = (u < 0.5) ? 2.0 * u : 2.0 * u - 1.0;
+            double lo = mc_normal_cdf(bin / sigma);
+            double hi = mc_normal_cdf(tol / sigma);
+            return side * sigma * rng_normal_quantile(lo + v * (hi - lo));
+        }
 
-    // Standard deviation for Gaussian distribution
-    // For ±tolerance%, we use 3-sigma = tolerance, so sigma = tolerance/3
-    double sigma_factor = tolerance_pct / 100.0 / 3.0;
+        default:
+            break;
+    }
+    // Gaussian with 3 sigma at the tolerance
+    return sigma * rng_normal_quantile(u);
+}
 
-    for (int i = 0; i < circuit->num_components; i++) {
-        Component *comp = circuit->components[i];
-        if (!comp) continue;
+// Set each varied component of replica to its nominal value in circuit
+// with the deviation drawn for run
+static void mc_randomize_values(MCWorker *worker, const MCContext *ctx, int run) {
+    Circuit *replica = worker->replica;
+    rng_uniform_batch(ctx->mc->seed, (uint64_t)run, 0, worker->draws, ctx->num_dims);
 
-        if (mc_component_has_value(comp->type)) {
-            double base_value = mc_get_component_value(comp);
-            if (base_value == 0.0) continue;
+    for (int i = 0; i < replica->num_components; i++) {
+        const MCVary *vary = &ctx->vary[i];
+        if (vary->dim < 0) continue;
 
-            // Apply Gaussian variation
-            double variation = rand_gaussian(1.0, sigma_factor);
-            double new_value = base_value * variation;
+        double base_value = mc_get_component_value(ctx->circuit->components[i]);
+        double u = mc_sample(ctx, run, vary->dim, worker->draws[vary->dim]);
+        double new_value = base_value * (1.0 + mc_deviation(vary, u));
 
-            // Ensure positive values for passive components
-            if (new_value < 0) new_value = fabs(new_value);
+        // Ensure positive values for passive components
+        if (new_value < 0) new_value = fabs(new_value);
 
-            mc_set_component_value(comp, new_value);
-        }
+        mc_set_component_value(replica->components[i], new_value);
     }
 }
 
-bool analysis_monte_carlo_step(AnalysisState *state, Circuit *circuit,
-                               Simulation *sim, int probe_idx, MCBackup *backup) {
-    if (!state || !circuit || !sim || !backup) return true;
+// Output value of one trial on the replica simulated by sim
+static bool mc_trial(MCContext *ctx, Simulation *sim, double *value) {
+    MonteCarloAnalysis *mc = ctx->mc;
+    Circuit *replica = sim->circuit;
 
-    MonteCarloAnalysis *mc = &state->monte_carlo;
+    simulation_reset(sim);
+    if (!simulation_dc_resolve(sim, NULL)) return false;
+
+    if (replica->num_probes == 0) {
+        *value = 0.0;
+        return true;
+    }
+    int probe = (ctx->probe_idx >= 0 && ctx->probe_idx < replica->num_probes) ?
+                ctx->probe_idx : 0;
 
-    if (!mc->active || mc->complete) return true;
+    if (mc->trial_type == MC_TRIAL_DC) {
+        *value = replica->probes[probe].voltage;
+        return true;
+    }
 
-    // First run: backup original values
-    if (mc->current_run == 0) {
-        analysis_mc_backup_values(circuit, backup);
+    double sum_sq = 0;
+    int steps = MAX(mc->transient_steps, 1);
+    for (int i = 0; i < steps; i++) {
+        if (!simulation_step(sim)) return false;
+        double v = replica->probes[probe].voltage;
+        sum_sq += v * v;
     }
+    *value = sqrt(sum_sq / steps);
+    return true;
+}
 
-    // Restore original values before applying new random variation
-    analysis_mc_restore_values(circuit, backup);
+// Monte Carlo worker: runs trials of the batch until none are left, on its
+// own replica of the circuit. The replica is made by the worker's first
+// task and its matrix compiled once, by the first trial; the following
+// ones only reload it with their values.
+static void mc_worker_task(void *arg, int thread_id) {
+    (void)thread_id;
+    MCContext *ctx = (MCContext *)arg;
+    MonteCarloAnalysis *mc = ctx->mc;
+    MCWorker *worker = &ctx->workers[atomic_inc(&ctx->next_worker) - 1];
+
+    if (!worker->sim) {
+        worker->replica = circuit_clone(ctx->circuit);
+        worker->sim = worker->replica ? simulation_create(worker->replica) : NULL;
+        worker->draws = malloc((ctx->num_dims + 1) * sizeof(double));
+        if (!worker->sim || !worker->draws) {
+            atomic_store(&ctx->out_of_memory, 1);
+            return;
+        }
+        worker->sim->context.environment = mc->environment;
+        if (mc->trial_type == MC_TRIAL_TRANSIENT) {
+            // The RMS is an unweighted mean over transient_steps: every
+            // trial must take the same steps over the same time window
+            simulation_enable_adaptive(worker->sim, false);
+            if (mc->time_step > 0) {
+                simulation_set_time_step(worker->sim, mc->time_step);
+            } else {
+                simulation_auto_time_step(worker->sim);
+            }
+        }
+    }
 
-    // Apply random variation
-    analysis_mc_randomize_values(circuit, mc->global_tolerance);
+    while (!mc->cancel && !atomic_load(&ctx->out_of_memory)) {
+        int run = atomic_inc(&ctx->next_run) - 1;
+        if (run >= ctx->batch_end) break;
 
-    // Reset simulation state for clean DC analysis
-    simulation_reset(sim);
+        mc_randomize_values(worker, ctx, run);
+        ctx->ok[run] = mc_trial(ctx, worker->sim, &ctx->values[run]);
+        mc->current_run = atomic_inc(&ctx->done);
+    }
+}
 
-    // Run DC analysis to get steady-state operating point
-    if (!simulation_dc_analysis(sim)) {
-        // DC analysis failed, record zero or skip
-        mc->output_values[mc->current_run] = 0.0;
-    } else {
-        // Get the voltage at the probe node
-        if (probe_idx >= 0 && probe_idx < circuit->num_probes) {
-            mc->output_values[mc->current_run] = circuit->probes[probe_idx].voltage;
-        } else if (circuit->num_probes > 0) {
-            // Use first probe if index invalid
-            mc->output_values[mc->current_run] = circuit->probes[0].voltage;
+// Results of runs [0, end) in run order, leaving out the runs that failed,
+// and their statistics
+static void mc_gather(AnalysisState *state, const MCContext *ctx, int end) {
+    MonteCarloAnalysis *mc = &state->monte_carlo;
+    mc->num_results = 0;
+    mc->num_failed = 0;
+    for (int i = 0; i < end; i++) {
+        if (ctx->ok[i]) {
+            mc->output_values[mc->num_results++] = ctx->values[i];
         } else {
-            // No probes, try to get a meaningful voltage
-            mc->output_values[mc->current_run] = 0.0;
+            mc->num_failed++;
         }
     }
+    analysis_monte_carlo_stats(state);
+}
 
-    mc->num_results = mc->current_run + 1;
-    mc->current_run++;
+// Early stopping test: both confidence intervals within ci_target of
+// their estimates
+static bool mc_converged(const MonteCarloAnalysis *mc) {
+    if (mc->num_results < MAX(mc->min_runs, 2)) return false;
+    return mc->mean_ci <= mc->ci_target * fabs(mc->mean) &&
+           mc->std_dev_ci <= mc->ci_target * mc->std_dev;
+}
 
-    // Check if complete
-    if (mc->current_run >= mc->num_runs) {
+bool analysis_monte_carlo_execute(AnalysisState *state, const Circuit *circuit,
+                                  int probe_idx, ThreadPool *pool) {
+    MonteCarloAnalysis *mc = &state->monte_carlo;
+    if (!circuit || !mc->active) {
+        mc->running = false;
+        return false;
+    }
+
+    MCContext *ctx = calloc(1, sizeof(MCContext));
+    int num_tasks = (pool && pool->initialized) ? MIN(pool->num_threads, mc->num_runs) : 0;
+    if (ctx) {
+        ctx->mc = mc;
+        ctx->circuit = circuit;
+        ctx->probe_idx = probe_idx;
+        ctx->vary = malloc((circuit->num_components + 1) * sizeof(MCVary));
+        ctx->workers = calloc(MAX(num_tasks, 1), sizeof(MCWorker));
+    }
+    bool ok = ctx && ctx->vary && ctx->workers;
+    if (ok) {
+        ctx->num_dims = mc_setup_variations(mc, circuit, ctx->vary);
+        ok = mc_setup_sampling(ctx);
+    }
+
+    // Runs are made in batches; with early stopping, the statistics of all
+    // runs so far are checked after each one. The decision only depends on
+    // runs in order, so it does not depend on the number of workers either.
+    mc->stopped_early = false;
+    int end = 0;
+    while (ok && end < mc->num_runs) {
+        atomic_store(&ctx->next_run, end);
+        atomic_store(&ctx->next_worker, 0);
+        end = (mc->ci_target > 0) ? MIN(mc->num_runs, MAX(mc->min_runs, end + MC_CHECK_RUNS)) :
+                                    mc->num_runs;
+        ctx->batch_end = end;
+
+        // One task per worker; without a pool (or if a task cannot be
+        // queued) the calling thread does the work
+        for (int i = 0; i < num_tasks; i++) {
+            if (!threadpool_submit(pool, mc_worker_task, ctx)) {
+                mc_worker_task(ctx, 0);
+            }
+        }
+        if (num_tasks > 0) {
+            threadpool_wait(pool);
+        } else {
+            mc_worker_task(ctx, 0);
+        }
+
+        ok = !mc->cancel && !atomic_load(&ctx->out_of_memory);
+        if (ok && mc->ci_target > 0 && end < mc->num_runs) {
+            mc_gather(state, ctx, end);
+            if (mc_converged(mc)) {
+                mc->stopped_early = true;
+                break;
+            }
+        }
+    }
+
+    if (ok) {
+        mc_gather(state, ctx, end);
+        mc->current_run = end;
         mc->complete = true;
+    }
+
+    if (ctx) {
+        for (int i = 0; ctx->workers && i < MAX(num_tasks, 1); i++) {
+            simulation_free(ctx->workers[i].sim);
+            circuit_free(ctx->workers[i].replica);
+            free(ctx->workers[i].draws);
+        }
+        free(ctx->workers);
+        free(ctx->vary);
+        free(ctx->lhs);
+        free(ctx->sobol);
+        free(ctx);
+    }
 
-        // Restore original values
-        analysis_mc_restore_values(circuit, backup);
+    // The next analysis draws new values
+    mc->seed = rng_bits(mc->seed, 0, 0);
 
-        // Calculate statistics
-        analysis_monte_carlo_stats(state);
+    mc->running = false;
+    return ok;
+}
+
+bool analysis_monte_carlo_set_tolerance(AnalysisState *state, int component_id,
+                                        double tolerance, MCDistribution distribution,
+                                        double bin_tolerance) {
+    MonteCarloAnalysis *mc = &state->monte_carlo;
+    int k = 0;
+    while (k < mc->num_tolerances && mc->tolerances[k].component_id != component_id) k++;
+    if (k == MAX_MC_TOLERANCES) return false;
+    if (k == mc->num_tolerances) mc->num_tolerances++;
+
+    mc->tolerances[k].component_id = component_id;
+    mc->tolerances[k].tolerance = tolerance;
+    mc->tolerances[k].distribution = distribution;
+    mc->tolerances[k].bin_tolerance = bin_tolerance;
+    return true;
+}
+
+// Sensitivity analysis functions
+
+// Field of comp holding parameter param (NULL if comp has none)
+static double *sens_param_field(Component *comp, SensParamType param) {
+    switch (param) {
+        case SENS_RESISTANCE:
+            if (comp->type == COMP_RESISTOR) return &comp->props.resistor.resistance;
+            if (comp->type == COMP_POTENTIOMETER) return &comp->props.potentiometer.resistance;
+            return NULL;
+        case SENS_CAPACITANCE:
+            if (comp->type == COMP_CAPACITOR || comp->type == COMP_CAPACITOR_ELEC) {
+                return &comp->props.capacitor.capacitance;
+            }
+            return NULL;
+        case SENS_INDUCTANCE:
+            return (comp->type == COMP_INDUCTOR) ? &comp->props.inductor.inductance : NULL;
+        case SENS_VOLTAGE:
+            return (comp->type == COMP_DC_VOLTAGE) ? &comp->props.dc_voltage.voltage : NULL;
+        case SENS_CURRENT:
+            return (comp->type == COMP_DC_CURRENT) ? &comp->props.dc_current.current : NULL;
+        case SENS_DIODE_IS:
+            return (comp->type == COMP_DIODE) ? &comp->props.diode.is : NULL;
+        case SENS_BJT_BF:
+        case SENS_BJT_IS:
+            if (comp->type != COMP_NPN_BJT && comp->type != COMP_PNP_BJT) return NULL;
+            return (param == SENS_BJT_BF) ? &comp->props.bjt.bf : &comp->props.bjt.is;
+        case SENS_MOSFET_VTH:
+        case SENS_MOSFET_KP:
+            if (comp->type != COMP_NMOS && comp->type != COMP_PMOS) return NULL;
+            return (param == SENS_MOSFET_VTH) ? &comp->props.mosfet.vth : &comp->props.mosfet.kp;
+        default:
+            return NULL;
+    }
+}
+
+// Tolerance (%) of a parameter: the component's own when it has one
+static double sens_param_tolerance(const Component *comp, SensParamType param,
+                                   double default_tol) {
+    if (param == SENS_RESISTANCE) {
+        double tol = (comp->type == COMP_RESISTOR) ? comp->props.resistor.tolerance :
+                                                     comp->props.potentiometer.tolerance;
+        if (tol > 0) return tol;
+    }
+    return default_tol;
+}
+
+// Largest |normalized| first
+static int compare_sensitivity(const void *a, const void *b) {
+    double sa = fabs(((const SensitivityEntry *)a)->normalized);
+    double sb = fabs(((const SensitivityEntry *)b)->normalized);
+    return (sa < sb) - (sa > sb);
+}
 
-        // Reset simulation back to normal
-        simulation_reset(sim);
+bool analysis_sensitivity_run(AnalysisState *state, Simulation *sim, int probe_idx,
+                              double frequency) {
+    SensitivityAnalysis *sens = &state->sensitivity;
+    sens->frequency = frequency;
+    sens->probe_idx = probe_idx;
+    sens->num_entries = 0;
+    sens->worst_case_delta = 0;
+    sens->complete = false;
+
+    Circuit *circuit = sim ? sim->circuit : NULL;
+    if (!circuit || probe_idx < 0 || probe_idx >= circuit->num_probes) return false;
+
+    SimSensitivity *ctx = simulation_sensitivity_begin(sim, circuit->probes[probe_idx].node_id,
+                                                       frequency);
+    if (!ctx) return false;
+
+    double yr, yi;
+    simulation_sensitivity_output(ctx, &yr, &yi);
+    double mag = sqrt(yr * yr + yi * yi);
+    bool ac = frequency > 0;
+    sens->output = ac ? mag : yr;
+    sens->output_phase = (ac && mag > 1e-12) ? atan2(yi, yr) * 180.0 / M_PI : 0;
+
+    bool ok = true;
+    for (int i = 0; ok && i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        for (int p = 0; p < SENS_PARAM_COUNT && sens->num_entries < MAX_SENSITIVITIES; p++) {
+            double *field = sens_param_field(comp, (SensParamType)p);
+            if (!field) continue;
+            // Reactances carry no current at the operating point
+            if (!ac && (p == SENS_CAPACITANCE || p == SENS_INDUCTANCE)) continue;
+
+            // The adjoint weight of the component is differentiated by a
+            // central difference of two re-stamps; the circuit is not
+            // solved again
+            double value = *field;
+            double h = (value != 0) ? 1e-4 * fabs(value) : 1e-6;
+            double ar, ai, br, bi;
+            *field = value + h;
+            ok = simulation_sensitivity_component(sim, ctx, comp, &ar, &ai);
+            *field = value - h;
+            ok = ok && simulation_sensitivity_component(sim, ctx, comp, &br, &bi);
+            *field = value;
+            if (!ok) break;
+
+            double dr = -(ar - br) / (2.0 * h);
+            double di = -(ai - bi) / (2.0 * h);
+
+            SensitivityEntry *entry = &sens->entries[sens->num_entries++];
+            entry->component_id = comp->id;
+            entry->param = (SensParamType)p;
+            entry->value = value;
+            entry->phase_derivative = 0;
+            if (ac) {
+                // d|y| = Re(conj(y) dy) / |y|, d(arg y) = Im(dy / y)
+                entry->derivative = (mag > 1e-12) ? (yr * dr + yi * di) / mag : 0;
+                entry->phase_derivative = (mag > 1e-12) ?
+                    (yr * di - yi * dr) / (mag * mag) * 180.0 / M_PI : 0;
+            } else {
+                entry->derivative = dr;
+            }
+            entry->normalized = (fabs(sens->output) > 1e-12) ?
+                                entry->derivative * value / fabs(sens->output) : 0;
+
+            double tol = sens_param_tolerance(comp, (SensParamType)p, sens->default_tolerance);
+            sens->worst_case_delta += fabs(entry->derivative * value) * tol / 100.0;
+        }
+    }
+
+    simulation_sensitivity_end(sim, ctx);
 
-        return true;  // Complete
+    if (!ok) {
+        sens->num_entries = 0;
+        sens->worst_case_delta = 0;
+        return false;
     }
 
-    return false;  // Not complete, more runs needed
+    qsort(sens->entries, sens->num_entries, sizeof(SensitivityEntry), compare_sensitivity);
+    sens->complete = true;
+    return true;
 }
 
 // FFT functions
@@ -510,25 +1210,17 @@ void analysis_fft_window(double *samples, int num_samples, int window_type) {
 // ~100x faster than DFT for N=1024 (10,240 vs 1,048,576 operations)
 // ============================================================================
 
-// Pre-computed twiddle factors for FFT (computed once, reused)
-static double fft_cos_table[FFT_SIZE];
-static double fft_sin_table[FFT_SIZE];
-static int fft_tables_initialized = 0;
-
-// Bit-reversal permutation lookup table
-static int fft_bit_rev[FFT_SIZE];
-
-// Initialize FFT lookup tables (called once)
-static void fft_init_tables(void) {
-    if (fft_tables_initialized) return;
+// Initialize the FFT lookup tables of a workspace (once)
+static void fft_init_tables(FFTWorkspace *w) {
+    if (w->tables_ready) return;
 
     int N = FFT_SIZE;
 
     // Pre-compute twiddle factors: W_N^k = e^(-2*pi*i*k/N) = cos - i*sin
     for (int k = 0; k < N; k++) {
         double angle = -2.0 * M_PI * k / N;
-        fft_cos_table[k] = cos(angle);
-        fft_sin_table[k] = sin(angle);
+        w->cos_table[k] = cos(angle);
+        w->sin_table[k] = sin(angle);
     }
 
     // Pre-compute bit-reversal indices
@@ -542,21 +1234,24 @@ static void fft_init_tables(void) {
             rev = (rev << 1) | (x & 1);
             x >>= 1;
         }
-        fft_bit_rev[i] = rev;
+        w->bit_rev[i] = rev;
     }
 
-    fft_tables_initialized = 1;
+    w->tables_ready = true;
 }
 
-// In-place Cooley-Tukey radix-2 decimation-in-time FFT
-// real[] and imag[] must be arrays of size N (power of 2)
-static void fft_transform(double *real, double *imag, int N) {
+// In-place Cooley-Tukey radix-2 decimation-in-time FFT of w->real and
+// w->imag (N = FFT_SIZE)
+static void fft_transform(FFTWorkspace *w) {
+    double *real = w->real, *imag = w->imag;
+    int N = FFT_SIZE;
+
     // Ensure lookup tables are ready
-    fft_init_tables();
+    fft_init_tables(w);
 
     // Bit-reversal permutation
     for (int i = 0; i < N; i++) {
-        int j = fft_bit_rev[i];
+        int j = w->bit_rev[i];
         if (i < j) {
             // Swap real[i] and real[j]
             double temp = real[i];
@@ -578,8 +1273,8 @@ static void fft_transform(double *real, double *imag, int N) {
             int k = 0;  // Twiddle index
             for (int j = i; j < i + halfsize; j++) {
                 // Butterfly operation
-                double cos_w = fft_cos_table[k];
-                double sin_w = fft_sin_table[k];
+                double cos_w = w->cos_table[k];
+                double sin_w = w->sin_table[k];
 
                 // t = W * x[j + halfsize]
                 double t_re = cos_w * real[j + halfsize] - sin_w * imag[j + halfsize];
@@ -618,14 +1313,15 @@ void analysis_fft_compute(AnalysisState *state, double *samples,
     }
 
     // Prepare real and imaginary arrays for FFT
-    static double fft_real[FFT_SIZE];
-    static double fft_imag[FFT_SIZE];
+    FFTWorkspace *work = &state->fft_work;
+    double *fft_real = work->real;
+    double *fft_imag = work->imag;
 
     memcpy(fft_real, windowed, FFT_SIZE * sizeof(double));
     memset(fft_imag, 0, FFT_SIZE * sizeof(double));  // Input is real-only
 
     // Perform FFT transform - O(n log n)
-    fft_transform(fft_real, fft_imag, FFT_SIZE);
+    fft_transform(work);
 
     // Extract magnitude and phase from complex output
     int N = FFT_SIZE;
@@ -10,9 +10,6 @@
 #include "circuits.h"
 #include "analysis.h"
 
-// Global wireless state for antenna TX/RX pairs
-WirelessState g_wireless = {0};
-
 // Thread data for frequency sweep
 typedef struct {
     Simulation *sim;
@@ -21,6 +18,7 @@ typedef struct {
     int source_node;
     int probe_node;
     int num_points;
+    ThreadPool *pool;
     bool success;
 } FreqSweepThreadData;
 
@@ -28,15 +26,42 @@ typedef struct {
 static int freq_sweep_thread_func(void *data) {
     FreqSweepThreadData *td = (FreqSweepThreadData *)data;
     td->success = simulation_freq_sweep(td->sim, td->start_freq, td->stop_freq,
-                                        td->source_node, td->probe_node, td->num_points);
+                                        td->source_node, td->probe_node, td->num_points,
+                                        td->pool);
     return 0;
 }
 
 // Static thread data (one sweep at a time)
 static FreqSweepThreadData g_sweep_data;
 
-// Static Monte Carlo backup storage
-static MCBackup g_mc_backup;
+// Thread data for Monte Carlo analysis
+typedef struct {
+    AnalysisState *analysis;
+    Circuit *snapshot;          // Copy of the circuit taken at start, owned by the thread
+    int probe_idx;
+    ThreadPool *pool;
+} MonteCarloThreadData;
+
+// Thread function for Monte Carlo analysis
+static int monte_carlo_thread_func(void *data) {
+    MonteCarloThreadData *td = (MonteCarloThreadData *)data;
+    analysis_monte_carlo_execute(td->analysis, td->snapshot, td->probe_idx, td->pool);
+    circuit_free(td->snapshot);
+    td->snapshot = NULL;
+    return 0;
+}
+
+// Static thread data (one Monte Carlo analysis at a time)
+static MonteCarloThreadData g_mc_data;
+
+// Cancel a running Monte Carlo analysis and wait for its thread
+static void app_stop_monte_carlo(App *app) {
+    if (!app->mc_thread_running) return;
+    app->analysis.monte_carlo.cancel = true;
+    SDL_WaitThread(app->mc_thread, NULL);
+    app->mc_thread = NULL;
+    app->mc_thread_running = false;
+}
 
 bool app_init(App *app) {
     memset(app, 0, sizeof(App));
@@ -107,6 +132,8 @@ bool app_init(App *app) {
         SDL_DestroyWindow(app->window);
         return false;
     }
+    // The interactive simulation keeps the probe debug log
+    app->simulation->probe_log = true;
 
     // Initialize UI
     ui_init(&app->ui);
@@ -117,6 +144,13 @@ bool app_init(App *app) {
     // Initialize analysis
     analysis_init(&app->analysis);
 
+    // Worker threads for parallel analyses (without them they run serially)
+    if (threadpool_init(&app->thread_pool, 0)) {
+        app->num_threads = threadpool_get_num_threads(&app->thread_pool);
+    } else {
+        app->num_threads = 1;
+    }
+
     // Set initial state
     app->running = true;
     app->show_voltages = false;
@@ -139,6 +173,10 @@ void app_shutdown(App *app) {
         app->freq_sweep_thread = NULL;
         app->freq_sweep_thread_running = false;
     }
+    app_stop_monte_carlo(app);
+    analysis_sweep_reset(&app->analysis);
+
+    threadpool_destroy(&app->thread_pool);
 
     // Clean up popup oscilloscope window if open
     if (app->ui.scope_popup_renderer) {
@@ -449,6 +487,7 @@ void app_handle_events(App *app) {
                         g_sweep_data.source_node = 0;
                         g_sweep_data.probe_node = probe_node;
                         g_sweep_data.num_points = app->ui.bode_num_points;
+                        g_sweep_data.pool = &app->thread_pool;
                         g_sweep_data.success = false;
 
                         app->freq_sweep_thread = SDL_CreateThread(
@@ -488,6 +527,7 @@ void app_handle_events(App *app) {
                         g_sweep_data.source_node = 0;
                         g_sweep_data.probe_node = probe_node;
                         g_sweep_data.num_points = app->ui.bode_num_points;
+                        g_sweep_data.pool = &app->thread_pool;
                         g_sweep_data.success = false;
 
                         app->freq_sweep_thread = SDL_CreateThread(
@@ -593,13 +633,35 @@ void app_handle_events(App *app) {
 
             case UI_ACTION_MC_RUN:
                 // Start Monte Carlo analysis
-                if (!app->analysis.monte_carlo.active) {
-                    // Initialize MC analysis
+                if (!app->analysis.monte_carlo.active && !app->mc_thread_running) {
+                    // The trials run on copies of this snapshot, so the
+                    // circuit stays editable meanwhile
+                    Circuit *snapshot = circuit_clone(app->circuit);
+                    if (!snapshot) {
+                        ui_set_status(&app->ui, "Error: out of memory for Monte Carlo");
+                        break;
+                    }
+
                     analysis_monte_carlo_init(&app->analysis, app->ui.monte_carlo_runs,
                                              true, app->ui.monte_carlo_tolerance);
-                    // Backup original component values
-                    analysis_mc_backup_values(app->circuit, &g_mc_backup);
-                    ui_set_status(&app->ui, "Monte Carlo analysis started...");
+                    app->analysis.monte_carlo.time_step = app->simulation->time_step;
+                    app->analysis.monte_carlo.environment = app->simulation->context.environment;
+
+                    g_mc_data.analysis = &app->analysis;
+                    g_mc_data.snapshot = snapshot;
+                    g_mc_data.probe_idx = 0;
+                    g_mc_data.pool = &app->thread_pool;
+
+                    app->mc_thread = SDL_CreateThread(
+                        monte_carlo_thread_func, "MonteCarlo", &g_mc_data);
+                    if (app->mc_thread) {
+                        app->mc_thread_running = true;
+                        ui_set_status(&app->ui, "Monte Carlo analysis started...");
+                    } else {
+                        circuit_free(snapshot);
+                        analysis_monte_carlo_reset(&app->analysis);
+                        ui_set_status(&app->ui, "Error: Could not start Monte Carlo thread");
+                    }
                 }
                 break;
 
@@ -638,10 +700,9 @@ void app_handle_events(App *app) {
                 break;
 
             case UI_ACTION_MC_RESET:
-                // Reset Monte Carlo results
+                // Reset Monte Carlo results (cancelling a run in progress)
+                app_stop_monte_carlo(app);
                 analysis_monte_carlo_reset(&app->analysis);
-                // Restore original values if MC was interrupted
-                analysis_mc_restore_values(app->circuit, &g_mc_backup);
                 ui_set_status(&app->ui, "Monte Carlo analysis reset");
                 break;
 
@@ -1490,40 +1551,37 @@ void app_update(App *app) {
         }
     }
 
-    // Run Monte Carlo analysis if active
-    if (app->analysis.monte_carlo.active && !app->analysis.monte_carlo.complete) {
-        // Run a few MC iterations per frame to keep UI responsive
-        for (int i = 0; i < 5; i++) {
-            bool done = analysis_monte_carlo_step(&app->analysis, app->circuit,
-                                                   app->simulation, 0, &g_mc_backup);
-            if (done) {
-                // Restore original component values
-                analysis_mc_restore_values(app->circuit, &g_mc_backup);
-
-                // Update status with results
-                char msg[128];
+    // Check for Monte Carlo thread completion
+    if (app->mc_thread_running) {
+        MonteCarloAnalysis *mc = &app->analysis.monte_carlo;
+        if (!mc->running) {
+            SDL_WaitThread(app->mc_thread, NULL);
+            app->mc_thread = NULL;
+            app->mc_thread_running = false;
+
+            char msg[128];
+            if (mc->complete && mc->num_results > 0) {
                 snprintf(msg, sizeof(msg), "MC complete: Mean=%.3fV, StdDev=%.3fV, Range=[%.3f, %.3f]V",
-                    app->analysis.monte_carlo.mean,
-                    app->analysis.monte_carlo.std_dev,
-                    app->analysis.monte_carlo.min_val,
-                    app->analysis.monte_carlo.max_val);
-                ui_set_status(&app->ui, msg);
-                break;
+                    mc->mean, mc->std_dev, mc->min_val, mc->max_val);
+            } else if (mc->complete) {
+                snprintf(msg, sizeof(msg), "Monte Carlo: all %d runs failed", mc->num_failed);
+            } else {
+                snprintf(msg, sizeof(msg), "Monte Carlo analysis failed");
+                analysis_monte_carlo_reset(&app->analysis);
             }
-        }
-
-        // Update progress in status bar
-        if (!app->analysis.monte_carlo.complete) {
+            ui_set_status(&app->ui, msg);
+        } else {
+            // Update progress in status bar
             char msg[64];
             snprintf(msg, sizeof(msg), "Monte Carlo: %d/%d runs...",
-                app->analysis.monte_carlo.current_run,
-                app->analysis.monte_carlo.num_runs);
+                mc->current_run, mc->num_runs);
             ui_set_status(&app->ui, msg);
         }
     }
 
-    // Run simulation if active
-    if (app->simulation->state == SIM_RUNNING) {
+    // Run simulation if active (held while a frequency sweep linearizes
+    // and solves the circuit on its own thread)
+    if (app->simulation->state == SIM_RUNNING && !app->freq_sweep_thread_running) {
         // Calculate steps based on speed
         int steps = (int)(delta_time * app->simulation->speed * 1000);
         steps = CLAMP(steps, 1, 1000);
@@ -42,6 +42,33 @@ void circuit_free(Circuit *circuit) {
     free(circuit);
 }
 
+Circuit *circuit_clone(const Circuit *circuit) {
+    if (!circuit) return NULL;
+
+    Circuit *clone = malloc(sizeof(Circuit));
+    if (!clone) return NULL;
+
+    // Nodes, wires, probes and the node map are plain arrays. Components are
+    // copied whole, ids and node connections included; the clipboard and
+    // the undo history stay with the original.
+    memcpy(clone, circuit, sizeof(Circuit));
+    clone->clipboard = NULL;
+    clone->undo_count = 0;
+    clone->redo_count = 0;
+
+    for (int i = 0; i < circuit->num_components; i++) {
+        clone->components[i] = malloc(sizeof(Component));
+        if (!clone->components[i]) {
+            clone->num_components = i;
+            circuit_free(clone);
+            return NULL;
+        }
+        memcpy(clone->components[i], circuit->components[i], sizeof(Component));
+    }
+
+    return clone;
+}
+
 void circuit_clear(Circuit *circuit) {
     if (!circuit) return;
 
@@ -557,9 +584,30 @@ static double get_mapped_voltage_internal(Circuit *circuit, int node_id, Vector
     return 0.0;
 }
 
+// Table of each node ID's array position (-1 if absent), so the per-step
+// updates below find nodes without scanning the node array
+static void circuit_index_nodes(Circuit *circuit, int *node_index) {
+    for (int i = 0; i < MAX_NODES; i++) node_index[i] = -1;
+    for (int i = 0; i < circuit->num_nodes; i++) {
+        int id = circuit->nodes[i].id;
+        if (id >= 0 && id < MAX_NODES) node_index[id] = i;
+    }
+}
+
+// Node with the given ID through that table; IDs past it fall back to a scan
+static Node *indexed_node(Circuit *circuit, const int *node_index, int id) {
+    if (id >= 0 && id < MAX_NODES) {
+        return node_index[id] >= 0 ? &circuit->nodes[node_index[id]] : NULL;
+    }
+    return circuit_get_node(circuit, id);
+}
+
 void circuit_update_voltages(Circuit *circuit, Vector *solution) {
     if (!circuit || !solution) return;
 
+    int node_index[MAX_NODES];
+    circuit_index_nodes(circuit, node_index);
+
     for (int i = 0; i < circuit->num_nodes; i++) {
         Node *node = &circuit->nodes[i];
         int idx = circuit->node_map[node->id];
@@ -573,7 +621,7 @@ void circuit_update_voltages(Circuit *circuit, Vector *solution) {
 
     // Update probes
     for (int i = 0; i < circuit->num_probes; i++) {
-        Node *node = circuit_get_node(circuit, circuit->probes[i].node_id);
+        Node *node = indexed_node(circuit, node_index, circuit->probes[i].node_id);
         circuit->probes[i].voltage = node ? node->voltage : 0;
     }
 
@@ -581,8 +629,8 @@ void circuit_update_voltages(Circuit *circuit, Vector *solution) {
     for (int i = 0; i < circuit->num_components; i++) {
         Component *comp = circuit->components[i];
         if (comp->type == COMP_RESISTOR && comp->num_terminals >= 2) {
-            Node *n1 = circuit_get_node(circuit, comp->node_ids[0]);
-            Node *n2 = circuit_get_node(circuit, comp->node_ids[1]);
+            Node *n1 = indexed_node(circuit, node_index, comp->node_ids[0]);
+            Node *n2 = indexed_node(circuit, node_index, comp->node_ids[1]);
             if (n1 && n2) {
                 double v_diff = n1->voltage - n2->voltage;
                 double R = comp->props.resistor.resistance;
@@ -594,8 +642,8 @@ void circuit_update_voltages(Circuit *circuit, Vector *solution) {
         // For series circuits, find connected resistor and use its current (Ohm's law)
         // This ensures KCL is satisfied for display purposes
         else if (comp->type == COMP_LED && comp->num_terminals >= 2) {
-            Node *led_n1 = circuit_get_node(circuit, comp->node_ids[0]);
-            Node *led_n2 = circuit_get_node(circuit, comp->node_ids[1]);
+            Node *led_n1 = indexed_node(circuit, node_index, comp->node_ids[0]);
+            Node *led_n2 = indexed_node(circuit, node_index, comp->node_ids[1]);
             double led_current = 0.0;
 
             if (led_n1 && led_n2) {
@@ -613,8 +661,8 @@ void circuit_update_voltages(Circuit *circuit, Vector *solution) {
 
                         if (shared_count == 1) {
                             // Series connection - use resistor current
-                            Node *r_n1 = circuit_get_node(circuit, other->node_ids[0]);
-                            Node *r_n2 = circuit_get_node(circuit, other->node_ids[1]);
+                            Node *r_n1 = indexed_node(circuit, node_index, other->node_ids[0]);
+                            Node *r_n2 = indexed_node(circuit, node_index, other->node_ids[1]);
                             if (r_n1 && r_n2 && other->props.resistor.resistance > 0) {
                                 double v_diff = fabs(r_n1->voltage - r_n2->voltage);
                                 led_current = v_diff / other->props.resistor.resistance;
@@ -828,8 +876,20 @@ static double calculate_component_current(Component *comp, double v1, double v2)
     return 0;
 }
 
+// Whether a node ID belongs to a ground component, through a table of flags
+// with the full list as fallback for IDs past it
+static bool ground_listed(const bool *ground_flag, const int *ground_nodes,
+                          int num_ground_nodes, int id) {
+    if (id >= 0 && id < MAX_NODES) return ground_flag[id];
+    for (int g = 0; g < num_ground_nodes; g++) {
+        if (ground_nodes[g] == id) return true;
+    }
+    return false;
+}
+
 // BFS-based current flow tracing from sources to ground
 // This properly traces current direction through all wires in the path
+
 void circuit_update_wire_currents(Circuit *circuit) {
     if (!circuit) return;
 
@@ -838,6 +898,9 @@ void circuit_update_wire_currents(Circuit *circuit) {
         circuit->wires[w].current = 0;
     }
 
+    int node_index[MAX_NODES];
+    circuit_index_nodes(circuit, node_index);
+
     // Find circuit current magnitude from resistors/components
     double circuit_current = 0;
     for (int c = 0; c < circuit->num_components; c++) {
@@ -846,8 +909,8 @@ void circuit_update_wire_currents(Circuit *circuit) {
 
         if (comp->type == COMP_RESISTOR || comp->type == COMP_LED ||
             comp->type == COMP_SPST_SWITCH || comp->type == COMP_PUSH_BUTTON) {
-            Node *n0 = circuit_get_node(circuit, comp->node_ids[0]);
-            Node *n1 = circuit_get_node(circuit, comp->node_ids[1]);
+            Node *n0 = indexed_node(circuit, node_index, comp->node_ids[0]);
+            Node *n1 = indexed_node(circuit, node_index, comp->node_ids[1]);
             if (n0 && n1) {
                 double current = fabs(calculate_component_current(comp, n0->voltage, n1->voltage));
                 if (current > circuit_current) {
@@ -888,6 +951,58 @@ void circuit_update_wire_currents(Circuit *circuit) {
             }
         }
     }
+    bool ground_flag[MAX_NODES];
+    memset(ground_flag, 0, sizeof(ground_flag));
+    for (int g = 0; g < num_ground_nodes; g++) {
+        if (ground_nodes[g] < MAX_NODES) ground_flag[ground_nodes[g]] = true;
+    }
+
+    // Index wires and component terminals by node ID, in the order a scan of
+    // all wires and components would meet them, so the walk below looks at a
+    // node's neighbours directly instead of scanning the whole circuit per node
+    int wire_first[MAX_NODES + 1];
+    int wire_adj[MAX_WIRES * 2];
+    memset(wire_first, 0, sizeof(wire_first));
+    for (int w = 0; w < circuit->num_wires; w++) {
+        int a = circuit->wires[w].start_node_id;
+        int b = circuit->wires[w].end_node_id;
+        if (a >= 0 && a < MAX_NODES) wire_first[a + 1]++;
+        if (b >= 0 && b < MAX_NODES && b != a) wire_first[b + 1]++;
+    }
+    for (int i = 0; i < MAX_NODES; i++) wire_first[i + 1] += wire_first[i];
+    int wire_fill[MAX_NODES];
+    memcpy(wire_fill, wire_first, sizeof(wire_fill));
+    for (int w = 0; w < circuit->num_wires; w++) {
+        int a = circuit->wires[w].start_node_id;
+        int b = circuit->wires[w].end_node_id;
+        if (a >= 0 && a < MAX_NODES) wire_adj[wire_fill[a]++] = w;
+        if (b >= 0 && b < MAX_NODES && b != a) wire_adj[wire_fill[b]++] = w;
+    }
+
+    // Terminals of multi-terminal components other than grounds, encoded as
+    // component * MAX_TERMINALS + terminal
+    int term_first[MAX_NODES + 1];
+    int term_adj[MAX_COMPONENTS * MAX_TERMINALS];
+    memset(term_first, 0, sizeof(term_first));
+    for (int c = 0; c < circuit->num_components; c++) {
+        Component *comp = circuit->components[c];
+        if (!comp || comp->num_terminals < 2 || comp->type == COMP_GROUND) continue;
+        for (int t = 0; t < comp->num_terminals; t++) {
+            int id = comp->node_ids[t];
+            if (id >= 0 && id < MAX_NODES) term_first[id + 1]++;
+        }
+    }
+    for (int i = 0; i < MAX_NODES; i++) term_first[i + 1] += term_first[i];
+    int term_fill[MAX_NODES];
+    memcpy(term_fill, term_first, sizeof(term_fill));
+    for (int c = 0; c < circuit->num_components; c++) {
+        Component *comp = circuit->components[c];
+        if (!comp || comp->num_terminals < 2 || comp->type == COMP_GROUND) continue;
+        for (int t = 0; t < comp->num_terminals; t++) {
+            int id = comp->node_ids[t];
+            if (id >= 0 && id < MAX_NODES) term_adj[term_fill[id]++] = c * MAX_TERMINALS + t;
+        }
+    }
 
     // Find all voltage/current sources
     for (int c = 0; c < circuit->num_components; c++) {
@@ -900,7 +1015,7 @@ void circuit_update_wire_currents(Circuit *circuit) {
 
         // Terminal 0 is positive (+), Terminal 1 is negative (-)
         int source_pos_node = comp->node_ids[0];
-        int source_neg_node = comp->node_ids[1];
+        if (source_pos_node < 0 || source_pos_node >= MAX_NODES) continue;
 
         // BFS from source positive terminal to find all paths to ground
         // Track: node_id, came_from_wire_idx, direction (+1 = start->end, -1 = end->start)
@@ -920,32 +1035,6 @@ void circuit_update_wire_currents(Circuit *circuit) {
         queue[queue_end++] = (BFSEntry){source_pos_node, -1, 0};
         visited[source_pos_node] = 1;
 
-        // Check for short circuit: is source negative terminal a ground?
-        bool neg_is_ground = false;
-        for (int g = 0; g < num_ground_nodes; g++) {
-            if (ground_nodes[g] == source_neg_node) {
-                neg_is_ground = true;
-                break;
-            }
-        }
-
-        // Also check if any ground component is at the negative node position
-        for (int c2 = 0; c2 < circuit->num_components; c2++) {
-            Component *gnd = circuit->components[c2];
-            if (gnd && gnd->type == COMP_GROUND && gnd->num_terminals >= 1) {
-                Node *gnd_node = circuit_get_node(circuit, gnd->node_ids[0]);
-                Node *neg_node = circuit_get_node(circuit, source_neg_node);
-                if (gnd_node && neg_node) {
-                    float dx = gnd_node->x - neg_node->x;
-                    float dy = gnd_node->y - neg_node->y;
-                    if (dx*dx + dy*dy < 100) {  // Within 10 units
-                        neg_is_ground = true;
-                        break;
-                    }
-                }
-            }
-        }
-
         // BFS to find all wires on paths to ground
         while (queue_start < queue_end) {
             BFSEntry entry = queue[queue_start++];
@@ -961,16 +1050,10 @@ void circuit_update_wire_currents(Circuit *circuit) {
             }
 
             // Check if we reached ground
-            bool at_ground = false;
-            for (int g = 0; g < num_ground_nodes; g++) {
-                if (ground_nodes[g] == current_node) {
-                    at_ground = true;
-                    break;
-                }
-            }
+            bool at_ground = ground_listed(ground_flag, ground_nodes, num_ground_nodes, current_node);
 
             // Also check if current node has a ground component
-            Node *cur_node = circuit_get_node(circuit, current_node);
+            Node *cur_node = indexed_node(circuit, node_index, current_node);
             if (cur_node && cur_node->is_ground) {
                 at_ground = true;
             }
@@ -982,7 +1065,8 @@ void circuit_update_wire_currents(Circuit *circuit) {
             }
 
             // Explore connected wires
-            for (int w = 0; w < circuit->num_wires; w++) {
+            for (int a = wire_first[current_node]; a < wire_first[current_node + 1]; a++) {
+                int w = wire_adj[a];
                 Wire *wire = &circuit->wires[w];
 
                 int next_node = -1;
@@ -1012,26 +1096,19 @@ void circuit_update_wire_currents(Circuit *circuit) {
             }
 
             // Also explore through components (current flows through components too)
-            for (int c2 = 0; c2 < circuit->num_components; c2++) {
-                Component *other = circuit->components[c2];
-                if (!other || other->num_terminals < 2) continue;
-
-                // Skip ground (it's a destination, not a path)
-                if (other->type == COMP_GROUND) continue;
-
-                // Check if component connects to current node
-                for (int t = 0; t < other->num_terminals; t++) {
-                    if (other->node_ids[t] == current_node) {
-                        // Component connects - find other terminals
-                        for (int t2 = 0; t2 < other->num_terminals; t2++) {
-                            if (t2 != t) {
-                                int next_node = other->node_ids[t2];
-                                if (next_node >= 0 && next_node < MAX_NODES && !visited[next_node]) {
-                                    visited[next_node] = 1;
-                                    // No wire for this hop, but mark node as visited
-                                    queue[queue_end++] = (BFSEntry){next_node, -1, 0};
-                                }
-                            }
+            // (grounds are destinations, not paths, and are not indexed)
+            for (int a = term_first[current_node]; a < term_first[current_node + 1]; a++) {
+                Component *other = circuit->components[term_adj[a] / MAX_TERMINALS];
+                int t = term_adj[a] % MAX_TERMINALS;
+
+                // Component connects - find other terminals
+                for (int t2 = 0; t2 < other->num_terminals; t2++) {
+                    if (t2 != t) {
+                        int next_node = other->node_ids[t2];
+                        if (next_node >= 0 && next_node < MAX_NODES && !visited[next_node]) {
+                            visited[next_node] = 1;
+                            // No wire for this hop, but mark node as visited
+                            queue[queue_end++] = (BFSEntry){next_node, -1, 0};
                         }
                     }
                 }
@@ -1115,6 +1192,15 @@ void circuit_update_wire_currents(Circuit *circuit) {
     // Third pass: Special cases for voltage source connections
     // 1. Wire from voltage source negative terminal to ground: current flows TOWARD negative (from ground)
     // 2. Wire between two voltage sources: current flows toward lower voltage source
+    Component *vsources[MAX_COMPONENTS];
+    int num_vsources = 0;
+    for (int c = 0; c < circuit->num_components; c++) {
+        Component *comp = circuit->components[c];
+        if (!comp) continue;
+        bool is_vsource = (comp->type == COMP_DC_VOLTAGE || comp->type == COMP_AC_VOLTAGE ||
+                          comp->type == COMP_BATTERY);
+        if (is_vsource && comp->num_terminals >= 2) vsources[num_vsources++] = comp;
+    }
     for (int w = 0; w < circuit->num_wires; w++) {
         Wire *wire = &circuit->wires[w];
 
@@ -1124,25 +1210,13 @@ void circuit_update_wire_currents(Circuit *circuit) {
         if (start_id < 0 || end_id < 0) continue;
 
         // Check if start node is a ground
-        bool start_is_ground = false;
-        for (int g = 0; g < num_ground_nodes; g++) {
-            if (ground_nodes[g] == start_id) {
-                start_is_ground = true;
-                break;
-            }
-        }
-        Node *start_node = circuit_get_node(circuit, start_id);
+        bool start_is_ground = ground_listed(ground_flag, ground_nodes, num_ground_nodes, start_id);
+        Node *start_node = indexed_node(circuit, node_index, start_id);
         if (start_node && start_node->is_ground) start_is_ground = true;
 
         // Check if end node is a ground
-        bool end_is_ground = false;
-        for (int g = 0; g < num_ground_nodes; g++) {
-            if (ground_nodes[g] == end_id) {
-                end_is_ground = true;
-                break;
-            }
-        }
-        Node *end_node = circuit_get_node(circuit, end_id);
+        bool end_is_ground = ground_listed(ground_flag, ground_nodes, num_ground_nodes, end_id);
+        Node *end_node = indexed_node(circuit, node_index, end_id);
         if (end_node && end_node->is_ground) end_is_ground = true;
 
         // Find voltage sources connected to wire endpoints
@@ -1151,12 +1225,8 @@ void circuit_update_wire_currents(Circuit *circuit) {
         Component *end_source = NULL;
         int end_source_terminal = -1;
 
-        for (int c = 0; c < circuit->num_components; c++) {
-            Component *comp = circuit->components[c];
-            if (!comp) continue;
-            bool is_vsource = (comp->type == COMP_DC_VOLTAGE || comp->type == COMP_AC_VOLTAGE ||
-                              comp->type == COMP_BATTERY);
-            if (!is_vsource || comp->num_terminals < 2) continue;
+        for (int v = 0; v < num_vsources; v++) {
+            Component *comp = vsources[v];
 
             // Check if this source connects to start node
             if (comp->node_ids[0] == start_id) {
@@ -203,6 +203,8 @@ static const CircuitTemplateInfo template_info[] = {
     // Signal Processing Circuits
     [CIRCUIT_CLAMPER] = {"Neg Clamper", "Clmp", "Negative clamper (DC restorer)"},
     [CIRCUIT_PHASE_SHIFT_OSC] = {"Phase Shift Osc", "PhOsc", "RC phase shift oscillator (keep noise on)"},
+    // Large Networks
+    [CIRCUIT_RC_MESH] = {"RC Mesh", "Mesh", "16x16 RC diffusion mesh driven through a diode"},
 };
 
 const CircuitTemplateInfo *circuit_template_get_info(CircuitTemplateType type) {
@@ -6446,6 +6448,78 @@ static int place_phase_shift_osc(Circuit *circuit, float x, float y) {
     return 16;  // opamp, rf, rin, noise, gnd_noise, sw, r_inject, r1, c1, r2, c2, r3, c3, gnd, rload, gnd_load
 }
 
+// RC Mesh:
+// Diode-fed square grid of resistors with a capacitor to ground at every
+// node, a lumped model of diffusion through a resistive sheet. The far corner
+// lags the driven one by milliseconds. Its fill-heavy matrix makes each
+// factorization expensive, so the simulator reuses factors across Newton
+// iterations here where it refactors on every other template.
+#define RC_MESH_SIZE 16         // Nodes per side
+#define RC_MESH_PITCH_X 160.0f
+#define RC_MESH_PITCH_Y 200.0f
+
+static int place_rc_mesh(Circuit *circuit, float x, float y) {
+    // Layout of one cell, node at (X, Y):
+    //
+    //     X    X+40  X+80       X+160
+    //  Y: *-----+-----[R]--------*  (next node)
+    //     |     |
+    //    [R]   [C]
+    //     |     |
+    //     |   [GND]
+    //     |
+    //     *  (node below, at Y+200)
+    // Every component, node and wire must fit, or the mesh would be torn
+    int k = RC_MESH_SIZE;
+    int count = 3 + k * k * 2 + 2 * k * (k - 1);
+    if (circuit->num_components + count > MAX_COMPONENTS ||
+        circuit->num_nodes + 6 * k * k + 4 > MAX_NODES ||
+        circuit->num_wires + 2 * k * k + 2 * k * (k - 1) + 2 > MAX_WIRES) {
+        return 0;
+    }
+
+    // AC source feeding the top-left corner through a diode; terminals that
+    // land on each other share a node without a wire
+    Component *vsrc = add_comp(circuit, COMP_AC_VOLTAGE, x - 160, y + 40, 0);
+    if (!vsrc) return 0;
+    vsrc->props.ac_voltage.amplitude = 5.0;
+    vsrc->props.ac_voltage.frequency = 1000.0;
+    add_comp(circuit, COMP_GROUND, x - 160, y + 100, 0);
+    add_comp(circuit, COMP_DIODE, x - 80, y, 0);
+    wire_L_shape(circuit, x - 160, y, x - 120, y, true);
+    wire_L_shape(circuit, x - 40, y, x, y, true);
+
+    for (int j = 0; j < k; j++) {
+        for (int i = 0; i < k; i++) {
+            float nx = x + i * RC_MESH_PITCH_X;
+            float ny = y + j * RC_MESH_PITCH_Y;
+
+            // Capacitor to ground on a stub right of the node
+            Component *cap = add_comp(circuit, COMP_CAPACITOR, nx + 40, ny + 80, 90);
+            cap->props.capacitor.capacitance = 10e-9;
+            add_comp(circuit, COMP_GROUND, nx + 40, ny + 140, 0);
+            wire_L_shape(circuit, nx, ny, nx + 40, ny, true);
+            wire_L_shape(circuit, nx + 40, ny, nx + 40, ny + 40, true);
+
+            // Resistor to the node on the right
+            if (i + 1 < k) {
+                Component *r = add_comp(circuit, COMP_RESISTOR, nx + 120, ny, 0);
+                r->props.resistor.resistance = 1000.0;
+                wire_L_shape(circuit, nx + 40, ny, nx + 80, ny, true);
+            }
+
+            // Resistor to the node below
+            if (j + 1 < k) {
+                Component *r = add_comp(circuit, COMP_RESISTOR, nx, ny + 40, 90);
+                r->props.resistor.resistance = 1000.0;
+                wire_L_shape(circuit, nx, ny + 80, nx, ny + RC_MESH_PITCH_Y, true);
+            }
+        }
+    }
+
+    return count;
+}
+
 int circuit_place_template(Circuit *circuit, CircuitTemplateType type, float x, float y) {
     if (!circuit) return 0;
 
@@ -6553,6 +6627,9 @@ int circuit_place_template(Circuit *circuit, CircuitTemplateType type, float x,
             return place_clamper(circuit, x, y);
         case CIRCUIT_PHASE_SHIFT_OSC:
             return place_phase_shift_osc(circuit, x, y);
+        // Large Networks
+        case CIRCUIT_RC_MESH:
+            return place_rc_mesh(circuit, x, y);
         default:
             return 0;
     }
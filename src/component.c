@@ -7,12 +7,7 @@
 #include <stdio.h>
 #include <math.h>
 #include "component.h"
-
-// Global environment state (affects LDR and thermistor components)
-EnvironmentState g_environment = {
-    .light_level = 0.5,     // Default: medium light (0.0=dark to 1.0=bright)
-    .temperature = 25.0     // Default: room temperature (°C)
-};
+#include "rng.h"
 
 // Global sub-circuit library
 SubCircuitLibrary g_subcircuit_library = {
@@ -1759,7 +1754,10 @@ Component *component_create(ComponentType type, float x, float y) {
                                type == COMP_FM_SOURCE ||
                                type == COMP_BATTERY ||
                                type == COMP_PULSE_SOURCE ||
-                               type == COMP_PWM_SOURCE);
+                               type == COMP_PWM_SOURCE ||
+                               type == COMP_PWL_SOURCE ||
+                               type == COMP_EXPR_SOURCE ||
+                               type == COMP_RELAY);
 
     // Initialize thermal state for components that can fail
     comp->thermal.temperature = 25.0;           // Room temperature
@@ -1975,11 +1973,11 @@ int component_get_terminal_at(Component *comp, float px, float py, float thresho
 
 // Stamping helper macros
 #define STAMP_CONDUCTANCE(n1, n2, g) do { \
-    if ((n1) > 0) matrix_add(A, (n1)-1, (n1)-1, (g)); \
-    if ((n2) > 0) matrix_add(A, (n2)-1, (n2)-1, (g)); \
+    if ((n1) > 0) sparse_add(A, (n1)-1, (n1)-1, (g)); \
+    if ((n2) > 0) sparse_add(A, (n2)-1, (n2)-1, (g)); \
     if ((n1) > 0 && (n2) > 0) { \
-        matrix_add(A, (n1)-1, (n2)-1, -(g)); \
-        matrix_add(A, (n2)-1, (n1)-1, -(g)); \
+        sparse_add(A, (n1)-1, (n2)-1, -(g)); \
+        sparse_add(A, (n2)-1, (n1)-1, -(g)); \
     } \
 } while(0)
 
@@ -2054,23 +2052,776 @@ double sweep_get_value(const SweepConfig *sweep, double base_value, double time)
     return result;
 }
 
-void component_stamp(Component *comp, Matrix *A, Vector *b,
-                     int *node_map, int num_nodes,
-                     double time, Vector *prev_solution, double dt) {
-    if (!comp || !A || !b || !node_map) return;
+void component_setup(Component *comp, const int *node_map) {
+    if (!comp || !node_map) return;
 
-    // Get node indices
-    int n[MAX_TERMINALS];
-    for (int i = 0; i < comp->num_terminals; i++) {
-        n[i] = (comp->node_ids[i] > 0) ? node_map[comp->node_ids[i]] : 0;
+    for (int i = 0; i < MAX_TERMINALS; i++) {
+        int id = (i < comp->num_terminals) ? comp->node_ids[i] : 0;
+        comp->matrix_nodes[i] = (id > 0 && id < MAX_NODES) ? node_map[id] : 0;
+    }
+    comp->bypass.valid = false;
+    memset(&comp->limit, 0, sizeof(comp->limit));
+    memset(&comp->accepted_limit, 0, sizeof(comp->accepted_limit));
+    memset(&comp->reactive, 0, sizeof(comp->reactive));
+}
+
+bool component_is_linear(const Component *comp) {
+    if (!comp) return false;
+    if (comp->ideal_switch) return true;
+
+    switch (comp->type) {
+        case COMP_GROUND:
+        case COMP_DC_VOLTAGE:
+        case COMP_AC_VOLTAGE:
+        case COMP_DC_CURRENT:
+        case COMP_AC_CURRENT:
+        case COMP_SQUARE_WAVE:
+        case COMP_TRIANGLE_WAVE:
+        case COMP_SAWTOOTH_WAVE:
+        case COMP_NOISE_SOURCE:
+        case COMP_PULSE_SOURCE:
+        case COMP_PWM_SOURCE:
+        case COMP_RESISTOR:
+        case COMP_POTENTIOMETER:
+        case COMP_CAPACITOR:
+        case COMP_CAPACITOR_ELEC:
+        case COMP_INDUCTOR:
+        case COMP_TRANSFORMER:
+        case COMP_TRANSFORMER_CT:
+        case COMP_VCVS:
+        case COMP_VCCS:
+        case COMP_CCVS:
+        case COMP_CCCS:
+        case COMP_SPST_SWITCH:
+        case COMP_SPDT_SWITCH:
+        case COMP_PUSH_BUTTON:
+        case COMP_VOLTMETER:
+        case COMP_AMMETER:
+        case COMP_WATTMETER:
+        case COMP_TEST_POINT:
+        case COMP_LABEL:
+            return true;
+        default:
+            return false;
+    }
+}
+
+bool component_set_ideal_switch(Component *comp, bool enable) {
+    if (!comp) return false;
+
+    bool supported = false;
+    switch (comp->type) {
+        case COMP_SPST_SWITCH:
+        case COMP_RELAY:
+        case COMP_ANALOG_SWITCH:
+            supported = true;
+            break;
+        case COMP_DIODE:
+            supported = comp->props.diode.ideal;
+            break;
+        default:
+            break;
+    }
+
+    comp->ideal_switch = enable && supported;
+    comp->switch_on = false;
+    return comp->ideal_switch;
+}
+
+bool component_ideal_switch_on(const Component *comp) {
+    if (!comp) return false;
+
+    switch (comp->type) {
+        case COMP_SPST_SWITCH:
+            return comp->props.switch_spst.closed;
+        case COMP_RELAY:
+            return comp->props.relay.energized;
+        default:
+            return comp->switch_on;
+    }
+}
+
+// Device bypass check: true if the cached linearized model was computed at
+// controlling voltages within tolerance of v and with identical parameters
+static bool device_bypass_hit(Component *comp, const double *v, int nv,
+                              const double *params, int np) {
+    DeviceBypass *bp = &comp->bypass;
+    if (!bp->valid) return false;
+
+    for (int k = 0; k < np; k++) {
+        if (params[k] != bp->params[k]) return false;
+    }
+    for (int k = 0; k < nv; k++) {
+        double tol = BYPASS_RELTOL * MAX(fabs(v[k]), fabs(bp->v[k])) + BYPASS_VNTOL;
+        if (fabs(v[k] - bp->v[k]) > tol) return false;
+    }
+    bp->hits++;
+    return true;
+}
+
+// Record the evaluation point of a freshly computed model (the caller fills
+// in g[] and i[])
+static void device_bypass_store(Component *comp, const double *v, int nv,
+                                const double *params, int np) {
+    DeviceBypass *bp = &comp->bypass;
+    memcpy(bp->v, v, nv * sizeof(double));
+    memcpy(bp->params, params, np * sizeof(double));
+    bp->valid = true;
+    bp->evaluations++;
+}
+
+// Junction voltage limiting (SPICE pnjlim): above the critical voltage, a
+// step of more than 2 nVt from the previous load's junction voltage follows
+// the logarithm of the diode curve instead of its exponential
+static double device_pnjlim(Component *comp, int k, double vnew, double nVt, double Is) {
+    DeviceLimit *lim = &comp->limit;
+    if (lim->valid && Is > 0) {
+        double vold = lim->v[k];
+        double vcrit = nVt * log(nVt / (sqrt(2.0) * Is));
+        if (vnew > vcrit && fabs(vnew - vold) > 2 * nVt) {
+            if (vold > 0) {
+                double arg = 1 + (vnew - vold) / nVt;
+                vnew = (arg > 0) ? vold + nVt * log(arg) : vcrit;
+            } else {
+                vnew = nVt * log(vnew / nVt);
+            }
+            lim->limited = true;
+        }
+    }
+    lim->v[k] = vnew;
+    return vnew;
+}
+
+// Gate-source voltage limiting (SPICE fetlim): keeps Vgs from jumping across
+// the threshold region, where the MOSFET characteristic bends the most
+static double device_fetlim(Component *comp, int k, double vnew, double vto) {
+    DeviceLimit *lim = &comp->limit;
+    double v = vnew;
+    if (lim->valid) {
+        double vold = lim->v[k];
+        double vtsthi = fabs(2 * (vold - vto)) + 2;
+        double vtstlo = vtsthi / 2 + 2;
+        double vtox = vto + 3.5;
+        double delv = vnew - vold;
+
+        if (vold >= vto) {
+            if (vold >= vtox) {
+                if (delv <= 0) {
+                    if (v >= vtox) {
+                        if (-delv > vtstlo) v = vold - vtstlo;
+                    } else {
+                        v = MAX(v, vto + 2);
+                    }
+                } else if (delv >= vtsthi) {
+                    v = vold + vtsthi;
+                }
+            } else {
+                v = (delv <= 0) ? MAX(v, vto - 0.5) : MIN(v, vto + 4);
+            }
+        } else {
+            if (delv <= 0) {
+                if (-delv > vtsthi) v = vold - vtsthi;
+            } else if (v <= vto + 0.5) {
+                if (delv > vtstlo) v = vold + vtstlo;
+            } else {
+                v = vto + 0.5;
+            }
+        }
+        if (v != vnew) lim->limited = true;
+    }
+    lim->v[k] = v;
+    return v;
+}
+
+// Drain-source voltage limiting (SPICE limvds)
+static double device_limvds(Component *comp, int k, double vnew) {
+    DeviceLimit *lim = &comp->limit;
+    double v = vnew;
+    // The model has no reverse mode, so only forward Vds is limited
+    if (lim->valid && vnew >= 0 && lim->v[k] >= 0) {
+        double vold = lim->v[k];
+        if (vold >= 3.5) {
+            if (v > vold) {
+                v = MIN(v, 3 * vold + 2);
+            } else if (v < 3.5) {
+                v = MAX(v, 2);
+            }
+        } else {
+            v = (v > vold) ? MIN(v, 4) : MAX(v, -0.5);
+        }
+        if (v != vnew) lim->limited = true;
+    }
+    lim->v[k] = v;
+    return v;
+}
+
+// Branch value sol[p] - sol[m] of a reactive state (-1 stands for ground)
+static double reactive_read(const Vector *sol, int p, int m) {
+    if (!sol) return 0;
+    double y = (p >= 0) ? sol->data[p] : 0;
+    if (m >= 0) y -= sol->data[m];
+    return y;
+}
+
+// Companion model of reactive state k with coefficient c (capacitance or
+// inductance): the derivative term c*dx/dt is geq*y + ieq, where y is the
+// branch value sol[p] - sol[m]. A series resistance r is folded in, so for
+// a capacitor geq/ieq is the Norton equivalent of C in series with its ESR.
+// Without an accepted point yet (the DC operating point, or the per-stamp
+// copies of subcircuit components) it is backward Euler from history.
+static void reactive_companion(Component *comp, int k, const Integrator *integ,
+                               double c, double r, const Vector *history,
+                               int p, int m, double *geq, double *ieq) {
+    ReactiveState *rs = &comp->reactive;
+    double g, i;
+    if (rs->valid) {
+        g = c * integ->ag[0];
+        i = c * (integ->ag[1] * rs->x1[k] + integ->ag[2] * rs->x2[k]) +
+            integ->ab1 * rs->d1[k];
+    } else {
+        g = c / integ->dt;
+        i = -g * reactive_read(history, p, m);
     }
+    if (r > 0) {
+        double scale = 1.0 / (1.0 + g * r);
+        g *= scale;
+        i *= scale;
+    }
+
+    rs->p[k] = p;
+    rs->m[k] = m;
+    rs->r[k] = r;
+    rs->c[k] = c;
+    rs->geq[k] = g;
+    rs->ieq[k] = i;
+    if (rs->count <= k) rs->count = k + 1;
+
+    *geq = g;
+    *ieq = i;
+}
+
+// Record the accepted solution in the integration history
+static void component_accept_history(Component *comp, const Vector *solution) {
+    ReactiveState *rs = &comp->reactive;
+    for (int k = 0; k < rs->count; k++) {
+        double y = reactive_read(solution, rs->p[k], rs->m[k]);
+        double d = rs->geq[k] * y + rs->ieq[k];
+        double x = y - rs->r[k] * d;
+        rs->x3[k] = rs->valid ? rs->x2[k] : x;
+        rs->x2[k] = rs->valid ? rs->x1[k] : x;
+        rs->x1[k] = x;
+        rs->d1[k] = d;
+    }
+    if (rs->count > 0) rs->valid = true;
+}
+
+// Advance the state the stamps read (or that is only displayed) over an
+// accepted step of dt, 0 for the DC operating point
+static void component_advance_state(Component *comp, const Vector *solution,
+                                    int num_nodes, double dt, SimContext *ctx) {
+    const int *n = comp->matrix_nodes;
+    double v_diff = reactive_read(solution, n[0] - 1, n[1] - 1);
+
+    switch (comp->type) {
+        case COMP_LED: {
+            // Current for glow rendering
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
+            double nVt = comp->props.led.n * Vt;
+            double Vd = CLAMP(v_diff, -5*nVt, 40*nVt);
+            double Id = comp->props.led.is * (exp(Vd / nVt) - 1);
+            comp->props.led.current = Id > 0 ? Id : 0;
+            break;
+        }
+
+        case COMP_LED_ARRAY: {
+            // Currents for rendering; a segment driven far past its rating
+            // burns out (open circuit from the next step on)
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
+            double nVt = comp->props.led_array.n * Vt;
+            double max_I = comp->props.led_array.max_current;
+            for (int i = 0; i < 8; i++) {
+                if (comp->props.led_array.failed[i]) {
+                    comp->props.led_array.currents[i] = 0;
+                    continue;
+                }
+                double Vd = CLAMP(reactive_read(solution, n[i] - 1, n[8] - 1), -5*nVt, 40*nVt);
+                double Id = comp->props.led_array.is * (exp(Vd / nVt) - 1);
+                comp->props.led_array.currents[i] = (Id > 0) ? Id : 0;
+                if (Id > max_I * 2.0 && Id > 0.001) {
+                    comp->props.led_array.failed[i] = true;
+                }
+            }
+            break;
+        }
+
+        case COMP_BATTERY: {
+            if (comp->props.battery.discharged) break;
+            double SoC = comp->props.battery.charge_state;
+            if (comp->props.battery.nominal_voltage * (0.85 + 0.15 * SoC) <
+                comp->props.battery.v_cutoff) {
+                comp->props.battery.discharged = true;
+                break;
+            }
+            if (comp->props.battery.ideal || dt <= 0) break;
+
+            // Discharge: dQ = I * dt, with I the source's branch current
+            double I_battery = solution->data[num_nodes + comp->voltage_var_idx];
+            comp->props.battery.current_draw = fabs(I_battery);
+            comp->props.battery.charge_coulombs -= fabs(I_battery) * dt;
+            if (comp->props.battery.charge_coulombs < 0) {
+                comp->props.battery.charge_coulombs = 0;
+            }
+
+            // Update SoC (charge_coulombs / initial_charge)
+            double initial_charge = comp->props.battery.capacity_mah * 3.6;  // mAh to C
+            comp->props.battery.charge_state = comp->props.battery.charge_coulombs / initial_charge;
+            if (comp->props.battery.charge_state < 0.01) {
+                comp->props.battery.discharged = true;
+            }
+            break;
+        }
+
+        case COMP_DC_MOTOR: {
+            // Armature current of the companion model the step was solved
+            // with (the inductance is a short at the operating point)
+            double R_a = comp->props.dc_motor.r_armature;
+            double L_a = comp->props.dc_motor.l_armature;
+            double omega_prev = comp->props.dc_motor.omega;
+            double I_prev = comp->props.dc_motor.current;
+            double V_bemf = comp->props.dc_motor.kv * omega_prev;
+            double Req = (dt > 0) ? R_a + L_a / dt : R_a;
+            double I = (v_diff - V_bemf) / Req;
+            if (dt > 0) I += I_prev * L_a / (Req * dt);
+            comp->props.dc_motor.v_bemf = V_bemf;
+            comp->props.dc_motor.current = I;
+
+            // Speed by forward Euler: J dω/dt = kt*I - b*ω - T_load
+            if (dt > 0) {
+                double T_motor = comp->props.dc_motor.kt * I_prev;
+                double T_friction = comp->props.dc_motor.b_friction * omega_prev;
+                double d_omega = (T_motor - T_friction - comp->props.dc_motor.torque_load) /
+                                 comp->props.dc_motor.j_rotor;
+                double omega_new = omega_prev + d_omega * dt;
+                if (omega_new < 0) omega_new = 0;  // Prevent negative rotation for simple DC motor
+                comp->props.dc_motor.omega = omega_new;
+            }
+            break;
+        }
+
+        case COMP_ANTENNA_TX: {
+            // Broadcast on the channel (averaged over all TX on it)
+            double v_tx = v_diff * comp->props.antenna.gain;
+            comp->props.antenna.voltage = v_tx;
+            int ch = comp->props.antenna.channel;
+            if (ch >= 0 && ch < WIRELESS_CHANNEL_COUNT) {
+                ctx->wireless.voltage[ch] += v_tx;
+                ctx->wireless.tx_count[ch]++;
+            }
+            break;
+        }
+
+        case COMP_ANTENNA_RX:
+            comp->props.antenna.voltage = v_diff;
+            break;
+
+        default:
+            break;
+    }
+}
+
+bool component_accept_step(Component *comp, const Vector *solution, int num_nodes,
+                           double time, double dt, SimContext *ctx) {
+    if (!comp || !solution || !ctx) return false;
+
+    component_accept_history(comp, solution);
+    component_advance_state(comp, solution, num_nodes, dt, ctx);
+    comp->accepted_limit = comp->limit;
+    return component_event_commit(comp, solution, num_nodes, time, dt);
+}
+
+void component_reject_step(Component *comp) {
+    if (!comp) return;
+    comp->limit = comp->accepted_limit;
+}
+
+double component_truncation_step(const Component *comp, const Vector *solution,
+                                 const Integrator *integ, const TruncationTolerance *tol) {
+    // Error constants of the methods (order 1, order 2)
+    static const double trap_coeff[2] = { 0.5, 1.0 / 12.0 };
+    static const double gear_coeff[2] = { 0.5, 2.0 / 9.0 };
+
+    const ReactiveState *rs = &comp->reactive;
+    int order = integ->order;
+    if (!rs->valid || !solution || integ->points < order + 1) return INFINITY;
+
+    double factor = (integ->method == INTEGRATE_GEAR2) ? gear_coeff[order - 1]
+                                                       : trap_coeff[order - 1];
+    double dt_max = INFINITY;
+
+    for (int k = 0; k < rs->count; k++) {
+        double c = rs->c[k];
+        double y = reactive_read(solution, rs->p[k], rs->m[k]);
+        double d = rs->geq[k] * y + rs->ieq[k];
+        double x = y - rs->r[k] * d;
+
+        double current_tol = tol->abstol + tol->reltol * fmax(fabs(d), fabs(rs->d1[k]));
+        double charge_tol = tol->reltol * fmax(fmax(fabs(c * x), fabs(c * rs->x1[k])),
+                                               tol->chgtol) / integ->dt;
+        double err_tol = fmax(current_tol, charge_tol);
+
+        // Divided differences of the charge (flux) over the new point and
+        // the accepted history, order + 1 times
+        double diff[4] = { c * x, c * rs->x1[k], c * rs->x2[k], c * rs->x3[k] };
+        double h[3] = { integ->dt, integ->dt_prev, integ->dt_prev2 };
+        double span[3] = { h[0], h[1], h[2] };
+        for (int j = order; ; ) {
+            for (int i = 0; i <= j; i++) {
+                diff[i] = (diff[i] - diff[i + 1]) / span[i];
+            }
+            if (--j < 0) break;
+            for (int i = 0; i <= j; i++) {
+                span[i] = span[i + 1] + h[i];
+            }
+        }
+
+        double step = tol->trtol * err_tol / fmax(tol->abstol, factor * fabs(diff[0]));
+        if (order == 2) step = sqrt(step);
+        if (step < dt_max) dt_max = step;
+    }
+    return dt_max;
+}
+
+// Earliest time after `after` at which the phase (t + shift) / period
+// crosses frac (0 <= frac < 1)
+static double periodic_next_edge(double after, double period, double shift, double frac) {
+    double n = floor((after + shift) / period - frac) + 1.0;
+    double t = (n + frac) * period - shift;
+    if (t <= after) t += period;
+    return t;
+}
+
+double component_next_breakpoint(const Component *comp, double time) {
+    double after = time + BREAKPOINT_RESOLUTION;
+    double next = INFINITY;
+
+    switch (comp->type) {
+        case COMP_SQUARE_WAVE: {
+            // A frequency sweep moves the edges continuously: not scheduled
+            double freq = comp->props.square_wave.frequency;
+            if (freq <= 0 || comp->props.square_wave.frequency_sweep.enabled) break;
+            double period = 1.0 / freq;
+            double shift = comp->props.square_wave.phase / (360.0 * freq);
+            next = fmin(periodic_next_edge(after, period, shift, 0.0),
+                        periodic_next_edge(after, period, shift, comp->props.square_wave.duty));
+            break;
+        }
+
+        case COMP_TRIANGLE_WAVE: {
+            // Corners at the bottom and top of the ramps
+            double freq = comp->props.triangle_wave.frequency;
+            if (freq <= 0 || comp->props.triangle_wave.frequency_sweep.enabled) break;
+            double period = 1.0 / freq;
+            double shift = comp->props.triangle_wave.phase / (360.0 * freq);
+            next = fmin(periodic_next_edge(after, period, shift, 0.0),
+                        periodic_next_edge(after, period, shift, 0.5));
+            break;
+        }
+
+        case COMP_SAWTOOTH_WAVE: {
+            double freq = comp->props.sawtooth_wave.frequency;
+            if (freq <= 0 || comp->props.sawtooth_wave.frequency_sweep.enabled) break;
+            double period = 1.0 / freq;
+            double shift = comp->props.sawtooth_wave.phase / (360.0 * freq);
+            next = periodic_next_edge(after, period, shift, 0.0);
+            break;
+        }
+
+        case COMP_CLOCK: {
+            double freq = comp->props.clock.frequency;
+            if (freq <= 0) break;
+            next = fmin(periodic_next_edge(after, 1.0 / freq, 0.0, 0.0),
+                        periodic_next_edge(after, 1.0 / freq, 0.0, comp->props.clock.duty));
+            break;
+        }
+
+        case COMP_PWM_SOURCE: {
+            double freq = comp->props.pwm_source.frequency;
+            if (freq <= 0) break;
+            next = fmin(periodic_next_edge(after, 1.0 / freq, 0.0, 0.0),
+                        periodic_next_edge(after, 1.0 / freq, 0.0, comp->props.pwm_source.duty));
+            break;
+        }
+
+        case COMP_PULSE_SOURCE: {
+            double delay = comp->props.pulse_source.delay;
+            double pw = comp->props.pulse_source.pulse_width;
+            double period = comp->props.pulse_source.period;
+            if (after < delay) {
+                next = delay;
+            } else if (period > 0) {
+                next = fmin(periodic_next_edge(after, period, -delay, 0.0),
+                            periodic_next_edge(after, period, -delay, fmod(pw / period, 1.0)));
+            } else if (after < delay + pw) {
+                next = delay + pw;
+            }
+            break;
+        }
+
+        case COMP_PWL_SOURCE: {
+            // Every point is a corner; in repeat mode the pattern restarts
+            // each period
+            int num_pts = comp->props.pwl_source.num_points;
+            if (num_pts <= 0) break;
+            const double *times = comp->props.pwl_source.times;
+
+            double period = 0.0;
+            if (comp->props.pwl_source.repeat && num_pts > 1) {
+                period = comp->props.pwl_source.repeat_period;
+                if (period <= 0) period = times[num_pts - 1];
+            }
+
+            double base = (period > 0) ? floor(after / period) * period : 0.0;
+            for (int i = 0; i < num_pts; i++) {
+                if (period > 0 && times[i] >= period) break;
+                if (base + times[i] > after) {
+                    next = base + times[i];
+                    break;
+                }
+            }
+            if (isinf(next) && period > 0) next = base + period;
+            break;
+        }
+
+        default:
+            break;
+    }
+    return next;
+}
+
+// On-state resistance of the SCR and TRIAC switch models
+#define THYRISTOR_R_ON 0.1
+
+// Voltage of a terminal in a solution vector (0 for ground)
+static double event_voltage(const Component *comp, const Vector *solution, int terminal) {
+    int node = comp->matrix_nodes[terminal];
+    return (node > 0) ? solution->data[node - 1] : 0.0;
+}
+
+// 555 comparator inputs: trigger and threshold relative to GND, and the
+// supply that sets the 1/3 and 2/3 VCC thresholds
+static void timer_555_inputs(const Component *comp, const Vector *solution,
+                             double *vcc, double *v_trig, double *v_thresh) {
+    double v_gnd = event_voltage(comp, solution, 1);
+    *vcc = event_voltage(comp, solution, 0) - v_gnd;
+    if (*vcc < 0.5) *vcc = comp->props.timer_555.vcc;  // Fallback
+    *v_trig = event_voltage(comp, solution, 2) - v_gnd;
+    *v_thresh = event_voltage(comp, solution, 3) - v_gnd;
+}
+
+// Fuse current from the voltage across its intact resistance
+static double fuse_current(const Component *comp, const Vector *solution) {
+    double v = event_voltage(comp, solution, 0) - event_voltage(comp, solution, 1);
+    return v / comp->props.fuse.resistance;
+}
+
+int component_event_guards(const Component *comp, const Vector *solution, int num_nodes,
+                           double elapsed, double *guards) {
+    if (!comp || !solution) return 0;
+
+    switch (comp->type) {
+        case COMP_RELAY: {
+            // Pull-in at the pickup current, release at the dropout current
+            double I = fabs(solution->data[num_nodes + comp->voltage_var_idx]);
+            guards[0] = comp->props.relay.energized ? comp->props.relay.i_dropout - I
+                                                    : I - comp->props.relay.i_pickup;
+            return 1;
+        }
+
+        case COMP_FUSE: {
+            if (comp->props.fuse.blown) return 0;
+            double I = fabs(fuse_current(comp, solution));
+            if (comp->props.fuse.ideal) {
+                // Instant blow when the current exceeds the rating
+                guards[0] = I - comp->props.fuse.rating;
+            } else {
+                // Blow when the accumulated i²t reaches the rating
+                double i2t = comp->props.fuse.i2t_accumulated;
+                if (I > comp->props.fuse.rating) i2t += I * I * elapsed;
+                guards[0] = i2t - comp->props.fuse.i2t;
+            }
+            return 1;
+        }
+
+        case COMP_555_TIMER: {
+            // TRIGGER below 1/3 VCC sets the flip-flop, THRESHOLD above
+            // 2/3 VCC resets it
+            double vcc, v_trig, v_thresh;
+            timer_555_inputs(comp, solution, &vcc, &v_trig, &v_thresh);
+            guards[0] = comp->props.timer_555.output ? v_thresh - 2.0 * vcc / 3.0
+                                                     : vcc / 3.0 - v_trig;
+            return 1;
+        }
+
+        case COMP_SCR: {
+            // Terminals: G, A, K. Fires on gate-cathode voltage, latches
+            // until the anode current falls below the holding current.
+            double v_k = event_voltage(comp, solution, 2);
+            if (comp->props.scr.on) {
+                double I = (event_voltage(comp, solution, 1) - v_k) / THYRISTOR_R_ON;
+                guards[0] = comp->props.scr.ih - I;
+            } else {
+                guards[0] = (event_voltage(comp, solution, 0) - v_k) - comp->props.scr.vgt;
+            }
+            return 1;
+        }
+
+        case COMP_TRIAC: {
+            // Terminals: G, MT1, MT2. Like the SCR in both directions.
+            double v_mt1 = event_voltage(comp, solution, 1);
+            if (comp->props.triac.on) {
+                double I = (event_voltage(comp, solution, 2) - v_mt1) / THYRISTOR_R_ON;
+                guards[0] = comp->props.triac.ih - fabs(I);
+            } else {
+                guards[0] = fabs(event_voltage(comp, solution, 0) - v_mt1) - comp->props.triac.vgt;
+            }
+            return 1;
+        }
+
+        case COMP_DIODE: {
+            // Ideal diode: conducts above the forward drop, blocks once
+            // the current through R_ON reverses
+            if (!comp->ideal_switch) return 0;
+            double vd = event_voltage(comp, solution, 0) - event_voltage(comp, solution, 1);
+            guards[0] = comp->switch_on ? IDEAL_DIODE_VF - vd : vd - IDEAL_DIODE_VF;
+            return 1;
+        }
+
+        case COMP_ANALOG_SWITCH: {
+            // Ideal analog switch: closes at v_on, opens at v_off
+            if (!comp->ideal_switch) return 0;
+            double v_ctl = event_voltage(comp, solution, 2);
+            guards[0] = comp->switch_on ? comp->props.analog_switch.v_off - v_ctl
+                                        : v_ctl - comp->props.analog_switch.v_on;
+            return 1;
+        }
+
+        case COMP_SCHMITT_INV:
+        case COMP_SCHMITT_BUF: {
+            // Input thresholds of the logic solver's hysteresis
+            const LogicLevels *levels = &comp->logic_state.levels;
+            if (levels->v_hyst <= 0.0) return 0;
+            double v = event_voltage(comp, solution, 0);
+            guards[0] = (comp->logic_state.inputs[0] == LOGIC_HIGH)
+                        ? (levels->v_ih - levels->v_hyst) - v
+                        : v - (levels->v_il + levels->v_hyst);
+            return 1;
+        }
+
+        default:
+            return 0;
+    }
+}
+
+bool component_event_commit(Component *comp, const Vector *solution, int num_nodes,
+                            double time, double elapsed) {
+    if (!comp || !solution) return false;
+
+    double guards[MAX_EVENT_GUARDS];
+    int count = component_event_guards(comp, solution, num_nodes, elapsed, guards);
+    bool fired = (count > 0 && guards[0] >= 0);
+
+    switch (comp->type) {
+        case COMP_RELAY:
+            comp->props.relay.i_coil = solution->data[num_nodes + comp->voltage_var_idx];
+            if (fired) comp->props.relay.energized = !comp->props.relay.energized;
+            return fired;
+
+        case COMP_FUSE: {
+            if (comp->props.fuse.blown) {
+                comp->props.fuse.current = 0.0;
+                return false;
+            }
+            double I_abs = fabs(fuse_current(comp, solution));
+            comp->props.fuse.current = I_abs;
+
+            if (!comp->props.fuse.ideal) {
+                if (I_abs > comp->props.fuse.rating) {
+                    // Accumulate i²t energy: integral of I² over time
+                    comp->props.fuse.i2t_accumulated += I_abs * I_abs * elapsed;
+                } else {
+                    // Below rating: slowly cool down (dissipate accumulated energy)
+                    // This simulates thermal recovery when overcurrent is removed
+                    double cooling_rate = 0.1; // 10% per second
+                    comp->props.fuse.i2t_accumulated *= (1.0 - cooling_rate * elapsed);
+                    if (comp->props.fuse.i2t_accumulated < 0.001) {
+                        comp->props.fuse.i2t_accumulated = 0.0;
+                    }
+                }
+            }
+            if (fired) {
+                comp->props.fuse.blown = true;
+                comp->props.fuse.blow_time = time;
+            }
+            return fired;
+        }
+
+        case COMP_555_TIMER: {
+            // Both comparators are checked; RESET wins when both are active
+            bool was_high = comp->props.timer_555.output;
+            double vcc, v_trig, v_thresh;
+            timer_555_inputs(comp, solution, &vcc, &v_trig, &v_thresh);
+            if (v_trig <= vcc / 3.0) comp->props.timer_555.output = true;
+            if (v_thresh >= 2.0 * vcc / 3.0) comp->props.timer_555.output = false;
+            return comp->props.timer_555.output != was_high;
+        }
+
+        case COMP_SCR:
+            if (fired) comp->props.scr.on = !comp->props.scr.on;
+            return fired;
+
+        case COMP_TRIAC:
+            if (fired) comp->props.triac.on = !comp->props.triac.on;
+            return fired;
+
+        case COMP_DIODE:
+        case COMP_ANALOG_SWITCH:
+            if (fired) comp->switch_on = !comp->switch_on;
+            return fired;
+
+        default:
+            // Schmitt triggers switch in the logic solver, which samples
+            // their input at the end of the step the event ends
+            return false;
+    }
+}
+
+// Counter of the random draw of a source at time: a new sample every
+// 1/rate seconds, or a new one at every distinct time point when rate <= 0.
+// Draws are a function of the time alone, so Newton iterations, rejected
+// and retried steps and repeated runs all see the same waveform.
+static uint64_t random_sample_index(double time, double rate) {
+    if (rate > 0) return (uint64_t)floor(MAX(time, 0.0) * rate);
+    uint64_t bits;
+    memcpy(&bits, &time, sizeof(bits));
+    return bits;
+}
+
+void component_stamp(Component *comp, SparseMatrix *A, Vector *b, int num_nodes,
+                     double time, Vector *prev_solution, Vector *history,
+                     const Integrator *integ, const SimContext *ctx) {
+    if (!comp || !A || !b || !integ || !ctx) return;
+
+    double dt = integ->dt;
+
+    // Node indices resolved by component_setup
+    const int *n = comp->matrix_nodes;
 
     switch (comp->type) {
         case COMP_GROUND: {
             // Ground forces node to 0V
             if (n[0] > 0) {
                 double g_large = 1e10;
-                matrix_add(A, n[0]-1, n[0]-1, g_large);
+                sparse_add(A, n[0]-1, n[0]-1, g_large);
             }
             break;
         }
@@ -2083,12 +2834,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             // Voltage source stamp
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2108,12 +2859,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2137,7 +2888,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // where alpha = temp_coeff / 1e6 (ppm to fraction), T_ref = 25°C
             if (!comp->props.resistor.ideal) {
                 double alpha = comp->props.resistor.temp_coeff / 1e6;  // ppm/°C to fraction
-                double dT = g_environment.temperature - 25.0;  // Delta from reference temp
+                double dT = ctx->environment.temperature - 25.0;  // Delta from reference temp
                 R = R_base * (1.0 + alpha * dT);
             }
 
@@ -2149,58 +2900,79 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
         case COMP_CAPACITOR:
         case COMP_CAPACITOR_ELEC: {
-            // Backward Euler companion model for capacitor:
-            // i_C = C * dv/dt ≈ C * (v - v_prev) / dt = Geq * v - Ieq
-            // where Geq = C/dt and Ieq = C * v_prev / dt
-            double C = (comp->type == COMP_CAPACITOR) ?
-                       comp->props.capacitor.capacitance :
-                       comp->props.capacitor_elec.capacitance;
-            double Geq = C / dt;
-            double Ieq = 0;
-
-            if (prev_solution) {
-                double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
-                double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
-                Ieq = C * (v1 - v2) / dt;
+            // Companion model for capacitor: i_C = C * dv/dt ≈ Geq * v + Ieq,
+            // with the history term Ieq from the integration method (for
+            // backward Euler Geq = C/dt and Ieq = -C * v_prev / dt)
+            bool cap = (comp->type == COMP_CAPACITOR);
+            double C = cap ? comp->props.capacitor.capacitance :
+                             comp->props.capacitor_elec.capacitance;
+            bool ideal = cap ? comp->props.capacitor.ideal :
+                               comp->props.capacitor_elec.ideal;
+
+            // Non-ideal: ESR in series (folded into the companion model)
+            // and leakage resistance in parallel
+            double esr = 0, G_leak = 0;
+            if (!ideal) {
+                esr = cap ? comp->props.capacitor.esr : comp->props.capacitor_elec.esr;
+                double R_leak = cap ? comp->props.capacitor.leakage :
+                                      comp->props.capacitor_elec.leakage;
+                if (R_leak > 0) G_leak = 1.0 / R_leak;
             }
 
-            STAMP_CONDUCTANCE(n[0], n[1], Geq);
-            // Ieq represents the capacitor's "memory" current
-            // Positive Ieq means capacitor was charged (n1 > n2), so it sources current at n1
-            if (n[0] > 0) vector_add(b, n[0]-1, Ieq);
-            if (n[1] > 0) vector_add(b, n[1]-1, -Ieq);
+            double Geq, Ieq;
+            reactive_companion(comp, 0, integ, C, esr, history, n[0] - 1, n[1] - 1,
+                               &Geq, &Ieq);
+
+            STAMP_CONDUCTANCE(n[0], n[1], Geq + G_leak);
+            // -Ieq represents the capacitor's "memory" current
+            // A capacitor charged to n1 > n2 sources current at n1
+            if (n[0] > 0) vector_add(b, n[0]-1, -Ieq);
+            if (n[1] > 0) vector_add(b, n[1]-1, Ieq);
             break;
         }
 
         case COMP_INDUCTOR: {
+            // Branch current i flows from n1 to n2; v = L * di/dt is
+            // approximated as Req * i + Veq by the integration method
             double L = comp->props.inductor.inductance;
-            double Req = L / dt;
-            double Veq = 0;
             int curr_idx = num_nodes + comp->voltage_var_idx;
 
-            if (prev_solution && curr_idx < prev_solution->size) {
-                double Iprev = vector_get(prev_solution, curr_idx);
-                Veq = L * Iprev / dt;
+            double Req, Veq;
+            reactive_companion(comp, 0, integ, L, 0, history, curr_idx, -1, &Req, &Veq);
+
+            // Non-ideal: winding resistance in series
+            if (!comp->props.inductor.ideal) {
+                Req += comp->props.inductor.dcr;
             }
 
             if (n[0] > 0) {
-                matrix_add(A, curr_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, curr_idx, 1);
+                sparse_add(A, curr_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, curr_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, curr_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, curr_idx, -1);
+                sparse_add(A, curr_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, curr_idx, -1);
             }
-            matrix_add(A, curr_idx, curr_idx, -Req);
+            sparse_add(A, curr_idx, curr_idx, -Req);
             vector_add(b, curr_idx, Veq);
             break;
         }
 
         case COMP_DIODE: {
+            if (comp->ideal_switch) {
+                // Piecewise linear: I = (Vd - Vf) / R_ON when on, R_OFF when off
+                double G = comp->switch_on ? 1.0 / IDEAL_DIODE_R_ON : 1.0 / IDEAL_SWITCH_R_OFF;
+                double Ieq = comp->switch_on ? -G * IDEAL_DIODE_VF : 0.0;
+                STAMP_CONDUCTANCE(n[0], n[1], G);
+                if (n[0] > 0) vector_add(b, n[0]-1, -Ieq);
+                if (n[1] > 0) vector_add(b, n[1]-1, Ieq);
+                break;
+            }
+
             double Is = comp->props.diode.is;
-            // Calculate thermal voltage from global environment temperature
+            // Calculate thermal voltage from the environment temperature
             // Vt = k*T/q where k/q = 8.617e-5 V/K
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nn = comp->props.diode.n;
             double nVt = nn * Vt;
 
@@ -2214,14 +2986,28 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 // Forward: limit to 40*nVt (~1V) to prevent overflow
                 // Reverse: allow up to -100V for proper blocking behavior
                 Vd = CLAMP(Vd_raw, -100.0, 40*nVt);
+                comp->limit.limited = false;
+                Vd = device_pnjlim(comp, 0, Vd, nVt, Is);
+                comp->limit.valid = true;
             }
 
-            double expTerm = exp(Vd / nVt);
-            double Id = Is * (expTerm - 1);
-            // Gd is conductance - add minimum conductance to prevent singularities
-            double Gd = (Is / nVt) * expTerm;
-            if (Gd < 1e-12) Gd = 1e-12;  // Minimum conductance for stability
-            double Ieq = Id - Gd * Vd;
+            double Gd, Ieq;
+            double params[] = { Is, nVt };
+            if (device_bypass_hit(comp, &Vd, 1, params, 2)) {
+                Gd = comp->bypass.g[0];
+                Ieq = comp->bypass.i[0];
+            } else {
+                double expTerm = exp(Vd / nVt);
+                double Id = Is * (expTerm - 1);
+                // Gd is conductance - add minimum conductance to prevent singularities
+                Gd = (Is / nVt) * expTerm;
+                if (Gd < 1e-12) Gd = 1e-12;  // Minimum conductance for stability
+                Ieq = Id - Gd * Vd;
+
+                comp->bypass.g[0] = Gd;
+                comp->bypass.i[0] = Ieq;
+                device_bypass_store(comp, &Vd, 1, params, 2);
+            }
 
             STAMP_CONDUCTANCE(n[0], n[1], Gd);
             if (n[0] > 0) vector_add(b, n[0]-1, -Ieq);
@@ -2232,8 +3018,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
         case COMP_ZENER: {
             // Zener diode - bidirectional conduction
             double Is = comp->props.zener.is;
-            // Calculate thermal voltage from global environment temperature
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            // Calculate thermal voltage from the environment temperature
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nn = comp->props.zener.n;
             double Vz = comp->props.zener.vz;
             double nVt = nn * Vt;
@@ -2243,6 +3029,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
                 double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
                 Vd = v1 - v2;
+                // Limit within the forward clamp applied below
+                comp->limit.limited = false;
+                Vd = device_pnjlim(comp, 0, MIN(Vd, 40*nVt), nVt, Is);
+                comp->limit.valid = true;
             }
 
             double Gd, Ieq;
@@ -2284,8 +3074,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 Is = comp->props.led.is;
                 nn = comp->props.led.n;
             }
-            // Calculate thermal voltage from global environment temperature
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            // Calculate thermal voltage from the environment temperature
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nVt = nn * Vt;
 
             double Vd = 0.6;
@@ -2293,16 +3083,27 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
                 double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
                 Vd = CLAMP(v1 - v2, -5*nVt, 40*nVt);
+                comp->limit.limited = false;
+                Vd = device_pnjlim(comp, 0, Vd, nVt, Is);
+                comp->limit.valid = true;
             }
 
-            double expTerm = exp(Vd / nVt);
-            double Id = Is * (expTerm - 1);
-            double Gd = (Is / nVt) * expTerm + 1e-12;
-            double Ieq = Id - Gd * Vd;
+            double Id, Gd, Ieq;
+            double params[] = { Is, nVt };
+            if (device_bypass_hit(comp, &Vd, 1, params, 2)) {
+                Gd = comp->bypass.g[0];
+                Ieq = comp->bypass.i[0];
+                Id = comp->bypass.i[1];
+            } else {
+                double expTerm = exp(Vd / nVt);
+                Id = Is * (expTerm - 1);
+                Gd = (Is / nVt) * expTerm + 1e-12;
+                Ieq = Id - Gd * Vd;
 
-            // Store LED current for glow rendering
-            if (comp->type == COMP_LED) {
-                comp->props.led.current = Id > 0 ? Id : 0;
+                comp->bypass.g[0] = Gd;
+                comp->bypass.i[0] = Ieq;
+                comp->bypass.i[1] = Id;
+                device_bypass_store(comp, &Vd, 1, params, 2);
             }
 
             STAMP_CONDUCTANCE(n[0], n[1], Gd);
@@ -2320,9 +3121,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double nf = comp->props.bjt.nf;      // Emission coefficient
             bool ideal = comp->props.bjt.ideal;
 
-            // Calculate thermal voltage from global environment temperature
+            // Calculate thermal voltage from the environment temperature
             // Vt = k*T/q where k/q = 8.617e-5 V/K, T must be in Kelvin
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
 
             // For PNP, invert voltage polarities
             double sign = (comp->type == COMP_PNP_BJT) ? -1.0 : 1.0;
@@ -2337,64 +3138,104 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 Vbc = sign * (vB - vC);
                 Vbe = CLAMP(Vbe, -5*nf*Vt, 40*nf*Vt);
                 Vbc = CLAMP(Vbc, -5*nf*Vt, 40*nf*Vt);
+                comp->limit.limited = false;
+                Vbe = device_pnjlim(comp, 0, Vbe, nf * Vt, Is);
+                Vbc = device_pnjlim(comp, 1, Vbc, nf * Vt, Is);
+                comp->limit.valid = true;
             }
 
-            double Gbe, Gbc, Gm, Ieq_be, Ieq_bc;
+            // Junction diodes and the transport current from collector to
+            // emitter, each linearized at (Vbe, Vbc): Ice is taken as
+            // Ieq_ce + Gm*Vbe + Gmu*Vbc
+            double Gbe, Gbc, Gm, Gmu, Ieq_be, Ieq_bc, Ieq_ce;
+            double vbjt[] = { Vbe, Vbc };
+            double params[] = {
+                Vt, bf, Is, Vaf, nf, ideal ? 1.0 : 0.0,
+                comp->props.bjt.br, comp->props.bjt.nr,
+                comp->props.bjt.ise, comp->props.bjt.isc
+            };
 
-            if (ideal) {
-                // Ideal Ebers-Moll model (simplified)
-                double expBE = exp(Vbe / (nf * Vt));
-                double Ibe = (Is / bf) * (expBE - 1);
-                Gbe = (Is / (bf * nf * Vt)) * expBE + 1e-12;
-                Ieq_be = Ibe - Gbe * Vbe;
-
-                // Collector current - forward active
-                double Ic = Is * (expBE - 1);
-                Gm = (Is / (nf * Vt)) * expBE;
-
-                // Simplified: ignore B-C junction for ideal mode
-                Gbc = 1e-12;
-                Ieq_bc = 0;
+            if (device_bypass_hit(comp, vbjt, 2, params, 10)) {
+                Gbe = comp->bypass.g[0];
+                Gbc = comp->bypass.g[1];
+                Gm = comp->bypass.g[2];
+                Gmu = comp->bypass.g[3];
+                Ieq_be = comp->bypass.i[0];
+                Ieq_bc = comp->bypass.i[1];
+                Ieq_ce = comp->bypass.i[2];
             } else {
-                // Non-ideal Gummel-Poon model with Early effect
-                double br = comp->props.bjt.br;
-                double nr = comp->props.bjt.nr;
-                double ise = comp->props.bjt.ise;
-                double isc = comp->props.bjt.isc;
-
-                // Forward B-E diode
-                double expBE = exp(Vbe / (nf * Vt));
-                double Ibe_main = (Is / bf) * (expBE - 1);
-                double Ibe_leak = ise * (exp(Vbe / (2 * nf * Vt)) - 1);  // Low-level injection
-                double Ibe = Ibe_main + Ibe_leak;
-                Gbe = (Is / (bf * nf * Vt)) * expBE + 1e-12;
-                Ieq_be = Ibe - Gbe * Vbe;
-
-                // Reverse B-C diode
-                double expBC = exp(Vbc / (nr * Vt));
-                double Ibc_main = (Is / br) * (expBC - 1);
-                double Ibc_leak = isc * (exp(Vbc / (2 * nr * Vt)) - 1);
-                double Ibc = Ibc_main + Ibc_leak;
-                Gbc = (Is / (br * nr * Vt)) * expBC + 1e-12;
-                Ieq_bc = Ibc - Gbc * Vbc;
-
-                // Collector current with Early effect
-                double early_factor = 1.0;
-                if (Vaf > 0) {
-                    double Vce = Vbe - Vbc;
-                    early_factor = 1.0 + Vce / Vaf;
+                double Ice;
+                if (ideal) {
+                    // Ideal Ebers-Moll model (simplified)
+                    double expBE = exp(Vbe / (nf * Vt));
+                    double Ibe = (Is / bf) * (expBE - 1);
+                    Gbe = (Is / (bf * nf * Vt)) * expBE + 1e-12;
+                    Ieq_be = Ibe - Gbe * Vbe;
+
+                    // Collector current - forward active
+                    Ice = Is * (expBE - 1);
+                    Gm = (Is / (nf * Vt)) * expBE;
+                    Gmu = 0;
+
+                    // Simplified: ignore B-C junction for ideal mode
+                    Gbc = 1e-12;
+                    Ieq_bc = 0;
+                } else {
+                    // Non-ideal Gummel-Poon model with Early effect
+                    double br = comp->props.bjt.br;
+                    double nr = comp->props.bjt.nr;
+                    double ise = comp->props.bjt.ise;
+                    double isc = comp->props.bjt.isc;
+
+                    // Forward B-E diode
+                    double expBE = exp(Vbe / (nf * Vt));
+                    double Ibe_main = (Is / bf) * (expBE - 1);
+                    double Ibe_leak = ise * (exp(Vbe / (2 * nf * Vt)) - 1);  // Low-level injection
+                    double Ibe = Ibe_main + Ibe_leak;
+                    Gbe = (Is / (bf * nf * Vt)) * expBE + 1e-12;
+                    Ieq_be = Ibe - Gbe * Vbe;
+
+                    // Reverse B-C diode
+                    double expBC = exp(Vbc / (nr * Vt));
+                    double Ibc_main = (Is / br) * (expBC - 1);
+                    double Ibc_leak = isc * (exp(Vbc / (2 * nr * Vt)) - 1);
+                    double Ibc = Ibc_main + Ibc_leak;
+                    Gbc = (Is / (br * nr * Vt)) * expBC + 1e-12;
+                    Ieq_bc = Ibc - Gbc * Vbc;
+
+                    // Collector current with Early effect
+                    double early_factor = 1.0;
+                    if (Vaf > 0) {
+                        double Vce = Vbe - Vbc;
+                        early_factor = 1.0 + Vce / Vaf;
+                    }
+                    double Ic_f = Is * (expBE - 1) * early_factor;
+                    double Ic_r = Is * (expBC - 1);
+                    Ice = Ic_f - Ic_r;
+
+                    // Vce = Vbe - Vbc, so the Early term depends on both
+                    double g_early = (Vaf > 0) ? Is * (expBE - 1) / Vaf : 0;
+                    Gm = (Is / (nf * Vt)) * expBE * early_factor + g_early;
+                    Gmu = -g_early - (Is / (nr * Vt)) * expBC;
                 }
-                double Ic_f = Is * (expBE - 1) * early_factor;
-                double Ic_r = Is * (expBC - 1);
-                Gm = (Is / (nf * Vt)) * expBE * early_factor;
+                Ieq_ce = Ice - Gm * Vbe - Gmu * Vbc;
+
+                // PNP: the currents change sign with the voltages, so the
+                // conductances in terms of node voltages keep theirs
+                Ieq_be *= sign;
+                Ieq_bc *= sign;
+                Ieq_ce *= sign;
+
+                comp->bypass.g[0] = Gbe;
+                comp->bypass.g[1] = Gbc;
+                comp->bypass.g[2] = Gm;
+                comp->bypass.g[3] = Gmu;
+                comp->bypass.i[0] = Ieq_be;
+                comp->bypass.i[1] = Ieq_bc;
+                comp->bypass.i[2] = Ieq_ce;
+                device_bypass_store(comp, vbjt, 2, params, 10);
             }
 
-            // Apply sign for PNP
-            Gbe *= 1;  // Conductance is always positive
-            Gm *= sign;
-            Ieq_be *= sign;
-            Ieq_bc *= sign;
-
             // Stamp B-E junction
             STAMP_CONDUCTANCE(n[0], n[2], Gbe);
             if (n[0] > 0) vector_add(b, n[0]-1, -Ieq_be);
@@ -2407,11 +3248,19 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 if (n[1] > 0) vector_add(b, n[1]-1, Ieq_bc);
             }
 
-            // Transconductance (collector current controlled by Vbe)
-            if (n[1] > 0 && n[0] > 0) matrix_add(A, n[1]-1, n[0]-1, Gm);
-            if (n[1] > 0 && n[2] > 0) matrix_add(A, n[1]-1, n[2]-1, -Gm);
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -Gm);
-            if (n[2] > 0 && n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, Gm);
+            // Transport current (collector to emitter, controlled by Vbe and Vbc)
+            if (n[1] > 0 && n[0] > 0) sparse_add(A, n[1]-1, n[0]-1, Gm);
+            if (n[1] > 0 && n[2] > 0) sparse_add(A, n[1]-1, n[2]-1, -Gm);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -Gm);
+            if (n[2] > 0 && n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, Gm);
+            if (!ideal) {
+                if (n[1] > 0 && n[0] > 0) sparse_add(A, n[1]-1, n[0]-1, Gmu);
+                if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, -Gmu);
+                if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -Gmu);
+                if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, Gmu);
+            }
+            if (n[1] > 0) vector_add(b, n[1]-1, -Ieq_ce);
+            if (n[2] > 0) vector_add(b, n[2]-1, Ieq_ce);
             break;
         }
 
@@ -2425,26 +3274,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double L = comp->props.mosfet.l;
             bool ideal = comp->props.mosfet.ideal;
 
-            // Temperature effects (non-ideal mode)
-            // Reference temperature is 25°C (298.15K)
-            if (!ideal) {
-                double T = g_environment.temperature + 273.15;  // Current temp in Kelvin
-                double T0 = 298.15;  // Reference temp (25°C) in Kelvin
-                double dT_C = g_environment.temperature - 25.0;  // Delta in Celsius
-
-                // Vth decreases ~2mV/°C (typical for silicon MOSFETs)
-                Vth = Vth - 0.002 * dT_C;
-
-                // Mobility decreases with temperature: Kp(T) = Kp(T0) * (T0/T)^1.5
-                Kp = Kp * pow(T0 / T, 1.5);
-            }
-
-            // Effective transconductance: K = Kp * W / L
-            double K = Kp * (W / L);
-
             // For PMOS, work with absolute values and invert at end
             double sign = (comp->type == COMP_PMOS) ? -1.0 : 1.0;
-            double Vth_eff = fabs(Vth);
 
             double Vgs = 0, Vds = 0, Vsb = 0;
             if (prev_solution) {
@@ -2462,61 +3293,104 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                     Vds = vD - vS;
                     Vsb = 0;
                 }
-            }
 
-            // Body effect (non-ideal mode only)
-            double Vth_adj = Vth_eff;
-            if (!ideal && Vsb > 0) {
-                double gamma = comp->props.mosfet.gamma;
-                double phi = comp->props.mosfet.phi;
-                Vth_adj = Vth_eff + gamma * (sqrt(phi + Vsb) - sqrt(phi));
+                comp->limit.limited = false;
+                Vgs = device_fetlim(comp, 0, Vgs, fabs(Vth));
+                Vds = device_limvds(comp, 1, Vds);
+                comp->limit.valid = true;
             }
 
-            double Gds = 1e-12;  // Minimum conductance
-            double Gm = 0;
-            double Id = 0;
-            double Ieq = 0;
+            double Gds, Gm, Ieq, Vov;
+            double vmos[] = { Vgs, Vds };
+            double params[] = {
+                ctx->environment.temperature, Vth, Kp, lambda, W, L, ideal ? 1.0 : 0.0,
+                comp->props.mosfet.gamma, comp->props.mosfet.phi
+            };
 
-            double Vov = Vgs - Vth_adj;  // Overdrive voltage
+            if (device_bypass_hit(comp, vmos, 2, params, 9)) {
+                Gds = comp->bypass.g[0];
+                Gm = comp->bypass.g[1];
+                Ieq = comp->bypass.i[0];
+                Vov = comp->bypass.i[1];
+            } else {
+                // Temperature effects (non-ideal mode)
+                // Reference temperature is 25°C (298.15K)
+                if (!ideal) {
+                    double T = ctx->environment.temperature + 273.15;  // Current temp in Kelvin
+                    double T0 = 298.15;  // Reference temp (25°C) in Kelvin
+                    double dT_C = ctx->environment.temperature - 25.0;  // Delta in Celsius
 
-            if (Vov <= 0) {
-                // Cutoff region
-                Gds = 1e-12;
+                    // Vth decreases ~2mV/°C (typical for silicon MOSFETs)
+                    Vth = Vth - 0.002 * dT_C;
+
+                    // Mobility decreases with temperature: Kp(T) = Kp(T0) * (T0/T)^1.5
+                    Kp = Kp * pow(T0 / T, 1.5);
+                }
+
+                // Effective transconductance: K = Kp * W / L
+                double K = Kp * (W / L);
+                double Vth_eff = fabs(Vth);
+
+                // Body effect (non-ideal mode only)
+                double Vth_adj = Vth_eff;
+                if (!ideal && Vsb > 0) {
+                    double gamma = comp->props.mosfet.gamma;
+                    double phi = comp->props.mosfet.phi;
+                    Vth_adj = Vth_eff + gamma * (sqrt(phi + Vsb) - sqrt(phi));
+                }
+
+                Gds = 1e-12;  // Minimum conductance
                 Gm = 0;
-                Id = 0;
-            } else if (Vds < Vov) {
-                // Triode (linear) region
-                // Id = K * (Vov * Vds - Vds²/2) * (1 + lambda * Vds)
-                double lambda_term = ideal ? 1.0 : (1.0 + lambda * Vds);
-                Id = K * (Vov * Vds - 0.5 * Vds * Vds) * lambda_term;
-
-                // Derivatives for Newton-Raphson linearization
-                Gm = K * Vds * lambda_term;  // dId/dVgs
-                Gds = K * (Vov - Vds) * lambda_term;  // dId/dVds
-                if (!ideal) {
-                    Gds += K * (Vov * Vds - 0.5 * Vds * Vds) * lambda;
+                double Id = 0;
+
+                Vov = Vgs - Vth_adj;  // Overdrive voltage
+
+                if (Vov <= 0) {
+                    // Cutoff region
+                    Gds = 1e-12;
+                    Gm = 0;
+                    Id = 0;
+                } else if (Vds < Vov) {
+                    // Triode (linear) region
+                    // Id = K * (Vov * Vds - Vds²/2) * (1 + lambda * Vds)
+                    double lambda_term = ideal ? 1.0 : (1.0 + lambda * Vds);
+                    Id = K * (Vov * Vds - 0.5 * Vds * Vds) * lambda_term;
+
+                    // Derivatives for Newton-Raphson linearization
+                    Gm = K * Vds * lambda_term;  // dId/dVgs
+                    Gds = K * (Vov - Vds) * lambda_term;  // dId/dVds
+                    if (!ideal) {
+                        Gds += K * (Vov * Vds - 0.5 * Vds * Vds) * lambda;
+                    }
+                } else {
+                    // Saturation region
+                    // Id = (K/2) * Vov² * (1 + lambda * Vds)
+                    double lambda_term = ideal ? 1.0 : (1.0 + lambda * Vds);
+                    Id = 0.5 * K * Vov * Vov * lambda_term;
+
+                    // Derivatives
+                    Gm = K * Vov * lambda_term;  // dId/dVgs
+                    Gds = ideal ? 1e-12 : (0.5 * K * Vov * Vov * lambda);  // dId/dVds (channel length modulation)
                 }
-            } else {
-                // Saturation region
-                // Id = (K/2) * Vov² * (1 + lambda * Vds)
-                double lambda_term = ideal ? 1.0 : (1.0 + lambda * Vds);
-                Id = 0.5 * K * Vov * Vov * lambda_term;
 
-                // Derivatives
-                Gm = K * Vov * lambda_term;  // dId/dVgs
-                Gds = ideal ? 1e-12 : (0.5 * K * Vov * Vov * lambda);  // dId/dVds (channel length modulation)
-            }
+                // Ensure minimum conductance
+                Gds = MAX(Gds, 1e-12);
+                Gm = MAX(Gm, 0);
 
-            // Ensure minimum conductance
-            Gds = MAX(Gds, 1e-12);
-            Gm = MAX(Gm, 0);
+                // Equivalent current source: Ieq = Id - Gm*Vgs - Gds*Vds
+                Ieq = Id - Gm * Vgs - Gds * Vds;
 
-            // Equivalent current source: Ieq = Id - Gm*Vgs - Gds*Vds
-            Ieq = Id - Gm * Vgs - Gds * Vds;
+                // Apply sign for PMOS: the current flows the opposite way,
+                // and since Vsg and Vsd flip with it the conductances in
+                // terms of node voltages keep their sign
+                Ieq *= sign;
 
-            // Apply sign for PMOS (currents flow opposite direction)
-            Gm *= sign;
-            Ieq *= sign;
+                comp->bypass.g[0] = Gds;
+                comp->bypass.g[1] = Gm;
+                comp->bypass.i[0] = Ieq;
+                comp->bypass.i[1] = Vov;
+                device_bypass_store(comp, vmos, 2, params, 9);
+            }
 
             // Stamp D-S conductance
             STAMP_CONDUCTANCE(n[1], n[2], Gds);
@@ -2526,10 +3400,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             if (n[2] > 0) vector_add(b, n[2]-1, Ieq);
 
             // Transconductance (drain current controlled by Vgs)
-            if (n[1] > 0 && n[0] > 0) matrix_add(A, n[1]-1, n[0]-1, Gm);
-            if (n[1] > 0 && n[2] > 0) matrix_add(A, n[1]-1, n[2]-1, -Gm);
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -Gm);
-            if (n[2] > 0 && n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, Gm);
+            if (n[1] > 0 && n[0] > 0) sparse_add(A, n[1]-1, n[0]-1, Gm);
+            if (n[1] > 0 && n[2] > 0) sparse_add(A, n[1]-1, n[2]-1, -Gm);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -Gm);
+            if (n[2] > 0 && n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, Gm);
 
             // Gate capacitance model (non-ideal mode only)
             if (!ideal && dt > 0) {
@@ -2562,21 +3436,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                     Cgd = cgdo * W;  // Only overlap in saturation
                 }
 
-                // Get current voltages for capacitor integration
-                double vG = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
-                double vD = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
-                double vS = (n[2] > 0) ? vector_get(prev_solution, n[2]-1) : 0;
-
-                double Vgs_curr = vG - vS;
-                double Vgd_curr = vG - vD;
-
-                // Trapezoidal integration: G_eq = 2*C/dt, I_eq = G_eq*V_prev + I_prev
-                double G_cgs = 2.0 * Cgs / dt;
-                double G_cgd = 2.0 * Cgd / dt;
-
-                // Equivalent currents from previous timestep
-                double I_cgs_eq = G_cgs * comp->props.mosfet.vgs_prev + comp->props.mosfet.i_cgs;
-                double I_cgd_eq = G_cgd * comp->props.mosfet.vgd_prev + comp->props.mosfet.i_cgd;
+                // Companion models of the gate capacitances (Vgs, Vgd)
+                double G_cgs, I_cgs_eq, G_cgd, I_cgd_eq;
+                reactive_companion(comp, 0, integ, Cgs, 0, history, n[0] - 1, n[2] - 1,
+                                   &G_cgs, &I_cgs_eq);
+                reactive_companion(comp, 1, integ, Cgd, 0, history, n[0] - 1, n[1] - 1,
+                                   &G_cgd, &I_cgd_eq);
 
                 // Stamp Cgs (between gate n[0] and source n[2])
                 STAMP_CONDUCTANCE(n[0], n[2], G_cgs);
@@ -2587,12 +3452,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 STAMP_CONDUCTANCE(n[0], n[1], G_cgd);
                 if (n[0] > 0) vector_add(b, n[0]-1, -I_cgd_eq);
                 if (n[1] > 0) vector_add(b, n[1]-1, I_cgd_eq);
-
-                // Update state for next iteration
-                comp->props.mosfet.i_cgs = G_cgs * Vgs_curr - I_cgs_eq;
-                comp->props.mosfet.i_cgd = G_cgd * Vgd_curr - I_cgd_eq;
-                comp->props.mosfet.vgs_prev = Vgs_curr;
-                comp->props.mosfet.vgd_prev = Vgd_curr;
+            } else {
+                comp->reactive.count = 0;
             }
             break;
         }
@@ -2604,11 +3465,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // VCVS model: Vout = A * (V+ - V-)
             // For COMP_OPAMP: n[0]="-", n[1]="+", n[2]="OUT"
             if (n[2] > 0) {
-                matrix_add(A, volt_idx, n[2]-1, 1);
-                matrix_add(A, n[2]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[2]-1, 1);
+                sparse_add(A, n[2]-1, volt_idx, 1);
             }
-            if (n[1] > 0) matrix_add(A, volt_idx, n[1]-1, -A_gain);
-            if (n[0] > 0) matrix_add(A, volt_idx, n[0]-1, A_gain);
+            if (n[1] > 0) sparse_add(A, volt_idx, n[1]-1, -A_gain);
+            if (n[0] > 0) sparse_add(A, volt_idx, n[0]-1, A_gain);
             break;
         }
 
@@ -2619,11 +3480,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // VCVS model: Vout = A * (V+ - V-)
             // For COMP_OPAMP_FLIPPED: n[0]="+", n[1]="-", n[2]="OUT"
             if (n[2] > 0) {
-                matrix_add(A, volt_idx, n[2]-1, 1);
-                matrix_add(A, n[2]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[2]-1, 1);
+                sparse_add(A, n[2]-1, volt_idx, 1);
             }
-            if (n[0] > 0) matrix_add(A, volt_idx, n[0]-1, -A_gain);  // + input
-            if (n[1] > 0) matrix_add(A, volt_idx, n[1]-1, A_gain);   // - input
+            if (n[0] > 0) sparse_add(A, volt_idx, n[0]-1, -A_gain);  // + input
+            if (n[1] > 0) sparse_add(A, volt_idx, n[1]-1, A_gain);   // - input
             break;
         }
 
@@ -2648,12 +3509,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2684,12 +3545,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2715,12 +3576,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2730,19 +3591,20 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double amp = comp->props.noise_source.amplitude;
             // Apply amplitude sweep if enabled
             amp = sweep_get_value(&comp->props.noise_source.amplitude_sweep, amp, time);
-            // Simple pseudo-random noise using time-based seed
-            // Uses a combination of sine functions at irrational ratios for pseudo-randomness
-            double V = amp * (sin(time * 12345.6789) + sin(time * 9876.5432 + 1.234) +
-                             sin(time * 5678.1234 + 2.345)) / 3.0;
+            // Gaussian white noise of RMS amp, band-limited by holding
+            // each sample for 1 / (2 * bandwidth) (Nyquist rate)
+            uint64_t k = random_sample_index(time, 2.0 * comp->props.noise_source.bandwidth);
+            double V = amp * rng_gaussian((uint64_t)comp->props.noise_source.seed,
+                                          RNG_STREAM(RNG_DOMAIN_SOURCE, comp->id), k);
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -2813,10 +3675,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 STAMP_CONDUCTANCE(n[2], n[3], G_src);
 
                 // Add VCCS terms: secondary voltage follows primary voltage
-                if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -G_src * N);
-                if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, G_src * N);
-                if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, G_src * N);
-                if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, -G_src * N);
+                if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -G_src * N);
+                if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, G_src * N);
+                if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, G_src * N);
+                if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, -G_src * N);
             } else {
                 // Non-ideal transformer with winding resistances
                 double R_p = comp->props.transformer.r_primary;
@@ -2834,10 +3696,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 STAMP_CONDUCTANCE(n[2], n[3], G_src);
 
                 // VCCS terms for voltage coupling
-                if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -G_src * N);
-                if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, G_src * N);
-                if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, G_src * N);
-                if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, -G_src * N);
+                if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -G_src * N);
+                if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, G_src * N);
+                if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, G_src * N);
+                if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, -G_src * N);
             }
             break;
         }
@@ -2871,18 +3733,18 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Expanding: I = G_src * V_s1 - G_src * V_ct - G_src * N_half * V_p1 + G_src * N_half * V_p2
             STAMP_CONDUCTANCE(n[2], n[3], G_src);
             // Add VCCS terms to make secondary follow primary
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -G_src * N_half);
-            if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, G_src * N_half);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, G_src * N_half);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, -G_src * N_half);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -G_src * N_half);
+            if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, G_src * N_half);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, G_src * N_half);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, -G_src * N_half);
 
             // Lower secondary (CT-S2): VCVS with series resistance
             // V_ct_s2 = N_half * V_primary
             STAMP_CONDUCTANCE(n[3], n[4], G_src);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, -G_src * N_half);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, G_src * N_half);
-            if (n[4] > 0 && n[0] > 0) matrix_add(A, n[4]-1, n[0]-1, G_src * N_half);
-            if (n[4] > 0 && n[1] > 0) matrix_add(A, n[4]-1, n[1]-1, -G_src * N_half);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, -G_src * N_half);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, G_src * N_half);
+            if (n[4] > 0 && n[0] > 0) sparse_add(A, n[4]-1, n[0]-1, G_src * N_half);
+            if (n[4] > 0 && n[1] > 0) sparse_add(A, n[4]-1, n[1]-1, -G_src * N_half);
 
             break;
         }
@@ -2909,10 +3771,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
         case COMP_PHOTORESISTOR: {
             // Photoresistor: resistance varies with light level
-            // Use global environment light level for all LDRs
+            // Use the environment light level for all LDRs
             double R_dark = comp->props.photoresistor.r_dark;
             double R_light = comp->props.photoresistor.r_light;
-            double light = g_environment.light_level;  // Use global light level
+            double light = ctx->environment.light_level;  // Use the environment light level
             double gamma = comp->props.photoresistor.gamma;
 
             // Logarithmic response to light
@@ -2924,10 +3786,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
         case COMP_THERMISTOR: {
             // Thermistor: resistance varies with temperature
-            // Use global environment temperature for all thermistors
+            // Use the environment temperature for all thermistors
             double R_25 = comp->props.thermistor.r_25;
             double beta = comp->props.thermistor.beta;
-            double T = g_environment.temperature + 273.15;  // Use global temperature, convert to Kelvin
+            double T = ctx->environment.temperature + 273.15;  // Environment temperature in Kelvin
             double T_25 = 298.15;  // 25°C in Kelvin
 
             double R;
@@ -2951,57 +3813,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
         }
 
         case COMP_FUSE: {
-            // Fuse with i²t protection model
-            // When not blown: accumulate i²t energy, blow when it exceeds rating
-            // When blown: very high resistance (open circuit)
-
-            if (!comp->props.fuse.blown) {
-                // Calculate current from previous solution voltages
-                double V1 = (n[0] > 0 && prev_solution) ? vector_get(prev_solution, n[0]-1) : 0.0;
-                double V2 = (n[1] > 0 && prev_solution) ? vector_get(prev_solution, n[1]-1) : 0.0;
-                double Vdiff = V1 - V2;
-                double R = comp->props.fuse.resistance;
-                double I = Vdiff / R;
-                double I_abs = fabs(I);
-
-                // Store current for display/animation
-                comp->props.fuse.current = I_abs;
-
-                if (comp->props.fuse.ideal) {
-                    // Ideal mode: instant blow when current exceeds rating
-                    if (I_abs > comp->props.fuse.rating) {
-                        comp->props.fuse.blown = true;
-                        comp->props.fuse.blow_time = time;
-                    }
-                } else {
-                    // Realistic mode: i²t accumulation
-                    // Only accumulate when current exceeds rating (pre-arcing region)
-                    if (I_abs > comp->props.fuse.rating) {
-                        // Accumulate i²t energy: integral of I² over time
-                        double i2t_increment = I_abs * I_abs * dt;
-                        comp->props.fuse.i2t_accumulated += i2t_increment;
-
-                        // Check if accumulated energy exceeds i²t rating
-                        if (comp->props.fuse.i2t_accumulated >= comp->props.fuse.i2t) {
-                            comp->props.fuse.blown = true;
-                            comp->props.fuse.blow_time = time;
-                        }
-                    } else {
-                        // Below rating: slowly cool down (dissipate accumulated energy)
-                        // This simulates thermal recovery when overcurrent is removed
-                        double cooling_rate = 0.1; // 10% per second
-                        comp->props.fuse.i2t_accumulated *= (1.0 - cooling_rate * dt);
-                        if (comp->props.fuse.i2t_accumulated < 0.001) {
-                            comp->props.fuse.i2t_accumulated = 0.0;
-                        }
-                    }
-                }
-            } else {
-                // Blown fuse: no current
-                comp->props.fuse.current = 0.0;
-            }
-
-            // Stamp conductance: low when intact, very high resistance when blown
+            // Fuse with i²t protection model. Whether it has blown is
+            // decided on accepted solutions (component_event_commit); when
+            // blown it is a very high resistance (open circuit).
             double R = comp->props.fuse.blown ? 1e9 : comp->props.fuse.resistance;
             double G = 1.0 / R;
             STAMP_CONDUCTANCE(n[0], n[1], G);
@@ -3042,12 +3856,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3061,12 +3875,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3092,10 +3906,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             } else {
                 // Simple linear discharge curve
                 V_oc = V_nom * (0.85 + 0.15 * SoC);
-                if (V_oc < V_cutoff) {
-                    comp->props.battery.discharged = true;
-                    V_oc = V_cutoff * 0.8;
-                }
+                if (V_oc < V_cutoff) V_oc = V_cutoff * 0.8;
             }
 
             int volt_idx = num_nodes + comp->voltage_var_idx;
@@ -3103,12 +3914,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             if (ideal) {
                 // Ideal voltage source (no internal resistance)
                 if (n[0] > 0) {
-                    matrix_add(A, volt_idx, n[0]-1, 1);
-                    matrix_add(A, n[0]-1, volt_idx, 1);
+                    sparse_add(A, volt_idx, n[0]-1, 1);
+                    sparse_add(A, n[0]-1, volt_idx, 1);
                 }
                 if (n[1] > 0) {
-                    matrix_add(A, volt_idx, n[1]-1, -1);
-                    matrix_add(A, n[1]-1, volt_idx, -1);
+                    sparse_add(A, volt_idx, n[1]-1, -1);
+                    sparse_add(A, n[1]-1, volt_idx, -1);
                 }
                 vector_add(b, volt_idx, V_oc);
             } else {
@@ -3118,42 +3929,19 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 // Using voltage source equation: V(n+) - V(n-) - I*R = V_oc
                 // Rearranged: V(n+) - V(n-) + I*R_int = V_oc
                 if (n[0] > 0) {
-                    matrix_add(A, volt_idx, n[0]-1, 1);
-                    matrix_add(A, n[0]-1, volt_idx, 1);
+                    sparse_add(A, volt_idx, n[0]-1, 1);
+                    sparse_add(A, n[0]-1, volt_idx, 1);
                 }
                 if (n[1] > 0) {
-                    matrix_add(A, volt_idx, n[1]-1, -1);
-                    matrix_add(A, n[1]-1, volt_idx, -1);
+                    sparse_add(A, volt_idx, n[1]-1, -1);
+                    sparse_add(A, n[1]-1, volt_idx, -1);
                 }
                 // Add internal resistance term to voltage equation
                 // Current flows from + to -, so I_source is in the positive direction
-                matrix_add(A, volt_idx, volt_idx, R_int);
+                sparse_add(A, volt_idx, volt_idx, R_int);
                 vector_add(b, volt_idx, V_oc);
             }
-
-            // Track discharge over time
-            // dQ = I * dt, where Q is charge in coulombs
-            if (!ideal && !discharged && prev_solution && dt > 0) {
-                // Get current from voltage source variable
-                double I_battery = vector_get(prev_solution, volt_idx);
-                comp->props.battery.current_draw = fabs(I_battery);
-
-                // Discharge: reduce charge_coulombs
-                double dQ = fabs(I_battery) * dt;
-                comp->props.battery.charge_coulombs -= dQ;
-
-                if (comp->props.battery.charge_coulombs < 0) {
-                    comp->props.battery.charge_coulombs = 0;
-                }
-
-                // Update SoC (charge_coulombs / initial_charge)
-                double initial_charge = comp->props.battery.capacity_mah * 3.6;  // mAh to C
-                comp->props.battery.charge_state = comp->props.battery.charge_coulombs / initial_charge;
-
-                if (comp->props.battery.charge_state < 0.01) {
-                    comp->props.battery.discharged = true;
-                }
-            }
+            // Discharge is tracked by component_accept_step
             break;
         }
 
@@ -3174,12 +3962,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3197,12 +3985,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3251,12 +4039,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             int volt_idx = num_nodes + comp->voltage_var_idx;
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3273,18 +4061,23 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double amp = 1.0, freq = 60.0, offset = 0.0;
             double noise_amp = 0.0;
 
-            // Try to parse sine wave pattern: "A*sin(2*pi*F*t)"
-            if (sscanf(expr, "%lf*sin(2*pi*%lf*t)", &amp, &freq) == 2) {
+            // Patterns from the longest: sscanf stops at the end of its
+            // format, so a shorter pattern would match the start of a longer
+            // expression and drop its tail
+            // Try pattern with noise: "A*sin(2*pi*F*t)+N*rand()"
+            if (sscanf(expr, "%lf*sin(2*pi*%lf*t)+%lf*rand()", &amp, &freq, &noise_amp) == 3) {
+                double u = rng_uniform(0, RNG_STREAM(RNG_DOMAIN_SOURCE, comp->id),
+                                       random_sample_index(time, 0));
                 V = amp * sin(2.0 * M_PI * freq * time);
+                V += noise_amp * (2.0 * u - 1.0);
             }
             // Try pattern with offset: "A*sin(2*pi*F*t)+C"
             else if (sscanf(expr, "%lf*sin(2*pi*%lf*t)+%lf", &amp, &freq, &offset) == 3) {
                 V = amp * sin(2.0 * M_PI * freq * time) + offset;
             }
-            // Try pattern with noise: "A*sin(2*pi*F*t)+N*rand()"
-            else if (sscanf(expr, "%lf*sin(2*pi*%lf*t)+%lf*rand()", &amp, &freq, &noise_amp) == 3) {
+            // Try to parse sine wave pattern: "A*sin(2*pi*F*t)"
+            else if (sscanf(expr, "%lf*sin(2*pi*%lf*t)", &amp, &freq) == 2) {
                 V = amp * sin(2.0 * M_PI * freq * time);
-                V += noise_amp * ((double)rand() / RAND_MAX * 2.0 - 1.0);
             }
             // Simple constant
             else if (sscanf(expr, "%lf", &V) != 1) {
@@ -3293,12 +4086,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             int volt_idx = num_nodes + comp->voltage_var_idx;
             if (n[0] > 0) {
-                matrix_add(A, volt_idx, n[0]-1, 1);
-                matrix_add(A, n[0]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, volt_idx, 1);
             }
             if (n[1] > 0) {
-                matrix_add(A, volt_idx, n[1]-1, -1);
-                matrix_add(A, n[1]-1, volt_idx, -1);
+                sparse_add(A, volt_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, volt_idx, -1);
             }
             vector_add(b, volt_idx, V);
             break;
@@ -3320,6 +4113,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
                 double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
                 Vd = CLAMP(v1 - v2, -5*nVt, 40*nVt);
+                comp->limit.limited = false;
+                Vd = device_pnjlim(comp, 0, Vd, nVt, Is);
+                comp->limit.valid = true;
             }
 
             double expTerm = exp(Vd / nVt);
@@ -3327,6 +4123,25 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double Gd = (Is / nVt) * expTerm + 1e-12;
             double Ieq = Id - Gd * Vd;
 
+            // Varactor: voltage-dependent junction capacitance
+            // Cj = CJO / (1 - Vd/VJ)^M, linearly extended above FC*VJ
+            if (comp->type == COMP_VARACTOR) {
+                const double vj = 0.7, mj = 0.5, fc = 0.5;
+                double cjo = comp->props.diode.cjo;
+                double Cj;
+                if (Vd < fc * vj) {
+                    Cj = cjo / pow(1.0 - Vd / vj, mj);
+                } else {
+                    Cj = cjo / pow(1.0 - fc, 1.0 + mj) * (1.0 - fc * (1.0 + mj) + mj * Vd / vj);
+                }
+
+                double Gc, Ic;
+                reactive_companion(comp, 0, integ, Cj, 0, history, n[0] - 1, n[1] - 1,
+                                   &Gc, &Ic);
+                Gd += Gc;
+                Ieq += Ic;
+            }
+
             STAMP_CONDUCTANCE(n[0], n[1], Gd);
             if (n[0] > 0) vector_add(b, n[0]-1, -Ieq);
             if (n[1] > 0) vector_add(b, n[1]-1, Ieq);
@@ -3366,10 +4181,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             if (n[0] > 0) vector_add(b, n[0]-1, -Ieq_be);
             if (n[2] > 0) vector_add(b, n[2]-1, Ieq_be);
 
-            if (n[1] > 0 && n[0] > 0) matrix_add(A, n[1]-1, n[0]-1, Gm);
-            if (n[1] > 0 && n[2] > 0) matrix_add(A, n[1]-1, n[2]-1, -Gm);
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -Gm);
-            if (n[2] > 0 && n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, Gm);
+            if (n[1] > 0 && n[0] > 0) sparse_add(A, n[1]-1, n[0]-1, Gm);
+            if (n[1] > 0 && n[2] > 0) sparse_add(A, n[1]-1, n[2]-1, -Gm);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -Gm);
+            if (n[2] > 0 && n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, Gm);
             break;
         }
 
@@ -3430,18 +4245,19 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             if (n[1] > 0) vector_add(b, n[1]-1, -Ieq);
             if (n[2] > 0) vector_add(b, n[2]-1, Ieq);
 
-            if (n[1] > 0 && n[0] > 0) matrix_add(A, n[1]-1, n[0]-1, Gm);
-            if (n[1] > 0 && n[2] > 0) matrix_add(A, n[1]-1, n[2]-1, -Gm);
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -Gm);
-            if (n[2] > 0 && n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, Gm);
+            if (n[1] > 0 && n[0] > 0) sparse_add(A, n[1]-1, n[0]-1, Gm);
+            if (n[1] > 0 && n[2] > 0) sparse_add(A, n[1]-1, n[2]-1, -Gm);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -Gm);
+            if (n[2] > 0 && n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, Gm);
             break;
         }
 
         // === THYRISTORS ===
 
         case COMP_SCR: {
-            // SCR: acts as diode when triggered, open circuit otherwise
-            double R = comp->props.scr.on ? 0.1 : 1e9;  // Low/high resistance
+            // SCR: conducts when triggered, open circuit otherwise (latched
+            // by component_event_commit)
+            double R = comp->props.scr.on ? THYRISTOR_R_ON : 1e9;  // Low/high resistance
             double G = 1.0 / R;
             STAMP_CONDUCTANCE(n[1], n[2], G);  // Anode to Kathode
             break;
@@ -3465,7 +4281,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
         case COMP_TRIAC: {
             // TRIAC: bidirectional SCR
-            double R = comp->props.triac.on ? 0.1 : 1e9;
+            double R = comp->props.triac.on ? THYRISTOR_R_ON : 1e9;
             double G = 1.0 / R;
             STAMP_CONDUCTANCE(n[1], n[2], G);  // MT1 to MT2
             break;
@@ -3509,32 +4325,32 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             if (saturated_high) {
                 // Positive saturation: output clamped to v_max
                 if (n[2] > 0) {
-                    matrix_add(A, volt_idx, n[2]-1, 1.0);
-                    matrix_add(A, n[2]-1, volt_idx, 1.0);
+                    sparse_add(A, volt_idx, n[2]-1, 1.0);
+                    sparse_add(A, n[2]-1, volt_idx, 1.0);
                 }
                 vector_add(b, volt_idx, v_max);
             } else if (saturated_low) {
                 // Negative saturation: output clamped to v_min
                 if (n[2] > 0) {
-                    matrix_add(A, volt_idx, n[2]-1, 1.0);
-                    matrix_add(A, n[2]-1, volt_idx, 1.0);
+                    sparse_add(A, volt_idx, n[2]-1, 1.0);
+                    sparse_add(A, n[2]-1, volt_idx, 1.0);
                 }
                 vector_add(b, volt_idx, v_min);
             } else {
                 // Linear region: V_out = A * (V+ - V-)
                 if (n[2] > 0) {
-                    matrix_add(A, volt_idx, n[2]-1, 1.0);
-                    matrix_add(A, n[2]-1, volt_idx, 1.0);
+                    sparse_add(A, volt_idx, n[2]-1, 1.0);
+                    sparse_add(A, n[2]-1, volt_idx, 1.0);
                 }
                 // n[0] is inverting (-), n[1] is non-inverting (+)
-                if (n[1] > 0) matrix_add(A, volt_idx, n[1]-1, -A_gain);
-                if (n[0] > 0) matrix_add(A, volt_idx, n[0]-1, A_gain);
+                if (n[1] > 0) sparse_add(A, volt_idx, n[1]-1, -A_gain);
+                if (n[0] > 0) sparse_add(A, volt_idx, n[0]-1, A_gain);
             }
 
             // Output resistance
             double G_out = 1.0 / r_out;
             if (n[2] > 0) {
-                matrix_add(A, n[2]-1, n[2]-1, G_out);
+                sparse_add(A, n[2]-1, n[2]-1, G_out);
             }
             break;
         }
@@ -3545,11 +4361,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int volt_idx = num_nodes + comp->voltage_var_idx;
 
             if (n[2] > 0) {
-                matrix_add(A, volt_idx, n[2]-1, 1);
-                matrix_add(A, n[2]-1, volt_idx, 1);
+                sparse_add(A, volt_idx, n[2]-1, 1);
+                sparse_add(A, n[2]-1, volt_idx, 1);
             }
-            if (n[1] > 0) matrix_add(A, volt_idx, n[1]-1, -gm);
-            if (n[0] > 0) matrix_add(A, volt_idx, n[0]-1, gm);
+            if (n[1] > 0) sparse_add(A, volt_idx, n[1]-1, -gm);
+            if (n[0] > 0) sparse_add(A, volt_idx, n[0]-1, gm);
             break;
         }
 
@@ -3575,10 +4391,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             // Output (n[2], n[3]) follows control voltage times gain
             STAMP_CONDUCTANCE(n[2], n[3], G_src);
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -G_src * gain);
-            if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, G_src * gain);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, G_src * gain);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, -G_src * gain);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -G_src * gain);
+            if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, G_src * gain);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, G_src * gain);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, -G_src * gain);
             break;
         }
 
@@ -3591,10 +4407,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             STAMP_CONDUCTANCE(n[0], n[1], G_in);
 
             // Output current proportional to control voltage
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, gm);
-            if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, -gm);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, -gm);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, gm);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, gm);
+            if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, -gm);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, -gm);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, gm);
             break;
         }
 
@@ -3611,10 +4427,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double G_src = 1.0;
             STAMP_CONDUCTANCE(n[2], n[3], G_src);
             // I_sense = G_sense * (V0 - V1), V_out = rm * I_sense
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, -G_src * rm * G_sense);
-            if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, G_src * rm * G_sense);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, G_src * rm * G_sense);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, -G_src * rm * G_sense);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, -G_src * rm * G_sense);
+            if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, G_src * rm * G_sense);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, G_src * rm * G_sense);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, -G_src * rm * G_sense);
             break;
         }
 
@@ -3628,10 +4444,10 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             STAMP_CONDUCTANCE(n[0], n[1], G_sense);
 
             // Output current proportional to sensed current
-            if (n[2] > 0 && n[0] > 0) matrix_add(A, n[2]-1, n[0]-1, gain * G_sense);
-            if (n[2] > 0 && n[1] > 0) matrix_add(A, n[2]-1, n[1]-1, -gain * G_sense);
-            if (n[3] > 0 && n[0] > 0) matrix_add(A, n[3]-1, n[0]-1, -gain * G_sense);
-            if (n[3] > 0 && n[1] > 0) matrix_add(A, n[3]-1, n[1]-1, gain * G_sense);
+            if (n[2] > 0 && n[0] > 0) sparse_add(A, n[2]-1, n[0]-1, gain * G_sense);
+            if (n[2] > 0 && n[1] > 0) sparse_add(A, n[2]-1, n[1]-1, -gain * G_sense);
+            if (n[3] > 0 && n[0] > 0) sparse_add(A, n[3]-1, n[0]-1, -gain * G_sense);
+            if (n[3] > 0 && n[1] > 0) sparse_add(A, n[3]-1, n[1]-1, gain * G_sense);
             break;
         }
 
@@ -3654,70 +4470,30 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
         }
 
         case COMP_RELAY: {
-            // Relay with coil inductance and hysteresis
+            // Relay: coil (R + L in series) with pickup/dropout hysteresis
             // Terminals: 0=C+ (coil+), 1=C- (coil-), 2=NO, 3=COM
-            double R_coil = comp->props.relay.r_coil;
-            double L_coil = comp->props.relay.l_coil;
-            double i_pickup = comp->props.relay.i_pickup;
-            double i_dropout = comp->props.relay.i_dropout;
-            double I_prev = comp->props.relay.i_coil;
-            bool energized = comp->props.relay.energized;
-
-            // --- Coil Circuit (R + L in series) ---
-            if (comp->props.relay.ideal || L_coil < 1e-9) {
-                // Ideal mode: just coil resistance, no inductance
-                STAMP_CONDUCTANCE(n[0], n[1], 1.0/R_coil);
-
-                // Estimate coil current from voltage for hysteresis
-                double V_coil = 0;
-                if (prev_solution) {
-                    double v0 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
-                    double v1 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
-                    V_coil = v0 - v1;
-                }
-                I_prev = V_coil / R_coil;
-                comp->props.relay.i_coil = I_prev;
-            } else {
-                // Non-ideal: R + L companion model
-                // V = I*R + L*dI/dt -> V = I*R_eq + V_eq
-                // where R_eq = R + L/dt, V_eq = L/dt * I_prev
-                double R_eq = R_coil + L_coil / dt;
-                double G = 1.0 / R_eq;
-                STAMP_CONDUCTANCE(n[0], n[1], G);
+            // The coil current is a branch variable like an inductor's; the
+            // contact state switches in component_event_commit.
+            double L = comp->props.relay.ideal ? 0.0 : comp->props.relay.l_coil;
+            int curr_idx = num_nodes + comp->voltage_var_idx;
 
-                // Current source for inductor history (I_eq = I_prev * L/dt / R_eq)
-                double I_eq = (L_coil / dt) * I_prev / R_eq;
-                if (n[0] > 0) vector_add(b, n[0]-1, -I_eq);
-                if (n[1] > 0) vector_add(b, n[1]-1, I_eq);
+            double Req, Veq;
+            reactive_companion(comp, 0, integ, L, 0, history, curr_idx, -1, &Req, &Veq);
+            Req += comp->props.relay.r_coil;
 
-                // Update coil current from solution for next iteration
-                // (done after matrix solve, but we can estimate from voltage)
-                if (prev_solution) {
-                    double v0 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
-                    double v1 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
-                    double V_coil = v0 - v1;
-                    // I = (V - V_eq) / R_eq = (V - L/dt * I_prev) / R_eq
-                    double I_new = (V_coil + (L_coil / dt) * I_prev) / R_eq;
-                    comp->props.relay.i_coil = I_new;
-                    I_prev = I_new;  // Use updated current for hysteresis
-                }
+            if (n[0] > 0) {
+                sparse_add(A, curr_idx, n[0]-1, 1);
+                sparse_add(A, n[0]-1, curr_idx, 1);
             }
-
-            // --- Hysteresis Logic ---
-            // Apply hysteresis: energize at pickup, de-energize at dropout
-            double I_abs = fabs(I_prev);
-            if (!energized && I_abs >= i_pickup) {
-                // Pull-in: energize relay
-                comp->props.relay.energized = true;
-                energized = true;
-            } else if (energized && I_abs <= i_dropout) {
-                // Drop-out: de-energize relay
-                comp->props.relay.energized = false;
-                energized = false;
+            if (n[1] > 0) {
+                sparse_add(A, curr_idx, n[1]-1, -1);
+                sparse_add(A, n[1]-1, curr_idx, -1);
             }
+            sparse_add(A, curr_idx, curr_idx, -Req);
+            vector_add(b, curr_idx, Veq);
 
             // --- Contact Circuit (NO to COM) ---
-            double R_contact = energized ?
+            double R_contact = comp->props.relay.energized ?
                               comp->props.relay.r_contact_on :
                               comp->props.relay.r_contact_off;
             STAMP_CONDUCTANCE(n[2], n[3], 1.0/R_contact);
@@ -3731,7 +4507,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 v_ctl = vector_get(prev_solution, n[2]-1);
             }
 
-            bool on = v_ctl >= comp->props.analog_switch.v_on;
+            // Ideal-switch mode uses the committed state instead
+            bool on = comp->ideal_switch ? comp->switch_on
+                                         : v_ctl >= comp->props.analog_switch.v_on;
             double R = on ? comp->props.analog_switch.r_on : comp->props.analog_switch.r_off;
             STAMP_CONDUCTANCE(n[0], n[1], 1.0/R);
             break;
@@ -3749,7 +4527,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Model as voltage source with series resistance
             double G = 1.0 / R_out;
             if (n[0] > 0) {
-                matrix_add(A, n[0]-1, n[0]-1, G);
+                sparse_add(A, n[0]-1, n[0]-1, G);
                 vector_add(b, n[0]-1, G * V);
             }
             break;
@@ -3759,7 +4537,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Logic output: high-impedance input (just observes voltage)
             double G = 1e-12;
             if (n[0] > 0) {
-                matrix_add(A, n[0]-1, n[0]-1, G);
+                sparse_add(A, n[0]-1, n[0]-1, G);
             }
             break;
         }
@@ -3792,11 +4570,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double G = 1.0 / r_out;
 
             // High-impedance input
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-12);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-12);
 
             // Output as voltage source with resistance
             if (n[1] > 0) {
-                matrix_add(A, n[1]-1, n[1]-1, G);
+                sparse_add(A, n[1]-1, n[1]-1, G);
                 vector_add(b, n[1]-1, G * V_out);
             }
             break;
@@ -3824,12 +4602,12 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double G = 1.0 / r_out;
 
             // High-impedance inputs
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-12);
-            if (n[1] > 0) matrix_add(A, n[1]-1, n[1]-1, 1e-12);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-12);
+            if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, 1e-12);
 
             // Output
             if (n[2] > 0) {
-                matrix_add(A, n[2]-1, n[2]-1, G);
+                sparse_add(A, n[2]-1, n[2]-1, G);
                 vector_add(b, n[2]-1, G * V_out);
             }
             break;
@@ -3856,11 +4634,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double V_out = result ? v_high : v_low;
             double G = 1.0 / r_out;
 
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-12);
-            if (n[1] > 0) matrix_add(A, n[1]-1, n[1]-1, 1e-12);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-12);
+            if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, 1e-12);
 
             if (n[2] > 0) {
-                matrix_add(A, n[2]-1, n[2]-1, G);
+                sparse_add(A, n[2]-1, n[2]-1, G);
                 vector_add(b, n[2]-1, G * V_out);
             }
             break;
@@ -3887,11 +4665,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double V_out = result ? v_high : v_low;
             double G = 1.0 / r_out;
 
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-12);
-            if (n[1] > 0) matrix_add(A, n[1]-1, n[1]-1, 1e-12);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-12);
+            if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, 1e-12);
 
             if (n[2] > 0) {
-                matrix_add(A, n[2]-1, n[2]-1, G);
+                sparse_add(A, n[2]-1, n[2]-1, G);
                 vector_add(b, n[2]-1, G * V_out);
             }
             break;
@@ -3913,19 +4691,19 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             bool enabled = v_en >= v_th;
             bool input_high = v_in >= v_th;
 
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-12);
-            if (n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, 1e-12);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-12);
+            if (n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, 1e-12);
 
             if (enabled) {
                 double V_out = input_high ? v_high : v_low;
                 double G = 1.0 / r_out;
                 if (n[1] > 0) {
-                    matrix_add(A, n[1]-1, n[1]-1, G);
+                    sparse_add(A, n[1]-1, n[1]-1, G);
                     vector_add(b, n[1]-1, G * V_out);
                 }
             } else {
                 // High impedance output
-                if (n[1] > 0) matrix_add(A, n[1]-1, n[1]-1, 1e-12);
+                if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, 1e-12);
             }
             break;
         }
@@ -3951,7 +4729,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             // High-impedance inputs
             for (int i = 0; i < comp->num_terminals - 2; i++) {
-                if (n[i] > 0) matrix_add(A, n[i]-1, n[i]-1, 1e-12);
+                if (n[i] > 0) sparse_add(A, n[i]-1, n[i]-1, 1e-12);
             }
 
             // Outputs (last two terminals typically)
@@ -3960,11 +4738,11 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int out2 = comp->num_terminals - 1;
 
             if (n[out1] > 0) {
-                matrix_add(A, n[out1]-1, n[out1]-1, G);
+                sparse_add(A, n[out1]-1, n[out1]-1, G);
                 vector_add(b, n[out1]-1, G * V_out);
             }
             if (n[out2] > 0) {
-                matrix_add(A, n[out2]-1, n[out2]-1, G);
+                sparse_add(A, n[out2]-1, n[out2]-1, G);
                 vector_add(b, n[out2]-1, G * (v_high - V_out + v_low));  // Complement
             }
             break;
@@ -3984,7 +4762,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             int bcd_value = 0;
             for (int i = 0; i < 4; i++) {
                 if (n[i] > 0) {
-                    matrix_add(A, n[i]-1, n[i]-1, 1e-12);
+                    sparse_add(A, n[i]-1, n[i]-1, 1e-12);
                     // Read input voltage from previous solution
                     if (prev_solution && prev_solution->data[n[i]-1] > v_thresh) {
                         bcd_value |= (1 << i);
@@ -4022,7 +4800,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                     bool seg_on = (segments >> i) & 1;
                     if (active_low) seg_on = !seg_on;
                     double V_out = seg_on ? v_high : v_low;
-                    matrix_add(A, n[term_idx]-1, n[term_idx]-1, G);
+                    sparse_add(A, n[term_idx]-1, n[term_idx]-1, G);
                     vector_add(b, n[term_idx]-1, G * V_out);
                 }
             }
@@ -4038,55 +4816,36 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double G_out = 1.0 / r_out;
             double G_in = 1e-7;  // High impedance inputs (10M)
 
-            // Get voltages from solution vector (for state update)
-            double v_vcc = 0, v_gnd = 0, v_trig = 0, v_thresh = 0;
+            // Supply voltage from the solution vector
+            double v_vcc = 0, v_gnd = 0;
             if (prev_solution) {
                 if (n[0] > 0) v_vcc = vector_get(prev_solution, n[0] - 1);
                 if (n[1] > 0) v_gnd = vector_get(prev_solution, n[1] - 1);
-                if (n[2] > 0) v_trig = vector_get(prev_solution, n[2] - 1);
-                if (n[3] > 0) v_thresh = vector_get(prev_solution, n[3] - 1);
             }
 
             // Calculate supply voltage relative to GND
             double vcc = v_vcc - v_gnd;
             if (vcc < 0.5) vcc = comp->props.timer_555.vcc;  // Fallback
 
-            // 555 internal comparator thresholds
-            double v_trig_thresh = vcc / 3.0;    // Trigger threshold (1/3 VCC)
-            double v_upper_thresh = 2.0 * vcc / 3.0;  // Upper threshold (2/3 VCC)
-
-            // Relative voltages (referenced to GND)
-            double v_trig_rel = v_trig - v_gnd;
-            double v_thresh_rel = v_thresh - v_gnd;
-
-            // Update internal flip-flop state based on comparators
-            // TRIGGER < 1/3 VCC: SET output HIGH
-            // THRESHOLD > 2/3 VCC: RESET output LOW
-            if (v_trig_rel < v_trig_thresh) {
-                comp->props.timer_555.output = true;  // SET
-            }
-            if (v_thresh_rel > v_upper_thresh) {
-                comp->props.timer_555.output = false;  // RESET
-            }
-
-            // Output voltage based on flip-flop state
+            // Output voltage based on flip-flop state (the comparators set
+            // and reset it in component_event_commit)
             double v_out = comp->props.timer_555.output ? (vcc - 0.3 + v_gnd) : (0.1 + v_gnd);
 
             // VCC input - small conductance to ground for stability
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, G_in);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, G_in);
 
             // GND input - small conductance
-            if (n[1] > 0) matrix_add(A, n[1]-1, n[1]-1, G_in);
+            if (n[1] > 0) sparse_add(A, n[1]-1, n[1]-1, G_in);
 
             // TRIGGER input - high impedance to GND
-            if (n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, G_in);
+            if (n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, G_in);
 
             // THRESHOLD input - high impedance to GND
-            if (n[3] > 0) matrix_add(A, n[3]-1, n[3]-1, G_in);
+            if (n[3] > 0) sparse_add(A, n[3]-1, n[3]-1, G_in);
 
             // Output - voltage source behavior (low impedance output)
             if (n[4] > 0) {
-                matrix_add(A, n[4]-1, n[4]-1, G_out);
+                sparse_add(A, n[4]-1, n[4]-1, G_out);
                 vector_add(b, n[4]-1, G_out * v_out);
             }
             break;
@@ -4103,7 +4862,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             // High-impedance inputs
             for (int i = 0; i < comp->num_terminals - 1; i++) {
-                if (n[i] > 0) matrix_add(A, n[i]-1, n[i]-1, 1e-12);
+                if (n[i] > 0) sparse_add(A, n[i]-1, n[i]-1, 1e-12);
             }
 
             // Output
@@ -4112,7 +4871,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
 
             double V_out = 2.5;  // Default mid-rail
             if (n[out_idx] > 0) {
-                matrix_add(A, n[out_idx]-1, n[out_idx]-1, G);
+                sparse_add(A, n[out_idx]-1, n[out_idx]-1, G);
                 vector_add(b, n[out_idx]-1, G * V_out);
             }
             break;
@@ -4167,21 +4926,33 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Calculate desired output voltage (ADJ + 1.25V)
             double v_out_desired = v_adj + v_ref;
 
-            // Check dropout condition: if Vin < Vout + dropout, regulator can't maintain output
+            // Check dropout condition: if Vin < Vout + dropout, regulator
+            // can't maintain output. The output follows the node that sets
+            // it (ctrl, -1 for none) plus an offset, so the stamp carries
+            // the dependence for Newton.
             double v_out_max = v_in - v_dropout;
-            double V_out = (v_out_desired < v_out_max) ? v_out_desired : v_out_max;
-            if (V_out < 0) V_out = 0;  // Can't output negative
+            int ctrl = n[2];
+            double offset = v_ref;
+            if (v_out_max < v_out_desired) {
+                ctrl = n[0];
+                offset = -v_dropout;
+            }
+            if (MIN(v_out_desired, v_out_max) < 0) {
+                ctrl = 0;  // Can't output negative
+                offset = 0;
+            }
 
             // Input connection - small conductance for bias current
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, G_in);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, G_in);
 
             // ADJ pin - very high impedance (draws ~50uA typically)
-            if (n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, 1e-12);
+            if (n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, 1e-12);
 
             // Output - voltage source behavior
             if (n[1] > 0) {
-                matrix_add(A, n[1]-1, n[1]-1, G_out);
-                vector_add(b, n[1]-1, G_out * V_out);
+                sparse_add(A, n[1]-1, n[1]-1, G_out);
+                if (ctrl > 0) sparse_add(A, n[1]-1, ctrl-1, -G_out);
+                vector_add(b, n[1]-1, G_out * offset);
             }
             break;
         }
@@ -4206,30 +4977,32 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Calculate voltage relative to GND pin
             double v_in_rel = v_in - v_gnd;
 
-            // Check dropout condition: need at least 7V (5V + 2V dropout)
-            double V_out;
+            // Check dropout condition: need at least 7V (5V + 2V dropout).
+            // The output follows the node that sets it (ctrl) plus an
+            // offset, so the stamp carries the dependence for Newton.
+            int ctrl = n[2];
+            double offset = 0;
             if (v_in_rel >= v_reg + v_dropout) {
                 // Normal regulation - output 5V above GND
-                V_out = v_gnd + v_reg;
-            } else if (v_in_rel > 0) {
+                offset = v_reg;
+            } else if (v_in_rel > v_dropout) {
                 // Dropout - output follows input minus dropout
-                V_out = v_in - v_dropout;
-                if (V_out < v_gnd) V_out = v_gnd;  // Can't go below GND
-            } else {
-                // No input voltage
-                V_out = v_gnd;
+                ctrl = n[0];
+                offset = -v_dropout;
             }
+            // Otherwise no usable input: the output can't go below GND
 
             // Input connection - small conductance for bias current
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, G_in);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, G_in);
 
             // GND pin - connection point
-            if (n[2] > 0) matrix_add(A, n[2]-1, n[2]-1, 1e-12);
+            if (n[2] > 0) sparse_add(A, n[2]-1, n[2]-1, 1e-12);
 
             // Output - voltage source behavior
             if (n[1] > 0) {
-                matrix_add(A, n[1]-1, n[1]-1, G_out);
-                vector_add(b, n[1]-1, G_out * V_out);
+                sparse_add(A, n[1]-1, n[1]-1, G_out);
+                if (ctrl > 0) sparse_add(A, n[1]-1, ctrl-1, -G_out);
+                vector_add(b, n[1]-1, G_out * offset);
             }
             break;
         }
@@ -4245,8 +5018,14 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 Vd = v1 - v2;
             }
 
+            // Conducting, the shunt current is G * (Vd - V_ref), so that
+            // the cathode settles just above V_ref instead of chattering
             double G = (Vd > v_ref) ? 1.0 : 1e-12;
             STAMP_CONDUCTANCE(n[0], n[1], G);
+            if (Vd > v_ref) {
+                if (n[0] > 0) vector_add(b, n[0]-1, G * v_ref);
+                if (n[1] > 0) vector_add(b, n[1]-1, -G * v_ref);
+            }
             break;
         }
 
@@ -4264,8 +5043,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // 7-segment display: terminals 0-3=a,b,c,d, 4=COM, 5-8=e,f,g,DP
             // Each segment is a diode from segment pin to COM
             double Is = 1e-20;
-            // Calculate thermal voltage from global environment temperature
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            // Calculate thermal voltage from the environment temperature
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nn = 2.0;
             double nVt = nn * Vt;
             int com = 4;  // COM is terminal 4
@@ -4298,17 +5077,13 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Each segment uses same Shockley diode model as COMP_LED
             double Is = comp->props.led_array.is;
             double nn = comp->props.led_array.n;
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nVt = nn * Vt;
             int com = 8;  // Common cathode terminal index
-            double max_I = comp->props.led_array.max_current;
 
             for (int i = 0; i < 8; i++) {
                 // Skip burned LEDs (open circuit)
-                if (comp->props.led_array.failed[i]) {
-                    comp->props.led_array.currents[i] = 0;
-                    continue;
-                }
+                if (comp->props.led_array.failed[i]) continue;
 
                 // Calculate diode voltage from previous solution
                 double Vd = 0.6;  // Initial guess
@@ -4324,14 +5099,6 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 double Gd = (Is / nVt) * expTerm + 1e-12;  // Dynamic conductance + GMIN
                 double Ieq = Id - Gd * Vd;  // Equivalent current source
 
-                // Store LED current for glow rendering
-                comp->props.led_array.currents[i] = (Id > 0) ? Id : 0;
-
-                // Check for overcurrent (burning)
-                if (Id > max_I * 2.0 && Id > 0.001) {
-                    comp->props.led_array.failed[i] = true;
-                }
-
                 // Stamp the companion model: conductance + current source
                 STAMP_CONDUCTANCE(n[i], n[com], Gd);
                 if (n[i] > 0) vector_add(b, n[i]-1, -Ieq);
@@ -4345,8 +5112,8 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // columns C0-C7 (terminals 8-15) are cathodes
             // Each LED(r,c) is connected between row r and column c
             double Is = 1e-20;
-            // Calculate thermal voltage from global environment temperature
-            double Vt = 8.617e-5 * (g_environment.temperature + 273.15);
+            // Calculate thermal voltage from the environment temperature
+            double Vt = 8.617e-5 * (ctx->environment.temperature + 273.15);
             double nn = 2.0;
             double nVt = nn * Vt;
 
@@ -4382,27 +5149,14 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double R_a = comp->props.dc_motor.r_armature;
             double L_a = comp->props.dc_motor.l_armature;
             double kv = comp->props.dc_motor.kv;
-            double kt = comp->props.dc_motor.kt;
-            double J = comp->props.dc_motor.j_rotor;
-            double b_f = comp->props.dc_motor.b_friction;
-            double T_load = comp->props.dc_motor.torque_load;
 
-            // Get previous state
+            // Speed and current at the last accepted step; the mechanical
+            // side advances in component_accept_step
             double omega_prev = comp->props.dc_motor.omega;
             double I_prev = comp->props.dc_motor.current;
 
             // Back-EMF voltage
             double V_bemf = kv * omega_prev;
-            comp->props.dc_motor.v_bemf = V_bemf;
-
-            // Update motor speed using Euler integration
-            // Torque = kt * I, friction torque = b * omega
-            double T_motor = kt * I_prev;
-            double T_friction = b_f * omega_prev;
-            double d_omega = (T_motor - T_friction - T_load) / J;
-            double omega_new = omega_prev + d_omega * dt;
-            if (omega_new < 0) omega_new = 0;  // Prevent negative rotation for simple DC motor
-            comp->props.dc_motor.omega = omega_new;
 
             // Stamp armature circuit: R_a + L_a with back-EMF
             // Use companion model: V = I*R_eq + V_eq where R_eq = R_a + L_a/dt
@@ -4413,19 +5167,13 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // Back-EMF acts as voltage source in series (reduces current)
             // Current source equivalent for back-EMF: I_bemf = V_bemf / Req
             double I_bemf = V_bemf / Req;
-            // Also add previous inductor current contribution
+            // Also add previous inductor current contribution. The armature
+            // current is I = (V - V_bemf)/Req + I_L_prev, i.e. G*V + I_eq.
             double I_L_prev = (L_a / dt) * I_prev / Req;
-            double I_eq = I_bemf - I_L_prev;
+            double I_eq = I_L_prev - I_bemf;
 
             if (n[0] > 0) vector_add(b, n[0]-1, -I_eq);
             if (n[1] > 0) vector_add(b, n[1]-1, I_eq);
-
-            // Update current from solution (will be done after solve)
-            if (prev_solution) {
-                double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0]-1) : 0;
-                double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1]-1) : 0;
-                comp->props.dc_motor.current = (v1 - v2 - V_bemf) / Req + I_prev * L_a / (Req * dt);
-            }
             break;
         }
 
@@ -4437,23 +5185,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double R_series = comp->props.antenna.ideal ? 1e-6 : comp->props.antenna.r_series;
             double G = 1.0 / R_series;
 
-            // Stamp as high-impedance load
+            // Stamp as high-impedance load. The voltage is broadcast on the
+            // channel when a step is accepted (component_accept_step).
             STAMP_CONDUCTANCE(n[0], n[1], G);
-
-            // Read voltage from previous solution and broadcast to channel
-            if (prev_solution) {
-                double v1 = (n[0] > 0) ? vector_get(prev_solution, n[0] - 1) : 0.0;
-                double v2 = (n[1] > 0) ? vector_get(prev_solution, n[1] - 1) : 0.0;
-                double v_diff = (v1 - v2) * comp->props.antenna.gain;
-                comp->props.antenna.voltage = v_diff;
-
-                // Contribute to wireless channel (will be averaged if multiple TX)
-                int ch = comp->props.antenna.channel;
-                if (ch >= 0 && ch < WIRELESS_CHANNEL_COUNT) {
-                    g_wireless.voltage[ch] += v_diff;
-                    g_wireless.tx_count[ch]++;
-                }
-            }
             break;
         }
 
@@ -4463,14 +5197,14 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             double R_series = comp->props.antenna.ideal ? 1e-6 : comp->props.antenna.r_series;
             double G = 1.0 / R_series;
 
-            // Get voltage from wireless channel
+            // Get voltage from wireless channel, as broadcast at the last
+            // accepted step
             int ch = comp->props.antenna.channel;
             double V_rx = 0.0;
-            if (ch >= 0 && ch < WIRELESS_CHANNEL_COUNT && g_wireless.tx_count[ch] > 0) {
+            if (ch >= 0 && ch < WIRELESS_CHANNEL_COUNT && ctx->wireless.tx_count[ch] > 0) {
                 // Average voltage from all TX on this channel
-                V_rx = (g_wireless.voltage[ch] / g_wireless.tx_count[ch]) * comp->props.antenna.gain;
+                V_rx = (ctx->wireless.voltage[ch] / ctx->wireless.tx_count[ch]) * comp->props.antenna.gain;
             }
-            comp->props.antenna.voltage = V_rx;
 
             // Stamp as voltage source with series resistance
             STAMP_CONDUCTANCE(n[0], n[1], G);
@@ -4530,7 +5264,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
         case COMP_TEST_POINT:
         case COMP_LABEL: {
             // Test point/Label: just a node marker, infinite impedance
-            if (n[0] > 0) matrix_add(A, n[0]-1, n[0]-1, 1e-15);
+            if (n[0] > 0) sparse_add(A, n[0]-1, n[0]-1, 1e-15);
             break;
         }
 
@@ -4549,8 +5283,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                 break;  // No definition found or empty
             }
 
-            // External global counter for allocating subcircuit internal node indices
-            extern int g_subcircuit_internal_node_offset;
+            // Internal nodes and branch currents are allocated in order from
+            // the private block reserved for this instance by the simulation
+            int next_index = comp->subcircuit_base;
 
             // Create node remapping table: internal_node_id -> matrix index
             // -1 means not yet assigned, 0 means ground
@@ -4562,10 +5297,9 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
             // First, map pin internal nodes to external circuit nodes
             for (int i = 0; i < def->num_pins && i < comp->num_terminals; i++) {
                 int internal_id = def->pins[i].internal_node_id;
-                int external_id = comp->node_ids[i];
-                if (internal_id > 0 && internal_id < MAX_NODES && external_id > 0) {
+                if (internal_id > 0 && internal_id < MAX_NODES && comp->node_ids[i] > 0) {
                     // Map internal node to the matrix index of the external node
-                    node_remap[internal_id] = node_map[external_id];
+                    node_remap[internal_id] = n[i];
                 }
             }
 
@@ -4578,7 +5312,7 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                     int orig_node = ic->node_ids[t];
                     if (orig_node > 0 && orig_node < MAX_NODES && node_remap[orig_node] == -1) {
                         // This internal node hasn't been assigned yet - allocate new index
-                        node_remap[orig_node] = g_subcircuit_internal_node_offset++;
+                        node_remap[orig_node] = next_index++;
                     }
                 }
             }
@@ -4593,28 +5327,31 @@ void component_stamp(Component *comp, Matrix *A, Vector *b,
                     continue;
                 }
 
-                // Create a temporary component with remapped node IDs
+                // Create a temporary component with remapped matrix nodes
                 Component temp_comp;
                 memcpy(&temp_comp, ic, sizeof(Component));
+                temp_comp.bypass.valid = false;  // Per-stamp copy, nothing to reuse
+                temp_comp.limit.valid = false;
+                temp_comp.reactive.valid = false;
 
-                // Remap node IDs using the mapping table
-                for (int t = 0; t < temp_comp.num_terminals && t < MAX_TERMINALS; t++) {
-                    int orig_node = ic->node_ids[t];
+                for (int t = 0; t < MAX_TERMINALS; t++) {
+                    int orig_node = (t < ic->num_terminals) ? ic->node_ids[t] : 0;
                     if (orig_node > 0 && orig_node < MAX_NODES) {
                         int mapped = node_remap[orig_node];
-                        temp_comp.node_ids[t] = (mapped >= 0) ? mapped : 0;
+                        temp_comp.matrix_nodes[t] = (mapped >= 0) ? mapped : 0;
                     } else {
-                        temp_comp.node_ids[t] = 0;  // Ground
+                        temp_comp.matrix_nodes[t] = 0;  // Ground
                     }
                 }
 
-                // Stamp the remapped component directly using matrix indices
-                // Note: We pass a dummy node_map since temp_comp already has matrix indices
-                int dummy_node_map[MAX_NODES];
-                for (int i = 0; i < MAX_NODES; i++) {
-                    dummy_node_map[i] = i;  // Identity mapping
+                // Branch current rows also come from the private block, so
+                // they cannot collide with the main circuit's voltage variables
+                if (temp_comp.needs_voltage_var) {
+                    temp_comp.voltage_var_idx = (next_index++ - 1) - num_nodes;
                 }
-                component_stamp(&temp_comp, A, b, dummy_node_map, num_nodes, time, prev_solution, dt);
+
+                component_stamp(&temp_comp, A, b, num_nodes, time, prev_solution, history, integ,
+                                ctx);
             }
             break;
         }
@@ -7,13 +7,39 @@
 #include <math.h>
 #include "matrix.h"
 
+// Solver heap allocations made by the current thread
+#ifdef _WIN32
+static __declspec(thread) unsigned long tls_alloc_count = 0;
+#else
+static __thread unsigned long tls_alloc_count = 0;
+#endif
+
+void *solver_malloc(size_t size) {
+    tls_alloc_count++;
+    return malloc(size);
+}
+
+void *solver_calloc(size_t count, size_t size) {
+    tls_alloc_count++;
+    return calloc(count, size);
+}
+
+void *solver_realloc(void *ptr, size_t size) {
+    tls_alloc_count++;
+    return realloc(ptr, size);
+}
+
+unsigned long solver_alloc_count(void) {
+    return tls_alloc_count;
+}
+
 Matrix *matrix_create(int rows, int cols) {
-    Matrix *m = malloc(sizeof(Matrix));
+    Matrix *m = solver_malloc(sizeof(Matrix));
     if (!m) return NULL;
 
     m->rows = rows;
     m->cols = cols;
-    m->data = calloc(rows * cols, sizeof(double));
+    m->data = solver_calloc(rows * cols, sizeof(double));
 
     if (!m->data) {
         free(m);
@@ -66,11 +92,11 @@ Matrix *matrix_clone(Matrix *m) {
 }
 
 Vector *vector_create(int size) {
-    Vector *v = malloc(sizeof(Vector));
+    Vector *v = solver_malloc(sizeof(Vector));
     if (!v) return NULL;
 
     v->size = size;
-    v->data = calloc(size, sizeof(double));
+    v->data = solver_calloc(size, sizeof(double));
 
     if (!v->data) {
         free(v);
@@ -122,6 +148,17 @@ Vector *vector_clone(Vector *v) {
     return clone;
 }
 
+void vector_init(Vector *v, double *data, int size) {
+    v->size = size;
+    v->data = data;
+}
+
+void vector_copy(Vector *dst, const Vector *src) {
+    if (dst && src && dst != src && dst->size == src->size) {
+        memcpy(dst->data, src->data, src->size * sizeof(double));
+    }
+}
+
 double vector_norm(Vector *v) {
     if (!v) return 0.0;
 
@@ -143,7 +180,7 @@ Vector *linear_solve(Matrix *A, Vector *b) {
     int n = A->rows;
 
     // Create augmented matrix [A|b]
-    double *aug = malloc(n * (n + 1) * sizeof(double));
+    double *aug = solver_malloc(n * (n + 1) * sizeof(double));
     if (!aug) return NULL;
 
     // Copy A and b into augmented matrix
@@ -0,0 +1,102 @@
+/**
+ * Circuit Playground - Counter-Based Random Numbers Implementation
+ */
+
+#include <math.h>
+#include "rng.h"
+
+#ifndef M_PI
+#define M_PI 3.14159265358979323846
+#endif
+
+static inline uint64_t rng_mix(uint64_t z) {
+    z += 0x9E3779B97F4A7C15ULL;
+    z = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ULL;
+    z = (z ^ (z >> 27)) * 0x94D049BB133111EBULL;
+    return z ^ (z >> 31);
+}
+
+// Key of a stream: mixed once, then combined with each counter
+static inline uint64_t rng_key(uint64_t seed, uint64_t stream) {
+    return rng_mix(seed ^ rng_mix(stream));
+}
+
+static inline uint64_t rng_draw(uint64_t key, uint64_t counter) {
+    return rng_mix(key ^ (counter * 0xD1B54A32D192ED03ULL));
+}
+
+static inline double rng_unit(uint64_t bits) {
+    return ((bits >> 11) + 0.5) * (1.0 / 9007199254740992.0);
+}
+
+uint64_t rng_bits(uint64_t seed, uint64_t stream, uint64_t counter) {
+    return rng_draw(rng_key(seed, stream), counter);
+}
+
+double rng_uniform(uint64_t seed, uint64_t stream, uint64_t counter) {
+    return rng_unit(rng_bits(seed, stream, counter));
+}
+
+double rng_gaussian(uint64_t seed, uint64_t stream, uint64_t counter) {
+    uint64_t key = rng_key(seed, stream);
+    uint64_t pair = counter & ~1ULL;
+    double r = sqrt(-2.0 * log(rng_unit(rng_draw(key, pair))));
+    double a = 2.0 * M_PI * rng_unit(rng_draw(key, pair + 1));
+    return r * ((counter & 1) ? sin(a) : cos(a));
+}
+
+void rng_uniform_batch(uint64_t seed, uint64_t stream, uint64_t counter,
+                       double *out, int count) {
+    uint64_t key = rng_key(seed, stream);
+    for (int i = 0; i < count; i++) {
+        out[i] = rng_unit(rng_draw(key, counter + i));
+    }
+}
+
+void rng_gaussian_batch(uint64_t seed, uint64_t stream, uint64_t counter,
+                        double *out, int count) {
+    uint64_t key = rng_key(seed, stream);
+    int i = 0;
+
+    // Odd start: second half of a pair
+    if (count > 0 && (counter & 1)) {
+        out[i++] = rng_gaussian(seed, stream, counter);
+    }
+    // Whole pairs: both halves from one logarithm and one angle
+    for (; i + 1 < count; i += 2) {
+        uint64_t pair = counter + i;
+        double r = sqrt(-2.0 * log(rng_unit(rng_draw(key, pair))));
+        double a = 2.0 * M_PI * rng_unit(rng_draw(key, pair + 1));
+        out[i] = r * cos(a);
+        out[i + 1] = r * sin(a);
+    }
+    if (i < count) {
+        out[i] = rng_gaussian(seed, stream, counter + i);
+    }
+}
+
+double rng_normal_quantile(double p) {
+    static const double a[] = {-3.969683028665376e+01, 2.209460984245205e+02,
+                               -2.759285104469687e+02, 1.383577518672690e+02,
+                               -3.066479806614716e+01, 2.506628277459239e+00};
+    static const double b[] = {-5.447609879822406e+01, 1.615858368580409e+02,
+                               -1.556989798598866e+02, 6.680131188771972e+01,
+                               -1.328068155288572e+01};
+    static const double c[] = {-7.784894002430293e-03, -3.223964580411365e-01,
+                               -2.400758277161838e+00, -2.549732539343734e+00,
+                               4.374664141464968e+00, 2.938163982698783e+00};
+    static const double d[] = {7.784695709041462e-03, 3.224671290700398e-01,
+                               2.445134137142996e+00, 3.754408661907416e+00};
+    const double p_low = 0.02425;
+
+    if (p < p_low || p > 1.0 - p_low) {
+        double q = sqrt(-2.0 * log(p < p_low ? p : 1.0 - p));
+        double x = (((((c[0] * q + c[1]) * q + c[2]) * q + c[3]) * q + c[4]) * q + c[5]) /
+                   ((((d[0] * q + d[1]) * q + d[2]) * q + d[3]) * q + 1.0);
+        return (p < p_low) ? x : -x;
+    }
+    double q = p - 0.5;
+    double r = q * q;
+    return (((((a[0] * r + a[1]) * r + a[2]) * r + a[3]) * r + a[4]) * r + a[5]) * q /
+           (((((b[0] * r + b[1]) * r + b[2]) * r + b[3]) * r + b[4]) * r + 1.0);
+}
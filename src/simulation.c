@@ -9,13 +9,12 @@
 #include "simulation.h"
 #include "logic.h"
 #include "component.h"
+#include "ac.h"
+#include "rng.h"
 
 // External subcircuit library
 extern SubCircuitLibrary g_subcircuit_library;
 
-// Global counter for allocating subcircuit internal node indices during stamping
-int g_subcircuit_internal_node_offset = 0;
-
 // Helper to count internal nodes needed for a subcircuit definition
 // Returns the max internal node ID found (excluding pin nodes)
 static int subcircuit_count_internal_nodes(SubCircuitDef *def) {
@@ -39,6 +38,19 @@ static int subcircuit_count_internal_nodes(SubCircuitDef *def) {
     return max_node_id;
 }
 
+// Count the internal components of a subcircuit definition that need a
+// branch current variable
+static int subcircuit_count_voltage_vars(SubCircuitDef *def) {
+    if (!def || !def->component_data) return 0;
+
+    int count = 0;
+    Component *internal_comps = (Component *)def->component_data;
+    for (int i = 0; i < def->num_components; i++) {
+        if (internal_comps[i].needs_voltage_var) count++;
+    }
+    return count;
+}
+
 // GMIN - minimum conductance added from each node to ground
 // This stabilizes floating nodes and prevents singular matrices
 // Equivalent to 1 TΩ resistance to ground
@@ -54,8 +66,15 @@ Simulation *simulation_create(Circuit *circuit) {
     sim->time_step = DEFAULT_TIME_STEP;
     sim->speed = 1.0;
 
-    // Initialize adaptive time-stepping (disabled by default - needs more tuning)
+    // Adaptive time-stepping controlled by the local truncation error. Off
+    // by default: the scope history, its FFT and the per-frame step count
+    // of the app all assume a uniform time step.
     sim->adaptive_enabled = false;
+    sim->lte.reltol = LTE_RELTOL;
+    sim->lte.abstol = LTE_ABSTOL;
+    sim->lte.chgtol = LTE_CHGTOL;
+    sim->lte.trtol = LTE_TRTOL;
+    sim->vntol = NEWTON_VNTOL;
     sim->dt_target = DEFAULT_TIME_STEP;
     sim->dt_actual = DEFAULT_TIME_STEP;
     sim->error_estimate = 0.0;
@@ -64,21 +83,32 @@ Simulation *simulation_create(Circuit *circuit) {
     sim->adaptive_factor = 1.0;
     sim->saved_solution = NULL;
 
+    // Modified Newton (Jacobian reuse) on by default
+    sim->modified_newton = true;
+    sim->integrator.method = INTEGRATE_GEAR2;
+
+    sim->context.environment.light_level = ENVIRONMENT_DEFAULT_LIGHT;
+    sim->context.environment.temperature = ENVIRONMENT_DEFAULT_TEMPERATURE;
+
+    sim->lu_cache[0].lu = sparse_lu_create();
+    if (!sim->lu_cache[0].lu) {
+        free(sim);
+        return NULL;
+    }
+    sim->lu_cache[0].used = true;
+    sim->lu = sim->lu_cache[0].lu;
+
     return sim;
 }
 
 void simulation_free(Simulation *sim) {
     if (!sim) return;
 
-    if (sim->solution) {
-        vector_free(sim->solution);
-    }
-    if (sim->prev_solution) {
-        vector_free(sim->prev_solution);
-    }
-    if (sim->saved_solution) {
-        vector_free(sim->saved_solution);
+    for (int i = 0; i < LU_CACHE_SIZE; i++) {
+        sparse_lu_free(sim->lu_cache[i].lu);
     }
+    sparse_free(sim->matrix);
+    free(sim->workspace);
 
     free(sim);
 }
@@ -106,19 +136,12 @@ void simulation_reset(Simulation *sim) {
 
     sim->state = SIM_STOPPED;
     sim->time = 0;
+    sim->num_breakpoints = 0;
 
-    if (sim->solution) {
-        vector_free(sim->solution);
-        sim->solution = NULL;
-    }
-    if (sim->prev_solution) {
-        vector_free(sim->prev_solution);
-        sim->prev_solution = NULL;
-    }
-    if (sim->saved_solution) {
-        vector_free(sim->saved_solution);
-        sim->saved_solution = NULL;
-    }
+    // The workspace stays allocated for the next DC analysis
+    sim->solution = NULL;
+    sim->prev_solution = NULL;
+    sim->saved_solution = NULL;
 
     sim->history_count = 0;
     sim->history_start = 0;
@@ -158,6 +181,23 @@ void simulation_reset(Simulation *sim) {
                     comp->props.fuse.blow_time = -1.0;
                     break;
 
+                case COMP_RELAY:
+                    comp->props.relay.energized = false;
+                    comp->props.relay.i_coil = 0.0;
+                    break;
+
+                case COMP_SCR:
+                    comp->props.scr.on = false;
+                    break;
+
+                case COMP_TRIAC:
+                    comp->props.triac.on = false;
+                    break;
+
+                case COMP_555_TIMER:
+                    comp->props.timer_555.output = false;
+                    break;
+
                 case COMP_CAPACITOR:
                 case COMP_CAPACITOR_ELEC:
                     // Reset capacitor voltage
@@ -191,6 +231,430 @@ static void simulation_set_error(Simulation *sim, const char *msg) {
     }
 }
 
+// Give each workspace vector its initial role (steps rotate the solution
+// vectors between roles)
+static void simulation_bind_workspace(Simulation *sim) {
+    sim->rhs = &sim->workspace_vectors[0];
+    sim->solution = NULL;           // Set once DC analysis has a result
+    sim->prev_solution = &sim->workspace_vectors[2];
+    sim->saved_solution = &sim->workspace_vectors[3];
+    sim->trial = &sim->workspace_vectors[4];
+    sim->iterate = &sim->workspace_vectors[5];
+    sim->residual = &sim->workspace_vectors[6];
+    sim->residual_scale = &sim->workspace_vectors[7];
+    sim->past_solution[0] = &sim->workspace_vectors[8];
+    sim->past_solution[1] = &sim->workspace_vectors[9];
+    sim->predictor_points = 0;
+}
+
+// Size the workspace arena for a matrix_size system and point the RHS and
+// solution vectors into it. The block is only reallocated when it grows.
+static bool simulation_alloc_workspace(Simulation *sim, int matrix_size) {
+    int capacity = sim->workspace_vectors[0].size;
+    if (!sim->workspace || matrix_size > capacity) {
+        int n = (matrix_size > 0) ? matrix_size : 1;
+        double *block = solver_realloc(sim->workspace,
+                                       (size_t)n * SIM_WORKSPACE_VECTORS * sizeof(double));
+        if (!block) return false;
+        sim->workspace = block;
+    }
+    memset(sim->workspace, 0, (size_t)matrix_size * SIM_WORKSPACE_VECTORS * sizeof(double));
+
+    for (int i = 0; i < SIM_WORKSPACE_VECTORS; i++) {
+        vector_init(&sim->workspace_vectors[i], sim->workspace + (size_t)i * matrix_size, matrix_size);
+    }
+    simulation_bind_workspace(sim);
+    return true;
+}
+
+// Forget the factors of every switch configuration for a new matrix
+// pattern: entry 0 becomes the active one, and the symbolic analysis is
+// redone on its first solve.
+static void simulation_reset_factors(Simulation *sim) {
+    for (int i = 0; i < LU_CACHE_SIZE; i++) {
+        LUCacheEntry *entry = &sim->lu_cache[i];
+        if (entry->lu) sparse_lu_invalidate(entry->lu);
+        entry->used = (i == 0);
+        entry->topology = 0;
+        entry->last_use = 0;
+    }
+
+    sim->lu_active = 0;
+    sim->lu = sim->lu_cache[0].lu;
+    sim->lu_cache_clock = 0;
+    sim->lu_cache_hits = 0;
+    sim->lu_cache_misses = 0;
+}
+
+// Switch configuration: one bit per ideal switch, in component order. Past
+// 64 switches bits are shared, which only makes configurations share an
+// LU cache entry.
+static uint64_t simulation_switch_topology(Simulation *sim) {
+    Circuit *circuit = sim->circuit;
+    uint64_t topology = 0;
+    int bit = 0;
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        if (!comp->ideal_switch) continue;
+        if (component_ideal_switch_on(comp)) topology ^= (uint64_t)1 << (bit % 64);
+        bit++;
+    }
+    return topology;
+}
+
+// Point lu at the LU cache entry of the current switch
+// configuration, taking the unused or least recently used entry for one not
+// seen before. The entry only narrows the search: every solve still compares
+// the matrix with the one its factors came from, so a shared or stale entry
+// (a new dt since it was factored) costs a refactor, never a wrong solution.
+static bool simulation_select_factors(Simulation *sim) {
+    if (sim->num_ideal_switches == 0) return true;
+
+    uint64_t topology = simulation_switch_topology(sim);
+    LUCacheEntry *entry = &sim->lu_cache[sim->lu_active];
+    entry->last_use = ++sim->lu_cache_clock;
+    if (entry->topology == topology) return true;
+
+    int slot = -1;
+    for (int i = 0; i < LU_CACHE_SIZE; i++) {
+        if (sim->lu_cache[i].used && sim->lu_cache[i].topology == topology) {
+            slot = i;
+            break;
+        }
+    }
+
+    if (slot >= 0) {
+        sim->lu_cache_hits++;
+    } else {
+        sim->lu_cache_misses++;
+        slot = 0;
+        for (int i = 1; i < LU_CACHE_SIZE; i++) {
+            const LUCacheEntry *e = &sim->lu_cache[i];
+            const LUCacheEntry *best = &sim->lu_cache[slot];
+            if (best->used && (!e->used || e->last_use < best->last_use)) slot = i;
+        }
+
+        // Storage is allocated the first time an entry is taken
+        entry = &sim->lu_cache[slot];
+        if (!entry->lu) entry->lu = sparse_lu_create();
+        if (!entry->lu) return false;
+        entry->used = true;
+        entry->topology = topology;
+    }
+
+    entry = &sim->lu_cache[slot];
+    entry->last_use = ++sim->lu_cache_clock;
+    sim->lu_active = slot;
+    sim->lu = entry->lu;
+
+    // The Jacobian age and coefficient tracked the previous entry's factors
+    sim->jacobian_ag0 = 0;
+    return true;
+}
+
+// Allocate the MNA system for a new topology and resolve every component's
+// matrix indices. Subcircuit instances get consecutive private blocks after
+// the voltage variables (block_sizes[i] entries for component i).
+static bool simulation_compile(Simulation *sim, int matrix_size, int first_block,
+                               const int *block_sizes) {
+    Circuit *circuit = sim->circuit;
+
+    sparse_free(sim->matrix);
+    sim->matrix = sparse_create(matrix_size, 0);
+    if (!sim->matrix || !simulation_alloc_workspace(sim, matrix_size)) return false;
+
+    simulation_reset_factors(sim);
+
+    // No channel has been broadcast on by this circuit yet
+    memset(&sim->context.wireless, 0, sizeof(sim->context.wireless));
+
+    int next_block = first_block;
+    sim->first_block = first_block;
+    sim->linear_circuit = true;
+    sim->num_ideal_switches = 0;
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        component_setup(comp, circuit->node_map);
+        if (component_set_ideal_switch(comp, sim->ideal_switches)) sim->num_ideal_switches++;
+        if (!component_is_linear(comp)) sim->linear_circuit = false;
+        comp->stamp_first = 0;
+        comp->subcircuit_base = next_block + 1;  // Matrix nodes are 1-based
+        next_block += block_sizes[i];
+    }
+    sim->gmin_first = 0;
+    sim->num_compiled_components = circuit->num_components;
+    sim->lu_cache[0].topology = simulation_switch_topology(sim);
+    return true;
+}
+
+// Integration coefficients for a step of dt (see Integrator). The
+// second-order methods need one step of history, so the DC operating point
+// and the first step after it use backward Euler, as does the first step
+// after a breakpoint. Gear-2 allows the step to differ from the previous one.
+static void simulation_integrator_setup(Integrator *integ, double dt) {
+    integ->dt = dt;
+    integ->order = (integ->method == INTEGRATE_EULER || integ->points < 2 ||
+                    integ->restart) ? 1 : 2;
+    integ->ag[2] = 0;
+    integ->ab1 = 0;
+
+    if (integ->order == 1) {
+        integ->ag[0] = 1.0 / dt;
+        integ->ag[1] = -1.0 / dt;
+    } else if (integ->method == INTEGRATE_TRAPEZOIDAL) {
+        integ->ag[0] = 2.0 / dt;
+        integ->ag[1] = -2.0 / dt;
+        integ->ab1 = -1.0;
+    } else {
+        double h1 = integ->dt_prev;
+        integ->ag[0] = (2.0 * dt + h1) / (dt * (dt + h1));
+        integ->ag[1] = -(dt + h1) / (dt * h1);
+        integ->ag[2] = dt / (h1 * (dt + h1));
+    }
+}
+
+// Record an accepted solution (a time step of dt, or the DC operating point
+// with dt = 0) in the integration history of every component and commit
+// the device states it implies. Returns true if a device switched.
+static bool simulation_accept(Simulation *sim, double dt) {
+    Circuit *circuit = sim->circuit;
+    bool switched = false;
+
+    // TX antennas broadcast the accepted voltages for the next step's loads
+    memset(&sim->context.wireless, 0, sizeof(sim->context.wireless));
+
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        if (component_accept_step(comp, sim->solution, circuit->num_matrix_nodes,
+                                  sim->time + dt, dt, &sim->context)) {
+            switched = true;
+        }
+    }
+    sim->integrator.dt_prev2 = sim->integrator.dt_prev;
+    sim->integrator.dt_prev = dt;
+    sim->integrator.restart = false;
+    if (sim->integrator.points < 3) sim->integrator.points++;
+
+    // The solution this step started from (left in sim->trial by the swap
+    // before the accept) moves into the predictor history
+    if (dt > 0) {
+        Vector *oldest = sim->past_solution[1];
+        sim->past_solution[1] = sim->past_solution[0];
+        sim->past_solution[0] = sim->trial;
+        sim->trial = oldest;
+        if (sim->predictor_points < 3) sim->predictor_points++;
+    } else {
+        sim->predictor_points = 1;
+    }
+    return switched;
+}
+
+// Discard a step attempt: devices return to the state of the last accepted
+// step before it is retried
+static void simulation_reject(Simulation *sim) {
+    Circuit *circuit = sim->circuit;
+    for (int i = 0; i < circuit->num_components; i++) {
+        component_reject_step(circuit->components[i]);
+    }
+}
+
+// Load the MNA system at the given operating point. The first load after
+// simulation_compile records the stamp sequence and compiles it into handles;
+// later loads write through the handles. Each component's first handle is
+// restored before it stamps so that one component changing its stamp branch
+// only costs lookups for its own entries.
+static bool simulation_load(Simulation *sim, double time, Vector *solution,
+                            Vector *history) {
+    Circuit *circuit = sim->circuit;
+    SparseMatrix *A = sim->matrix;
+    int num_nodes = circuit->num_matrix_nodes;
+    bool recording = !A->compiled;
+
+    sparse_begin_load(A);
+    vector_zero(sim->rhs);
+
+    sim->newton_limited = false;
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        if (recording) {
+            comp->stamp_first = sparse_get_cursor(A);
+        } else {
+            sparse_set_cursor(A, comp->stamp_first);
+        }
+        component_stamp(comp, A, sim->rhs, num_nodes, time, solution, history,
+                        &sim->integrator, &sim->context);
+        if (comp->limit.limited) sim->newton_limited = true;
+    }
+
+    // Add GMIN (minimum conductance) from each node to ground
+    // This stabilizes floating nodes and prevents singular matrices
+    if (recording) {
+        sim->gmin_first = sparse_get_cursor(A);
+    } else {
+        sparse_set_cursor(A, sim->gmin_first);
+    }
+    for (int i = 0; i < num_nodes; i++) {
+        sparse_add(A, i, i, GMIN);
+    }
+
+    return sparse_end_load(A);
+}
+
+// Solve the assembled MNA system. The symbolic analysis is only redone when
+// the matrix pattern changes, and the previous pivot sequence is reused
+// (numeric refactor) unless one of its pivots has become too small. If the
+// matrix is unchanged since the last factorization - every step of a linear
+// circuit at a fixed dt - the factors are reused as they are. Comparing the
+// values also catches changes that bypass the modified flag (a switch
+// toggled while running, a new dt, the ambient temperature).
+static bool simulation_lu_solve(Simulation *sim, SparseMatrix *A, Vector *b, Vector *x) {
+    if (!A->compiled && !sparse_compress(A)) return false;
+
+    if (sparse_lu_values_match(sim->lu, A)) {
+        sim->lu->reuse_count++;
+    } else {
+        if (!sparse_lu_pattern_matches(sim->lu, A)) {
+            if (!sparse_lu_analyze(sim->lu, A)) return false;
+        }
+        if (!sparse_lu_refactor(sim->lu, A) && !sparse_lu_factor(sim->lu, A)) {
+            return false;
+        }
+    }
+
+    return sparse_lu_solve(sim->lu, b, x);
+}
+
+// Total factorizations so far (full and refactor); their difference
+// over a step gives the per-step count
+static int simulation_factor_total(Simulation *sim) {
+    int total = 0;
+    for (int i = 0; i < LU_CACHE_SIZE; i++) {
+        const LUCacheEntry *entry = &sim->lu_cache[i];
+        if (entry->lu) total += entry->lu->factor_count + entry->lu->refactor_count;
+    }
+    return total;
+}
+
+// Whether reusing the current factors can pay off: a refactor (its
+// multiply-adds plus writing the factors) against what each extra iteration
+// costs, a load of every stamp, a residual and a pair of triangular solves.
+static bool simulation_reuse_pays(Simulation *sim, SparseMatrix *A) {
+    const SparseLU *lu = sim->lu;
+    double refactor = lu->refactor_ops + lu->fill_nnz;
+    double iteration = A->num_handles + 2.0 * A->nnz + lu->fill_nnz;
+    return refactor >= NEWTON_REUSE_COST_RATIO * iteration;
+}
+
+// Modified Newton update with the sparse factors of an earlier Jacobian:
+// x = x_prev + LU^-1 (b - A x_prev), with A and b freshly loaded at x_prev.
+// Converges to the same solution as full Newton, at a linear rate.
+static bool simulation_modified_solve(Simulation *sim, SparseMatrix *A, Vector *b,
+                                      Vector *x_prev, Vector *x) {
+    if (!sparse_residual(A, x_prev, b, sim->residual) ||
+        !sparse_lu_solve(sim->lu, sim->residual, x)) {
+        return false;
+    }
+
+    for (int i = 0; i < x->size; i++) {
+        x->data[i] += x_prev->data[i];
+    }
+    return true;
+}
+
+// Damped Newton: called after loading the system at a new iterate
+// (sim->trial). If the full update increased the largest residual entry
+// compared with the previous iterate (sim->iterate), the trial is pulled
+// back halfway and true is returned so the caller reloads instead of
+// solving. A load that limited a junction voltage has the residual of its
+// limited linearization rather than of the circuit, so it is not compared.
+static bool simulation_damp_update(Simulation *sim, double *prev_norm, int *backtracks) {
+    double norm = INFINITY;
+    if (!sim->newton_limited &&
+        sparse_residual(sim->matrix, sim->trial, sim->rhs, sim->residual)) {
+        norm = 0;
+        for (int i = 0; i < sim->residual->size; i++) {
+            double r = fabs(sim->residual->data[i]);
+            if (r > norm) norm = r;
+        }
+    }
+
+    // Below the floor the residual is rounding noise and says nothing about
+    // the direction of the update
+    if (norm > *prev_norm && norm > NEWTON_DAMP_FLOOR &&
+        *backtracks < NEWTON_MAX_BACKTRACKS) {
+        Vector *x = sim->trial;
+        Vector *x_prev = sim->iterate;
+        for (int i = 0; i < x->size; i++) {
+            x->data[i] = 0.5 * (x->data[i] + x_prev->data[i]);
+        }
+        (*backtracks)++;
+        return true;
+    }
+
+    *prev_norm = norm;
+    *backtracks = 0;
+    return false;
+}
+
+static void simulation_swap_vectors(Vector **a, Vector **b) {
+    Vector *t = *a;
+    *a = *b;
+    *b = t;
+}
+
+// Convergence of the Newton update from x_old to x_new, per unknown: node
+// voltages within reltol + vntol, branch currents within reltol + abstol.
+// Subcircuit blocks mix both and are held to vntol.
+static bool simulation_update_converged(Simulation *sim, const Vector *x_new,
+                                        const Vector *x_old) {
+    int num_nodes = sim->circuit->num_matrix_nodes;
+    double reltol = sim->lte.reltol;
+    for (int i = 0; i < x_new->size; i++) {
+        double a = x_new->data[i];
+        double b = x_old->data[i];
+        bool current = i >= num_nodes && i < sim->first_block;
+        double tol = reltol * fmax(fabs(a), fabs(b)) + (current ? sim->lte.abstol : sim->vntol);
+        if (fabs(a - b) > tol) return false;
+    }
+    return true;
+}
+
+// Residual half of the convergence test, for the load at sim->trial with
+// sim->residual = b - Ax already computed: every equation must hold to
+// within reltol of its largest term, plus abstol for the node equations
+// (currents) and vntol for the branch equations (voltages)
+static bool simulation_residual_converged(Simulation *sim) {
+    if (!sparse_residual_scale(sim->matrix, sim->trial, sim->rhs, sim->residual_scale)) {
+        return false;
+    }
+    int num_nodes = sim->circuit->num_matrix_nodes;
+    double reltol = sim->lte.reltol;
+    for (int i = 0; i < sim->residual->size; i++) {
+        double tol = reltol * sim->residual_scale->data[i] +
+                     ((i < num_nodes) ? sim->lte.abstol : sim->vntol);
+        if (fabs(sim->residual->data[i]) > tol) return false;
+    }
+    return true;
+}
+
+// Largest change between two Newton iterates
+static double simulation_max_change(Vector *a, Vector *b) {
+    double max_diff = 0;
+    for (int i = 0; i < a->size; i++) {
+        double diff = fabs(a->data[i] - b->data[i]);
+        if (diff > max_diff) max_diff = diff;
+    }
+    return max_diff;
+}
+
+// True if every entry of the vector is a finite number
+static bool simulation_vector_finite(const Vector *v) {
+    for (int i = 0; i < v->size; i++) {
+        if (!isfinite(v->data[i])) return false;
+    }
+    return true;
+}
+
 // NOTE: The BFS function nodes_connected_via_wires was removed because it caused
 // false positives in short circuit detection for parallel resistor circuits.
 // The union-find based node_map check is sufficient and more accurate.
@@ -357,6 +821,148 @@ static bool simulation_detect_excessive_current(Simulation *sim) {
     return sim->has_short_circuit;
 }
 
+// Newton iteration of the DC operating point from the guess in sim->trial,
+// with the integrator set up for DC by the caller. The result is left in
+// sim->trial. Returns false if the load or solve failed (error set);
+// *converged tells whether the iteration converged.
+static bool simulation_dc_newton(Simulation *sim, bool *converged) {
+    *converged = false;
+    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+        // Stamp all components
+        if (!simulation_load(sim, 0, sim->trial, sim->trial)) {
+            simulation_set_error(sim, "Memory allocation failed");
+            return false;
+        }
+        sim->dc_iteration_count++;
+
+        // Check convergence (not while junction limiting is still
+        // active): the load must satisfy the equations at this iterate
+        // and the update from it must pass the per-unknown test
+        bool balanced = !sim->newton_limited &&
+                        sparse_residual(sim->matrix, sim->trial, sim->rhs, sim->residual) &&
+                        simulation_residual_converged(sim);
+
+        // Solve
+        simulation_swap_vectors(&sim->trial, &sim->iterate);
+        if (!simulation_lu_solve(sim, sim->matrix, sim->rhs, sim->trial)) {
+            simulation_set_error(sim, "Matrix solver failed");
+            return false;
+        }
+
+        // A linear system is solved exactly by one pass
+        if (sim->linear_circuit) {
+            *converged = true;
+            break;
+        }
+
+        if (balanced && simulation_update_converged(sim, sim->trial, sim->iterate)) {
+            *converged = true;
+            break;
+        }
+    }
+    return true;
+}
+
+// Operating point of the compiled system from the initial guess in
+// sim->trial (the trial and iterate vectors swap roles after every solve),
+// committed as the accepted solution
+static bool simulation_solve_dc(Simulation *sim) {
+    Circuit *circuit = sim->circuit;
+    bool converged = false;
+
+    // Use large dt for DC analysis so capacitors → open circuit, inductors → short circuit
+    sim->integrator.points = 0;
+    simulation_integrator_setup(&sim->integrator, 1e9);
+    sim->dc_iteration_count = 0;
+
+    // Ideal switches: commit the states the operating point implies and
+    // solve again until they agree with it
+    for (int pass = 0; pass < IDEAL_SWITCH_MAX_DC_PASSES; pass++) {
+        if (!simulation_select_factors(sim)) {
+            simulation_set_error(sim, "Memory allocation failed");
+            return false;
+        }
+
+        if (!simulation_dc_newton(sim, &converged)) {
+            return false;
+        }
+
+        bool switched = false;
+        for (int i = 0; i < circuit->num_components && sim->num_ideal_switches > 0; i++) {
+            Component *comp = circuit->components[i];
+            if (comp->ideal_switch &&
+                component_event_commit(comp, sim->trial, circuit->num_matrix_nodes, 0, 0)) {
+                switched = true;
+            }
+        }
+        if (!switched) break;
+    }
+
+    // The factors now belong to the DC matrix: the first time step refactors
+    sim->jacobian_ag0 = 0;
+
+    if (!converged) {
+        // Still use the solution, but warn
+        simulation_set_error(sim, "Warning: solution may not have converged");
+    }
+
+    // Store solution
+    Vector *solution = &sim->workspace_vectors[1];
+    vector_copy(solution, sim->trial);
+    vector_copy(sim->prev_solution, solution);
+    sim->solution = solution;
+    simulation_accept(sim, 0);
+
+    // Update circuit voltages and wire currents
+    circuit_update_voltages(circuit, solution);
+    circuit_update_wire_currents(circuit);
+    circuit_update_meter_readings(circuit);
+
+    // Check for excessive current indicating short circuit (after meter readings updated)
+    if (simulation_detect_excessive_current(sim)) {
+        simulation_set_error(sim, "Short circuit: excessive current (>100A) detected!");
+        return false;
+    }
+
+    // Check for open circuit current sources (excessive voltage)
+    if (simulation_detect_open_current_source(sim)) {
+        simulation_set_error(sim, "Open circuit: current source has no load path!");
+        return false;
+    }
+
+    sim->has_error = false;
+    return true;
+}
+
+bool simulation_dc_resolve(Simulation *sim, const Vector *guess) {
+    if (!sim || !sim->circuit) {
+        simulation_set_error(sim, "No circuit");
+        return false;
+    }
+
+    Circuit *circuit = sim->circuit;
+    if (!sim->matrix || !sim->matrix->compiled ||
+        circuit->num_components != sim->num_compiled_components) {
+        return simulation_dc_analysis(sim);
+    }
+
+    // Same matrix indices; forget the device caches and integration history
+    // of the previous operating point
+    for (int i = 0; i < circuit->num_components; i++) {
+        component_setup(circuit->components[i], circuit->node_map);
+    }
+
+    // Initial guess in the vector that becomes the trial
+    Vector *trial = &sim->workspace_vectors[4];
+    if (guess && guess->size == trial->size) {
+        vector_copy(trial, guess);
+    } else {
+        vector_zero(trial);
+    }
+    simulation_bind_workspace(sim);
+    return simulation_solve_dc(sim);
+}
+
 bool simulation_dc_analysis(Simulation *sim) {
     if (!sim || !sim->circuit) {
         simulation_set_error(sim, "No circuit");
@@ -414,232 +1020,323 @@ bool simulation_dc_analysis(Simulation *sim) {
     }
 
     // Count subcircuit internal nodes needed
-    // Each subcircuit instance needs space for internal nodes not exposed as pins
+    // Each subcircuit instance needs a private block for its internal nodes
+    // (not exposed as pins) and the branch currents of its internal sources
+    int block_sizes[MAX_COMPONENTS];
     int num_subcircuit_internal = 0;
     for (int i = 0; i < circuit->num_components; i++) {
         Component *comp = circuit->components[i];
+        block_sizes[i] = 0;
         if (comp->type == COMP_SUBCIRCUIT) {
             // Find the definition
             for (int d = 0; d < g_subcircuit_library.count; d++) {
                 if (g_subcircuit_library.defs[d].id == comp->props.subcircuit.def_id) {
-                    int max_internal = subcircuit_count_internal_nodes(&g_subcircuit_library.defs[d]);
-                    num_subcircuit_internal += max_internal + 1;  // +1 for safety
+                    SubCircuitDef *def = &g_subcircuit_library.defs[d];
+                    int max_internal = subcircuit_count_internal_nodes(def);
+                    block_sizes[i] = max_internal + 1 + subcircuit_count_voltage_vars(def);
                     break;
                 }
             }
         }
+        num_subcircuit_internal += block_sizes[i];
     }
 
     int matrix_size = num_nodes + num_volt_vars + num_subcircuit_internal;
     sim->solution_size = matrix_size;
 
-    // Store base offset for subcircuit internal nodes (after voltage variables)
-    g_subcircuit_internal_node_offset = num_nodes + num_volt_vars;
-
-    // Iterative solution for nonlinear components
-    Vector *solution = vector_create(matrix_size);
-    if (!solution) {
+    // Resolve component nodes and set up the persistent MNA system
+    if (!simulation_compile(sim, matrix_size, num_nodes + num_volt_vars, block_sizes)) {
         simulation_set_error(sim, "Memory allocation failed");
         return false;
     }
 
-    bool converged = false;
+    // Iterative solution for nonlinear components, starting from zero
+    return simulation_solve_dc(sim);
+}
 
-    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
-        Matrix *A = matrix_create(matrix_size, matrix_size);
-        Vector *b = vector_create(matrix_size);
+// Initial Newton guess for a step of dt: the polynomial through the last
+// accepted solutions, evaluated at the end of the step with the actual step
+// history. Its order follows the integration order (linear after backward
+// Euler, quadratic with Gear-2 and trapezoidal) and is limited by the
+// points accepted since the last discontinuity. Linear circuits need no
+// guess and start from the accepted solution.
+static void simulation_predict(Simulation *sim, double dt, Vector *x) {
+    const Integrator *integ = &sim->integrator;
+    int order = MIN(sim->predictor_points - 1, integ->order);
+    if (sim->linear_circuit || order <= 0 || integ->dt_prev <= 0) {
+        vector_copy(x, sim->solution);
+        return;
+    }
 
-        if (!A || !b) {
-            matrix_free(A);
-            vector_free(b);
-            vector_free(solution);
-            simulation_set_error(sim, "Memory allocation failed");
-            return false;
+    const double *x0 = sim->solution->data;
+    const double *x1 = sim->past_solution[0]->data;
+    double h1 = integ->dt_prev;
+    if (order == 1 || integ->dt_prev2 <= 0) {
+        double c = dt / h1;
+        for (int i = 0; i < x->size; i++) {
+            x->data[i] = x0[i] + c * (x0[i] - x1[i]);
         }
+        return;
+    }
 
-        // Clear wireless state for antenna TX/RX pairs
-        memset(&g_wireless, 0, sizeof(g_wireless));
+    // Lagrange weights of the points at 0, -h1 and -(h1 + h2) for time dt
+    const double *x2 = sim->past_solution[1]->data;
+    double h2 = integ->dt_prev2;
+    double l0 = (dt + h1) * (dt + h1 + h2) / (h1 * (h1 + h2));
+    double l1 = -dt * (dt + h1 + h2) / (h1 * h2);
+    double l2 = dt * (dt + h1) / (h2 * (h1 + h2));
+    for (int i = 0; i < x->size; i++) {
+        x->data[i] = l0 * x0[i] + l1 * x1[i] + l2 * x2[i];
+    }
+}
 
-        // Reset subcircuit internal node offset for this iteration
-        // (subcircuit stamping increments this, so we must reset each pass)
-        g_subcircuit_internal_node_offset = num_nodes + num_volt_vars;
+// Newton-Raphson solve of one time step, starting from the predicted
+// solution (simulation_predict), with the sources evaluated at source_time
+// (the end of the step). The result is left in sim->trial; returns false on
+// failure. The step has converged when the load at an iterate satisfies
+// the equations (simulation_residual_converged) and the update solved from
+// it passes the per-unknown test; the update is then taken.
+//
+// In modified Newton mode the sparse LU factors of an earlier iteration, or
+// of the previous step at the same dt, are reused as long as the updates keep
+// shrinking: by NEWTON_REFACTOR_RATE per iteration, and for the first update
+// of a step relative to the first update of the previous one. An update that
+// fails the test is discarded and redone as a full Newton step on the matrix
+// already loaded, so a device switching on cannot throw the iterate off.
+// Reuse is only tried where the factorization is expensive next to an
+// iteration (simulation_reuse_pays); elsewhere every iteration refactors.
+//
+// Updates are damped (simulation_damp_update) so that a full Newton step
+// which makes the residual worse is halved instead of taken.
+static bool simulation_solve_step(Simulation *sim, double dt, double source_time) {
+    SparseMatrix *A = sim->matrix;
+    double prev_change = 0;
+    double prev_norm = INFINITY;
+    int backtracks = 0;
+
+    Integrator *integ = &sim->integrator;
+    simulation_integrator_setup(integ, dt);
+    if (!simulation_select_factors(sim)) return false;
+
+    simulation_predict(sim, dt, sim->trial);
+    sim->converged = false;
 
-        // Stamp all components
-        // Use large dt for DC analysis so capacitors → open circuit, inductors → short circuit
-        double dc_dt = 1e9;  // Very large dt for steady-state DC behavior
-        for (int i = 0; i < circuit->num_components; i++) {
-            component_stamp(circuit->components[i], A, b,
-                           circuit->node_map, num_nodes,
-                           0, solution, dc_dt);
+    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
+        // Stamp components: reactive companion models integrate from the
+        // accepted history, not from the Newton iterate
+        if (!simulation_load(sim, source_time, sim->trial, sim->solution)) {
+            return false;
         }
-
-        // Add GMIN (minimum conductance) from each node to ground
-        // This stabilizes floating nodes and prevents singular matrices
-        for (int i = 0; i < num_nodes; i++) {
-            matrix_add(A, i, i, GMIN);
+        sim->iteration_count++;
+        if (!sim->linear_circuit && simulation_damp_update(sim, &prev_norm, &backtracks)) {
+            continue;
         }
 
-        // Solve
-        Vector *new_solution = linear_solve(A, b);
-        matrix_free(A);
-        vector_free(b);
-
-        if (!new_solution) {
-            vector_free(solution);
-            simulation_set_error(sim, "Matrix solver failed");
-            return false;
+        // The damping check left the residual of this load in sim->residual
+        bool balanced = !sim->linear_circuit && !sim->newton_limited &&
+                        simulation_residual_converged(sim);
+        simulation_swap_vectors(&sim->trial, &sim->iterate);
+
+        // A matrix identical to the factored one is a full Newton step for free
+        bool reuse = sim->modified_newton && !sim->linear_circuit &&
+                     simulation_reuse_pays(sim, A) &&
+                     !A->pattern_changed && sim->jacobian_ag0 == integ->ag[0] &&
+                     sim->jacobian_age < NEWTON_MAX_REUSE &&
+                     sim->lu->factored && !sparse_lu_values_match(sim->lu, A);
+
+        double change = 0;
+        if (reuse) {
+            if (!simulation_modified_solve(sim, A, sim->rhs, sim->iterate, sim->trial)) {
+                return false;
+            }
+            change = simulation_max_change(sim->trial, sim->iterate);
+            double limit = (iter > 0) ? NEWTON_REFACTOR_RATE * prev_change
+                                      : NEWTON_FIRST_UPDATE_RATIO * sim->newton_first_change;
+            reuse = change <= limit;
         }
 
-        // Check convergence
-        double max_diff = 0;
-        for (int i = 0; i < matrix_size; i++) {
-            double diff = fabs(vector_get(new_solution, i) - vector_get(solution, i));
-            if (diff > max_diff) max_diff = diff;
+        if (reuse) {
+            sim->jacobian_age++;
+        } else {
+            if (!simulation_lu_solve(sim, A, sim->rhs, sim->trial)) {
+                return false;
+            }
+            sim->jacobian_ag0 = integ->ag[0];
+            sim->jacobian_age = 0;
+            change = simulation_max_change(sim->trial, sim->iterate);
         }
-
-        vector_free(solution);
-        solution = new_solution;
-
-        if (max_diff < CONVERGENCE_TOL) {
-            converged = true;
-            break;
+        if (iter == 0) {
+            sim->newton_first_change = change;
         }
-    }
-
-    if (!converged) {
-        // Still use the solution, but warn
-        simulation_set_error(sim, "Warning: solution may not have converged");
-    }
-
-    // Store solution
-    if (sim->solution) vector_free(sim->solution);
-    if (sim->prev_solution) vector_free(sim->prev_solution);
-
-    sim->solution = solution;
-    sim->prev_solution = vector_clone(solution);
-
-    // Update circuit voltages and wire currents
-    circuit_update_voltages(circuit, solution);
-    circuit_update_wire_currents(circuit);
-    circuit_update_meter_readings(circuit);
-
-    // Check for excessive current indicating short circuit (after meter readings updated)
-    if (simulation_detect_excessive_current(sim)) {
-        simulation_set_error(sim, "Short circuit: excessive current (>100A) detected!");
-        return false;
-    }
 
-    // Check for open circuit current sources (excessive voltage)
-    if (simulation_detect_open_current_source(sim)) {
-        simulation_set_error(sim, "Open circuit: current source has no load path!");
-        return false;
+        // A linear system is solved exactly by one pass; there is nothing
+        // for a second iteration to confirm
+        if (sim->linear_circuit) {
+            sim->converged = true;
+            break;
+        }
+
+        // Check convergence. A first update on reused factors has no
+        // contraction rate yet, so it cannot confirm convergence by itself,
+        // and neither can a load whose junction voltages were limited.
+        if (balanced && !(reuse && iter == 0) &&
+            simulation_update_converged(sim, sim->trial, sim->iterate)) {
+            sim->converged = true;
+            break;
+        }
+        prev_change = change;
     }
 
-    sim->has_error = false;
     return true;
 }
 
-// Helper function to perform a single Newton-Raphson solve iteration
-// Returns the new solution vector, or NULL on failure
-static Vector *simulation_solve_step(Simulation *sim, double dt) {
+// Largest step the local truncation error of the step just solved allows:
+// the minimum over all reactive states (INFINITY if the circuit has none)
+static double simulation_truncation_step(Simulation *sim, Vector *new_solution) {
     Circuit *circuit = sim->circuit;
-    int num_nodes = circuit->num_matrix_nodes;
-    int matrix_size = sim->solution_size;
-
-    Vector *current_solution = vector_clone(sim->solution);
-    if (!current_solution) return NULL;
-
-    for (int iter = 0; iter < MAX_ITERATIONS; iter++) {
-        Matrix *A = matrix_create(matrix_size, matrix_size);
-        Vector *b = vector_create(matrix_size);
-
-        if (!A || !b) {
-            matrix_free(A);
-            vector_free(b);
-            vector_free(current_solution);
-            return NULL;
-        }
+    double dt_max = INFINITY;
+    for (int i = 0; i < circuit->num_components; i++) {
+        double step = component_truncation_step(circuit->components[i], new_solution,
+                                                 &sim->integrator, &sim->lte);
+        if (step < dt_max) dt_max = step;
+    }
+    return dt_max;
+}
 
-        // Clear wireless state for antenna TX/RX pairs
-        memset(&g_wireless, 0, sizeof(g_wireless));
+// Earliest zero crossing of a device guard inside the step just solved, as
+// a fraction of the step (1 if no guard crosses). The guard is taken as
+// linear over the step, so redoing the step up to the estimate is a secant
+// iteration on the crossing time.
+static double simulation_locate_event(Simulation *sim, double dt) {
+    Circuit *circuit = sim->circuit;
+    int num_nodes = circuit->num_matrix_nodes;
+    double theta = 1.0;
 
-        // Reset subcircuit internal node offset for this iteration
-        // Count voltage variables to compute base offset
-        int num_volt_vars = 0;
-        for (int i = 0; i < circuit->num_components; i++) {
-            if (circuit->components[i]->needs_voltage_var) {
-                num_volt_vars++;
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *comp = circuit->components[i];
+        double g0[MAX_EVENT_GUARDS], g1[MAX_EVENT_GUARDS];
+        int count = component_event_guards(comp, sim->solution, num_nodes, 0, g0);
+        if (count == 0) continue;
+        component_event_guards(comp, sim->trial, num_nodes, dt, g1);
+
+        for (int k = 0; k < count; k++) {
+            if (g0[k] < 0 && g1[k] >= 0) {
+                double t = g0[k] / (g0[k] - g1[k]);
+                if (t < theta) theta = t;
             }
         }
-        g_subcircuit_internal_node_offset = num_nodes + num_volt_vars;
+    }
+    return theta;
+}
 
-        // Stamp components
-        for (int i = 0; i < circuit->num_components; i++) {
-            component_stamp(circuit->components[i], A, b,
-                           circuit->node_map, num_nodes,
-                           sim->time, current_solution, dt);
-        }
+bool simulation_add_breakpoint(Simulation *sim, double time) {
+    if (!sim || time <= sim->time + BREAKPOINT_RESOLUTION) return false;
 
-        // Add GMIN (minimum conductance) from each node to ground
-        for (int i = 0; i < num_nodes; i++) {
-            matrix_add(A, i, i, GMIN);
-        }
+    int pos = sim->num_breakpoints;
+    while (pos > 0 && sim->breakpoints[pos - 1] > time) pos--;
 
-        Vector *new_solution = linear_solve(A, b);
-        matrix_free(A);
-        vector_free(b);
+    // Already scheduled (sources publish the same edge every step)
+    if (pos > 0 && time - sim->breakpoints[pos - 1] <= BREAKPOINT_RESOLUTION) return true;
+    if (pos < sim->num_breakpoints &&
+        sim->breakpoints[pos] - time <= BREAKPOINT_RESOLUTION) return true;
 
-        if (!new_solution) {
-            vector_free(current_solution);
-            return NULL;
-        }
+    if (sim->num_breakpoints == MAX_BREAKPOINTS) return false;
+    memmove(&sim->breakpoints[pos + 1], &sim->breakpoints[pos],
+            (sim->num_breakpoints - pos) * sizeof(double));
+    sim->breakpoints[pos] = time;
+    sim->num_breakpoints++;
+    return true;
+}
 
-        // Check convergence
-        double max_diff = 0;
-        for (int i = 0; i < matrix_size; i++) {
-            double diff = fabs(vector_get(new_solution, i) - vector_get(current_solution, i));
-            if (diff > max_diff) max_diff = diff;
-        }
+// Drop the breakpoints that have been reached and queue the next edge of
+// every source. Asking each step keeps the queue right when a source's
+// parameters are edited while the simulation runs.
+static void simulation_schedule_breakpoints(Simulation *sim) {
+    int passed = 0;
+    while (passed < sim->num_breakpoints &&
+           sim->breakpoints[passed] <= sim->time + BREAKPOINT_RESOLUTION) {
+        passed++;
+    }
+    if (passed > 0) {
+        sim->num_breakpoints -= passed;
+        memmove(sim->breakpoints, sim->breakpoints + passed,
+                sim->num_breakpoints * sizeof(double));
+    }
 
-        vector_free(current_solution);
-        current_solution = new_solution;
+    Circuit *circuit = sim->circuit;
+    for (int i = 0; i < circuit->num_components; i++) {
+        double t = component_next_breakpoint(circuit->components[i], sim->time);
+        if (!isinf(t)) simulation_add_breakpoint(sim, t);
+    }
+}
 
-        if (max_diff < CONVERGENCE_TOL) {
-            break;
+// Longest step the sources allow. Between its breakpoints a square wave,
+// clock, PWM or pulse source is constant, so only the truncation error
+// limits the step there. Sources that keep changing between breakpoints
+// (which the truncation error does not see), noise included, hold it to the
+// nominal step.
+static double simulation_source_step_limit(Simulation *sim) {
+    Circuit *circuit = sim->circuit;
+    for (int i = 0; i < circuit->num_components; i++) {
+        Component *c = circuit->components[i];
+        switch (c->type) {
+            case COMP_AC_VOLTAGE:
+            case COMP_AC_CURRENT:
+            case COMP_TRIANGLE_WAVE:
+            case COMP_SAWTOOTH_WAVE:
+            case COMP_PWL_SOURCE:
+            case COMP_EXPR_SOURCE:
+            case COMP_NOISE_SOURCE:
+                return sim->dt_target;
+            case COMP_SQUARE_WAVE:
+                if (c->props.square_wave.frequency_sweep.enabled ||
+                    c->props.square_wave.amplitude_sweep.enabled) {
+                    return sim->dt_target;
+                }
+                break;
+            default:
+                break;
         }
     }
-
-    return current_solution;
+    return MAX_TIME_STEP;
 }
 
-// Estimate the local truncation error based on change in solution
-// Returns the maximum relative change across all node voltages
-static double simulation_estimate_error(Simulation *sim, Vector *new_solution) {
-    if (!sim->prev_solution || !new_solution) return 0.0;
-
-    int matrix_size = sim->solution_size;
-    double max_rel_change = 0.0;
+// Highest frequency of the periodic sources in the circuit (0 if none)
+static double simulation_source_frequency(Simulation *sim) {
+    double max_freq = 0;
 
-    for (int i = 0; i < matrix_size; i++) {
-        double old_val = vector_get(sim->prev_solution, i);
-        double new_val = vector_get(new_solution, i);
-        double change = fabs(new_val - old_val);
+    for (int i = 0; i < sim->circuit->num_components; i++) {
+        Component *c = sim->circuit->components[i];
+        if (!c) continue;
 
-        // Use relative error with a minimum reference to avoid division by near-zero
-        double ref = fmax(fabs(old_val), fabs(new_val));
-        if (ref < 1e-6) ref = 1e-6;  // Minimum reference voltage of 1µV
+        double freq = 0;
+        switch (c->type) {
+            case COMP_AC_VOLTAGE:
+                freq = c->props.ac_voltage.frequency;
+                break;
+            case COMP_SQUARE_WAVE:
+                freq = c->props.square_wave.frequency;
+                break;
+            case COMP_TRIANGLE_WAVE:
+                freq = c->props.triangle_wave.frequency;
+                break;
+            case COMP_SAWTOOTH_WAVE:
+                freq = c->props.sawtooth_wave.frequency;
+                break;
+            default:
+                break;
+        }
 
-        double rel_change = change / ref;
-        if (rel_change > max_rel_change) {
-            max_rel_change = rel_change;
+        if (freq > max_freq) {
+            max_freq = freq;
         }
     }
-
-    return max_rel_change;
+    return max_freq;
 }
 
 // Update thermal state for all components - calculates temperature rise and damage
-static void thermal_update_components(Circuit *circuit, double dt, double sim_time) {
+static void thermal_update_components(Circuit *circuit, const EnvironmentState *env,
+                                      double dt, double sim_time) {
     if (!circuit) return;
 
     for (int i = 0; i < circuit->num_components; i++) {
@@ -719,8 +1416,8 @@ static void thermal_update_components(Circuit *circuit, double dt, double sim_ti
         // dT/dt = (P - (T - T_ambient) / R_thermal) / C_thermal
         double thermal_resistance = c->thermal.thermal_resistance;
         double thermal_mass = c->thermal.thermal_mass;
-        // Use global environment temperature for ambient
-        double ambient = g_environment.temperature;
+        // Use the environment temperature for ambient
+        double ambient = env->temperature;
 
         if (thermal_mass > 0) {
             double heat_in = power;  // Power dissipation heats up
@@ -778,16 +1475,21 @@ static void thermal_update_components(Circuit *circuit, double dt, double sim_ti
                 c->thermal.failure_time = sim_time;
                 c->thermal.smoke_active = true;
 
-                // Spawn initial smoke particles
+                // Spawn initial smoke particles: six draws per particle from
+                // the component's own stream
+                double u[6 * MAX_SMOKE_PARTICLES];
+                rng_uniform_batch(0, RNG_STREAM(RNG_DOMAIN_SMOKE, c->id), 0,
+                                  u, 6 * MAX_SMOKE_PARTICLES);
                 c->thermal.num_smoke = MAX_SMOKE_PARTICLES;
                 for (int s = 0; s < MAX_SMOKE_PARTICLES; s++) {
                     SmokeParticle *p = &c->thermal.smoke[s];
-                    p->x = (float)(rand() % 20 - 10);  // Random offset
-                    p->y = (float)(rand() % 10 - 5);
-                    p->vx = (float)(rand() % 20 - 10) * 0.5f;
-                    p->vy = (float)(rand() % 10 + 10) * -2.0f;  // Rise upward
-                    p->life = 1.0f + (float)(rand() % 50) / 100.0f;
-                    p->size = 3.0f + (float)(rand() % 5);
+                    const double *r = &u[6 * s];
+                    p->x = (float)((int)(r[0] * 20) - 10);  // Random offset
+                    p->y = (float)((int)(r[1] * 10) - 5);
+                    p->vx = (float)((int)(r[2] * 20) - 10) * 0.5f;
+                    p->vy = (float)((int)(r[3] * 10) + 10) * -2.0f;  // Rise upward
+                    p->life = 1.0f + (float)(int)(r[4] * 50) / 100.0f;
+                    p->size = 3.0f + (float)(int)(r[5] * 5);
                     p->alpha = 200;
                 }
             }
@@ -799,9 +1501,13 @@ bool simulation_step(Simulation *sim) {
     if (!sim || !sim->circuit) return false;
 
     Circuit *circuit = sim->circuit;
+    unsigned long allocs_at_start = solver_alloc_count();
+    int factors_at_start = simulation_factor_total(sim);
+    sim->iteration_count = 0;
 
-    // Ensure we have a solution (run DC analysis if needed)
-    if (!sim->solution) {
+    // Ensure we have a solution (run DC analysis if needed). The compiled
+    // stamp handles are only valid for the components they were built for.
+    if (!sim->solution || circuit->num_components != sim->num_compiled_components) {
         if (!simulation_dc_analysis(sim)) {
             return false;
         }
@@ -816,54 +1522,74 @@ bool simulation_step(Simulation *sim) {
     // Current time step to try
     double dt = sim->adaptive_enabled ? sim->dt_actual : sim->time_step;
     double dt_new = dt;
+    bool at_breakpoint = false;
+    int event_iterations = 0;
+
+    if (sim->adaptive_enabled) {
+        simulation_schedule_breakpoints(sim);
+    }
 
     // Maximum retries to prevent infinite loops
     int max_retries = 10;
     int retries = 0;
 
     while (retries < max_retries) {
-        // Save the current solution in case we need to reject this step
-        if (sim->saved_solution) {
-            vector_free(sim->saved_solution);
+        // Land on the next breakpoint instead of stepping over it; a step
+        // that would stop just short of it is split in two equal halves
+        if (sim->adaptive_enabled && sim->num_breakpoints > 0) {
+            double gap = sim->breakpoints[0] - sim->time;
+            at_breakpoint = (dt >= gap - BREAKPOINT_RESOLUTION);
+            if (at_breakpoint) {
+                dt = gap;
+            } else if (dt > 0.5 * gap) {
+                dt = 0.5 * gap;
+            }
         }
-        sim->saved_solution = vector_clone(sim->solution);
-
-        // Attempt a solve with current dt
-        Vector *trial_solution = simulation_solve_step(sim, dt);
 
-        if (!trial_solution) {
-            // Solver failed - halve dt and retry
-            if (sim->adaptive_enabled) {
+        // Save the current solution in case we need to reject this step
+        vector_copy(sim->saved_solution, sim->solution);
+
+        // Attempt a solve with current dt (result in sim->trial). Sources
+        // are evaluated at the end of the step; a step ending on a
+        // breakpoint sees the value just before the edge, whichever way the
+        // edge time was rounded.
+        double source_time = at_breakpoint ? sim->breakpoints[0] - BREAKPOINT_RESOLUTION
+                                           : sim->time + dt;
+        bool solved = simulation_solve_step(sim, dt, source_time);
+        if (!solved || !sim->converged) {
+            // Solver failed or Newton did not converge - cut dt and retry.
+            // The last retry is made at the minimum step.
+            if (sim->adaptive_enabled && dt > MIN_TIME_STEP) {
+                simulation_reject(sim);
                 dt *= ADAPTIVE_MIN_FACTOR;
-                dt = fmax(dt, MIN_TIME_STEP);
+                dt = (retries + 1 < max_retries) ? fmax(dt, MIN_TIME_STEP) : MIN_TIME_STEP;
                 retries++;
                 sim->step_rejections++;
                 sim->total_step_rejections++;
                 continue;
-            } else {
+            } else if (!solved) {
                 simulation_set_error(sim, "Matrix solver failed");
                 return false;
+            } else if (sim->adaptive_enabled || !simulation_vector_finite(sim->trial)) {
+                simulation_set_error(sim, "Newton iteration did not converge");
+                return false;
             }
+            // A fixed step has no smaller step to retry at: its last
+            // iterate is kept, as long as it is a number
         }
 
-        // Estimate error from solution change
-        double error = simulation_estimate_error(sim, trial_solution);
-        sim->error_estimate = error;
-
         if (sim->adaptive_enabled) {
-            if (error > ADAPTIVE_ERROR_TOL) {
-                // Error too large - reject step, halve dt, and retry
-                vector_free(trial_solution);
-
-                // Restore the saved solution
-                vector_free(sim->solution);
-                sim->solution = vector_clone(sim->saved_solution);
-
-                // Reduce time step
-                double factor = ADAPTIVE_SAFETY_FACTOR * sqrt(ADAPTIVE_ERROR_TOL / error);
-                factor = fmax(factor, ADAPTIVE_MIN_FACTOR);
-                dt *= factor;
-                dt = fmax(dt, MIN_TIME_STEP);
+            // Local truncation error: a step longer than the error allows is
+            // redone a margin below the step the error estimate asks for. A
+            // step at the minimum is accepted whatever its error, and the
+            // last retry goes there.
+            double dt_lte = simulation_truncation_step(sim, sim->trial);
+            sim->error_estimate = isinf(dt_lte) ? 0.0 : dt / dt_lte;
+
+            if (dt_lte < ADAPTIVE_REJECT_RATIO * dt && dt > MIN_TIME_STEP) {
+                simulation_reject(sim);
+                dt = fmax(ADAPTIVE_SAFETY * dt_lte, dt * ADAPTIVE_MIN_FACTOR);
+                dt = (retries + 1 < max_retries) ? fmax(dt, MIN_TIME_STEP) : MIN_TIME_STEP;
 
                 retries++;
                 sim->step_rejections++;
@@ -871,30 +1597,39 @@ bool simulation_step(Simulation *sim) {
                 continue;
             }
 
-            // Step accepted - compute new dt for next step
-            if (error < ADAPTIVE_STEADY_THRESHOLD) {
-                // Circuit is very steady - increase dt gradually
-                dt_new = dt * ADAPTIVE_MAX_FACTOR;
-            } else if (error < ADAPTIVE_ERROR_TOL * 0.5) {
-                // Error is comfortably below tolerance - increase dt
-                double factor = ADAPTIVE_SAFETY_FACTOR * sqrt(ADAPTIVE_ERROR_TOL / error);
-                factor = fmin(factor, ADAPTIVE_MAX_FACTOR);
-                dt_new = dt * factor;
-            } else {
-                // Error is close to tolerance - keep dt similar
-                dt_new = dt;
+            // A device guard crossing well inside the step: redo the step
+            // to end just past the crossing, so the device switches there
+            if (event_iterations < EVENT_MAX_ITERATIONS) {
+                double tol = fmax(EVENT_TIME_RESOLUTION * sim->dt_target, MIN_TIME_STEP);
+                double t_event = simulation_locate_event(sim, dt) * dt;
+                if (t_event < dt - tol) {
+                    simulation_reject(sim);
+                    dt = t_event + 0.5 * tol;
+                    event_iterations++;
+                    continue;
+                }
             }
 
-            // Clamp to valid range
-            dt_new = fmax(dt_new, MIN_TIME_STEP);
-            dt_new = fmin(dt_new, MAX_TIME_STEP);
-            // Don't exceed the target/nominal time step by too much
-            dt_new = fmin(dt_new, sim->dt_target * ADAPTIVE_MAX_FACTOR * 2.0);
+            // Step accepted - grow towards the step the error allows, as far
+            // as the sources let it
+            dt_new = fmin(dt_lte, dt * ADAPTIVE_MAX_FACTOR);
+            dt_new = CLAMP(dt_new, MIN_TIME_STEP,
+                           fmax(simulation_source_step_limit(sim), MIN_TIME_STEP));
         }
 
         // Accept the step
-        vector_free(sim->solution);
-        sim->solution = trial_solution;
+        simulation_swap_vectors(&sim->solution, &sim->trial);
+        bool switched = simulation_accept(sim, dt);
+
+        // Past a discontinuity (a source edge or a device that switched) the
+        // old slopes no longer apply: restart small and with backward Euler,
+        // and estimate the truncation error only from points after it
+        if (sim->adaptive_enabled && (at_breakpoint || switched)) {
+            dt_new = fmax(dt_new * BREAKPOINT_RESTART_FACTOR, MIN_TIME_STEP);
+            sim->integrator.restart = true;
+            sim->integrator.points = 0;
+            sim->predictor_points = 0;
+        }
         break;
     }
 
@@ -904,8 +1639,7 @@ bool simulation_step(Simulation *sim) {
     }
 
     // Update for next step
-    if (sim->prev_solution) vector_free(sim->prev_solution);
-    sim->prev_solution = vector_clone(sim->solution);
+    vector_copy(sim->prev_solution, sim->solution);
 
     // Update adaptive state
     sim->dt_actual = dt;
@@ -924,7 +1658,7 @@ bool simulation_step(Simulation *sim) {
     circuit_update_meter_readings(circuit);
 
     // Update thermal state for all components (magic smoke simulation)
-    thermal_update_components(circuit, dt, sim->time);
+    thermal_update_components(circuit, &sim->context.environment, dt, sim->time);
 
     // Mixed-signal logic solver phase
     // 1. ADC: Sample analog node voltages and convert to logic states
@@ -934,6 +1668,10 @@ bool simulation_step(Simulation *sim) {
     // 3. DAC: Drive logic outputs to analog nodes
     logic_drive_outputs(sim, circuit);
 
+    // Solver heap allocations made by this step (0 once the topology is compiled)
+    sim->step_alloc_count = solver_alloc_count() - allocs_at_start;
+    sim->step_factorizations = simulation_factor_total(sim) - factors_at_start;
+
     // Adaptive decimation for history recording - calculated ONCE when dt becomes valid
     // Changing decimation mid-run causes inconsistent sample spacing and distorted waveforms
     // history_decimate_factor == 0 means "not yet calculated"
@@ -1009,8 +1747,7 @@ bool simulation_step(Simulation *sim) {
         }
 
         // Debug: Log probe values to file (every 1000 samples)
-        static int debug_sample_count = 0;
-        if (circuit->num_probes > 0 && debug_sample_count++ % 1000 == 0) {
+        if (sim->probe_log && circuit->num_probes > 0 && sim->probe_log_count++ % 1000 == 0) {
             FILE *debug_log = fopen("probe_debug.log", "a");
             if (debug_log) {
                 fprintf(debug_log, "t=%.6f", sim->time);
@@ -1075,38 +1812,86 @@ double simulation_get_error_estimate(Simulation *sim) {
     return sim ? sim->error_estimate : 0.0;
 }
 
-double simulation_auto_time_step(Simulation *sim) {
-    if (!sim || !sim->circuit) return DEFAULT_TIME_STEP;
+void simulation_set_tolerances(Simulation *sim, double reltol, double abstol, double chgtol) {
+    if (!sim || reltol <= 0 || abstol <= 0 || chgtol <= 0) return;
+    sim->lte.reltol = reltol;
+    sim->lte.abstol = abstol;
+    sim->lte.chgtol = chgtol;
+}
 
-    // Find the highest frequency signal in the circuit
-    double max_freq = 0;
+void simulation_set_voltage_tolerance(Simulation *sim, double vntol) {
+    if (!sim || vntol <= 0) return;
+    sim->vntol = vntol;
+}
 
-    for (int i = 0; i < sim->circuit->num_components; i++) {
-        Component *c = sim->circuit->components[i];
-        if (!c) continue;
+void simulation_enable_modified_newton(Simulation *sim, bool enable) {
+    if (sim) {
+        sim->modified_newton = enable;
+    }
+}
 
-        double freq = 0;
-        switch (c->type) {
-            case COMP_AC_VOLTAGE:
-                freq = c->props.ac_voltage.frequency;
-                break;
-            case COMP_SQUARE_WAVE:
-                freq = c->props.square_wave.frequency;
-                break;
-            case COMP_TRIANGLE_WAVE:
-                freq = c->props.triangle_wave.frequency;
-                break;
-            case COMP_SAWTOOTH_WAVE:
-                freq = c->props.sawtooth_wave.frequency;
-                break;
-            default:
-                break;
-        }
+bool simulation_is_modified_newton_enabled(Simulation *sim) {
+    return sim ? sim->modified_newton : false;
+}
 
-        if (freq > max_freq) {
-            max_freq = freq;
+void simulation_set_integration(Simulation *sim, IntegrationMethod method) {
+    if (sim && method >= 0 && method < INTEGRATE_METHOD_COUNT) {
+        sim->integrator.method = method;
+    }
+}
+
+IntegrationMethod simulation_get_integration(Simulation *sim) {
+    return sim ? sim->integrator.method : INTEGRATE_EULER;
+}
+
+void simulation_enable_ideal_switches(Simulation *sim, bool enable) {
+    if (sim) {
+        sim->ideal_switches = enable;
+    }
+}
+
+bool simulation_is_ideal_switches_enabled(Simulation *sim) {
+    return sim ? sim->ideal_switches : false;
+}
+
+void simulation_get_lu_cache_stats(Simulation *sim, unsigned long *hits,
+                                   unsigned long *misses) {
+    if (hits) *hits = sim ? sim->lu_cache_hits : 0;
+    if (misses) *misses = sim ? sim->lu_cache_misses : 0;
+}
+
+int simulation_get_step_iterations(Simulation *sim) {
+    return sim ? sim->iteration_count : 0;
+}
+
+int simulation_get_dc_iterations(Simulation *sim) {
+    return sim ? sim->dc_iteration_count : 0;
+}
+
+int simulation_get_step_factorizations(Simulation *sim) {
+    return sim ? sim->step_factorizations : 0;
+}
+
+void simulation_get_bypass_stats(Simulation *sim, unsigned long *hits,
+                                 unsigned long *evaluations) {
+    unsigned long h = 0, e = 0;
+    if (sim && sim->circuit) {
+        for (int i = 0; i < sim->circuit->num_components; i++) {
+            Component *comp = sim->circuit->components[i];
+            if (!comp) continue;
+            h += comp->bypass.hits;
+            e += comp->bypass.evaluations;
         }
     }
+    if (hits) *hits = h;
+    if (evaluations) *evaluations = e;
+}
+
+double simulation_auto_time_step(Simulation *sim) {
+    if (!sim || !sim->circuit) return DEFAULT_TIME_STEP;
+
+    // Find the highest frequency signal in the circuit
+    double max_freq = simulation_source_frequency(sim);
 
     // Calculate time step to ensure smooth waveform visualization
     // More samples per period = smoother sine waves (avoiding triangular appearance)
@@ -1126,16 +1911,21 @@ double simulation_auto_time_step(Simulation *sim) {
         } else {
             dt = period / 300.0;  // 300 samples/period for >100kHz
         }
+
+        // Second-order integration reaches the accuracy of those rates with
+        // half the samples; 50 per period remain for the waveform display
+        if (sim->integrator.method != INTEGRATE_EULER) {
+            dt = fmin(2.0 * dt, period / 50.0);
+        }
     } else {
         // No AC signals, use default time step
         dt = DEFAULT_TIME_STEP;
     }
 
-    // Clamp to valid range
-    dt = CLAMP(dt, MIN_TIME_STEP, MAX_TIME_STEP);
-    sim->time_step = dt;
+    // Clamp to valid range (the nominal step is also the adaptive target)
+    simulation_set_time_step(sim, dt);
 
-    return dt;
+    return sim->time_step;
 }
 
 double simulation_get_node_voltage(Simulation *sim, int node_id) {
@@ -1180,9 +1970,129 @@ void simulation_clear_error(Simulation *sim) {
     }
 }
 
-// Frequency response / Bode plot implementation
+// Small-signal model of the circuit at its DC operating point, excited at
+// the branch of the given AC voltage source. The operating point is solved
+// from the current solution with the committed device and switch states, and
+// nothing of it is committed: the solution, integration history and device
+// states stay as they were (simulation_reject), only the Newton scratch is
+// reused, and the next time step refactors.
+static ACSystem *simulation_ac_linearize(Simulation *sim, Component *source) {
+    Circuit *circuit = sim->circuit;
+
+    if (!sim->solution || circuit->num_components != sim->num_compiled_components) {
+        if (!simulation_dc_analysis(sim)) return NULL;
+    }
+
+    Integrator saved = sim->integrator;
+    sim->integrator.points = 0;
+    simulation_integrator_setup(&sim->integrator, 1e9);
+
+    // Converge, then load once more so that the Jacobian and the reactive
+    // records belong to the operating point itself
+    bool converged = false;
+    vector_copy(sim->trial, sim->solution);
+    bool ok = simulation_dc_newton(sim, &converged) &&
+              simulation_load(sim, 0, sim->trial, sim->trial);
+
+    ACSystem *sys = NULL;
+    if (ok) {
+        int num_nodes = circuit->num_matrix_nodes;
+        sys = ac_system_create(sim->matrix, circuit, num_nodes,
+                               num_nodes + source->voltage_var_idx);
+        if (!sys) simulation_set_error(sim, "Memory allocation failed");
+    }
+
+    sim->integrator = saved;
+    simulation_reject(sim);
+    sim->jacobian_ag0 = 0;
+    return sys;
+}
+
+// Solve one frequency and store the response of unknown probe_idx
+static bool simulation_ac_point(const ACSystem *sys, ACSolver *solver, int probe_idx,
+                                double freq, FreqResponsePoint *point) {
+    if (!ac_solve(sys, solver, freq)) return false;
+
+    double re, im;
+    ac_solver_response(sys, solver, probe_idx, &re, &im);
+    double magnitude = sqrt(re * re + im * im);
+
+    point->frequency = freq;
+    point->magnitude_db = (magnitude > 1e-12) ? 20.0 * log10(magnitude) : -120.0;
+    point->phase_deg = (magnitude > 1e-12) ? atan2(im, re) * 180.0 / M_PI : 0;
+    return true;
+}
+
+// First AC voltage source of the circuit (the excitation of AC analysis)
+static Component *simulation_find_ac_source(Simulation *sim) {
+    for (int i = 0; i < sim->circuit->num_components; i++) {
+        Component *comp = sim->circuit->components[i];
+        if (comp->type == COMP_AC_VOLTAGE) return comp;
+    }
+    return NULL;
+}
+
+// Unknown of a node for AC responses (-1 for ground or a node outside the
+// circuit)
+static int simulation_ac_probe_index(Simulation *sim, int probe_node) {
+    if (probe_node < 0 || probe_node >= MAX_NODES) return -1;
+    return sim->circuit->node_map[probe_node] - 1;
+}
+
+// Shared state of a frequency sweep: workers claim chunks of
+// AC_SWEEP_CHUNK points in order and write each point to its own slot
+typedef struct {
+    Simulation *sim;
+    const ACSystem *sys;
+    int probe_idx;
+    int num_points;
+    double log_start;
+    double log_step;
+    FreqResponsePoint *points;
+    atomic_int_t next_chunk;
+    atomic_int_t done;
+    atomic_int_t failed;            // 1: solver failure, 2: out of memory
+} ACSweepContext;
+
+// Sweep worker: solves chunks until none are left, with its own ACSolver
+// (consecutive points of a chunk refactor with the same pivot sequence)
+static void simulation_ac_sweep_task(void *arg, int thread_id) {
+    (void)thread_id;
+    ACSweepContext *ctx = (ACSweepContext *)arg;
+
+    ACSolver *solver = ac_solver_create(ctx->sys);
+    if (!solver) {
+        atomic_store(&ctx->failed, 2);
+        return;
+    }
+
+    while (!ctx->sim->freq_sweep_cancel && !atomic_load(&ctx->failed)) {
+        int first = (atomic_inc(&ctx->next_chunk) - 1) * AC_SWEEP_CHUNK;
+        if (first >= ctx->num_points) break;
+        int last = MIN(first + AC_SWEEP_CHUNK, ctx->num_points);
+
+        for (int i = first; i < last; i++) {
+            double freq = pow(10.0, ctx->log_start + i * ctx->log_step);
+            if (!simulation_ac_point(ctx->sys, solver, ctx->probe_idx, freq, &ctx->points[i])) {
+                atomic_store(&ctx->failed, 1);
+                break;
+            }
+
+            ctx->sim->freq_sweep_progress = atomic_inc(&ctx->done) - 1;
+        }
+    }
+
+    ac_solver_free(solver);
+}
+
+// Frequency response / Bode plot: small-signal AC analysis. The response
+// at probe_node to a unit excitation of the first AC voltage source is the
+// transfer function itself, so each point is one complex solve. The points
+// are independent and are spread over the pool's workers, then copied to
+// freq_response in frequency order.
 bool simulation_freq_sweep(Simulation *sim, double start_freq, double stop_freq,
-                           int source_node, int probe_node, int num_points) {
+                           int source_node, int probe_node, int num_points,
+                           ThreadPool *pool) {
     if (!sim || !sim->circuit) {
         simulation_set_error(sim, "No circuit");
         return false;
@@ -1191,26 +2101,18 @@ bool simulation_freq_sweep(Simulation *sim, double start_freq, double stop_freq,
     if (num_points > MAX_FREQ_POINTS) {
         num_points = MAX_FREQ_POINTS;
     }
-
-    // Find an AC voltage source to use for excitation
-    Component *ac_source = NULL;
-    for (int i = 0; i < sim->circuit->num_components; i++) {
-        Component *comp = sim->circuit->components[i];
-        if (comp->type == COMP_AC_VOLTAGE) {
-            ac_source = comp;
-            break;
-        }
+    if (num_points < 2 || start_freq <= 0 || stop_freq <= start_freq) {
+        simulation_set_error(sim, "Invalid frequency sweep range");
+        return false;
     }
 
+    // Find an AC voltage source to use for excitation
+    Component *ac_source = simulation_find_ac_source(sim);
     if (!ac_source) {
         simulation_set_error(sim, "No AC voltage source found for frequency sweep");
         return false;
     }
 
-    // Save original frequency
-    double orig_freq = ac_source->props.ac_voltage.frequency;
-    double amplitude = ac_source->props.ac_voltage.amplitude;
-
     sim->freq_start = start_freq;
     sim->freq_stop = stop_freq;
     sim->freq_source_node = source_node;
@@ -1222,128 +2124,240 @@ bool simulation_freq_sweep(Simulation *sim, double start_freq, double stop_freq,
     sim->freq_sweep_progress = 0;
     sim->freq_sweep_total = num_points;
 
+    ACSystem *sys = simulation_ac_linearize(sim, ac_source);
+    FreqResponsePoint *points = sys ? malloc(num_points * sizeof(FreqResponsePoint)) : NULL;
+    if (!points) {
+        if (sys) simulation_set_error(sim, "Memory allocation failed");
+        ac_system_free(sys);
+        sim->freq_sweep_running = false;
+        return false;
+    }
+
+    ACSweepContext ctx;
+    memset(&ctx, 0, sizeof(ctx));
+    ctx.sim = sim;
+    ctx.sys = sys;
+    ctx.num_points = num_points;
+    ctx.points = points;
+
+    ctx.probe_idx = simulation_ac_probe_index(sim, probe_node);
+
     // Generate logarithmically spaced frequencies
-    double log_start = log10(start_freq);
-    double log_stop = log10(stop_freq);
-    double log_step = (log_stop - log_start) / (num_points - 1);
-
-    for (int i = 0; i < num_points; i++) {
-        // Check for cancellation request
-        if (sim->freq_sweep_cancel) {
-            ac_source->props.ac_voltage.frequency = orig_freq;
-            sim->freq_sweep_running = false;
-            sim->freq_sweep_complete = false;
-            return false;
+    ctx.log_start = log10(start_freq);
+    ctx.log_step = (log10(stop_freq) - ctx.log_start) / (num_points - 1);
+
+    // One task per worker, as many as there are chunks; without a pool (or
+    // if a task cannot be queued) the calling thread does the work
+    int num_chunks = (num_points + AC_SWEEP_CHUNK - 1) / AC_SWEEP_CHUNK;
+    int num_tasks = (pool && pool->initialized) ? MIN(pool->num_threads, num_chunks) : 0;
+    for (int i = 0; i < num_tasks; i++) {
+        if (!threadpool_submit(pool, simulation_ac_sweep_task, &ctx)) {
+            simulation_ac_sweep_task(&ctx, 0);
         }
+    }
+    if (num_tasks > 0) {
+        threadpool_wait(pool);
+    } else {
+        simulation_ac_sweep_task(&ctx, 0);
+    }
 
-        // Update progress
-        sim->freq_sweep_progress = i;
+    int failed = atomic_load(&ctx.failed);
+    bool ok = !failed && !sim->freq_sweep_cancel;
+    if (ok) {
+        memcpy(sim->freq_response, points, num_points * sizeof(FreqResponsePoint));
+        sim->freq_response_count = num_points;
+    } else if (failed) {
+        simulation_set_error(sim, failed == 2 ? "Memory allocation failed" :
+                                                "Matrix solver failed");
+    }
 
-        double freq = pow(10.0, log_start + i * log_step);
+    free(points);
+    ac_system_free(sys);
 
-        // Set source frequency
-        ac_source->props.ac_voltage.frequency = freq;
+    sim->freq_sweep_running = false;
+    sim->freq_sweep_complete = ok;
 
-        // Calculate time step and simulation duration
-        double period = 1.0 / freq;
-        double dt = period / 100.0;  // 100 samples per period
-        if (dt < MIN_TIME_STEP) dt = MIN_TIME_STEP;
-        if (dt > MAX_TIME_STEP) dt = MAX_TIME_STEP;
+    return ok;
+}
 
-        // Simulate for several cycles to reach steady state
-        int num_cycles = 10;
-        double total_time = num_cycles * period;
-        int num_steps = (int)(total_time / dt);
+bool simulation_ac_response(Simulation *sim, double freq, int probe_node,
+                            FreqResponsePoint *point) {
+    if (!sim || !sim->circuit || !point) {
+        simulation_set_error(sim, "No circuit");
+        return false;
+    }
 
-        // Track min/max values for last 2 cycles
-        double in_min = 1e30, in_max = -1e30;
-        double out_min = 1e30, out_max = -1e30;
+    Component *ac_source = simulation_find_ac_source(sim);
+    if (!ac_source) {
+        simulation_set_error(sim, "No AC voltage source found for AC analysis");
+        return false;
+    }
 
-        // Track zero crossings for phase measurement
-        double in_zero_cross_time = 0;
-        double out_zero_cross_time = 0;
-        double prev_in = 0, prev_out = 0;
-        bool found_in_zero = false, found_out_zero = false;
+    ACSystem *sys = simulation_ac_linearize(sim, ac_source);
+    if (!sys) return false;
 
-        // Reset simulation state
-        sim->time = 0;
-        if (sim->solution) {
-            for (int j = 0; j < sim->solution_size; j++) {
-                vector_set(sim->solution, j, 0);
-            }
-        }
-        if (sim->prev_solution) {
-            for (int j = 0; j < sim->solution_size; j++) {
-                vector_set(sim->prev_solution, j, 0);
-            }
-        }
+    ACSolver *solver = ac_solver_create(sys);
+    bool ok = solver && simulation_ac_point(sys, solver, simulation_ac_probe_index(sim, probe_node),
+                                            freq, point);
+    if (!solver) {
+        simulation_set_error(sim, "Memory allocation failed");
+    } else if (!ok) {
+        simulation_set_error(sim, "Matrix solver failed");
+    }
 
-        // Run simulation
-        double measure_start = (num_cycles - 2) * period;
-        for (int step = 0; step < num_steps; step++) {
-            sim->time_step = dt;
-            simulation_step(sim);
-            sim->time += dt;
-
-            // Get input (AC source output) and output voltages
-            double t = sim->time;
-            double in_voltage = amplitude * sin(2 * M_PI * freq * t + ac_source->props.ac_voltage.phase);
-            double out_voltage = simulation_get_node_voltage(sim, probe_node);
-
-            // Only measure during last 2 cycles
-            if (t >= measure_start) {
-                if (in_voltage < in_min) in_min = in_voltage;
-                if (in_voltage > in_max) in_max = in_voltage;
-                if (out_voltage < out_min) out_min = out_voltage;
-                if (out_voltage > out_max) out_max = out_voltage;
-
-                // Detect rising zero crossings for phase measurement
-                if (!found_in_zero && prev_in <= 0 && in_voltage > 0) {
-                    in_zero_cross_time = t - dt * prev_in / (in_voltage - prev_in);
-                    found_in_zero = true;
-                }
-                if (!found_out_zero && prev_out <= 0 && out_voltage > 0) {
-                    out_zero_cross_time = t - dt * prev_out / (out_voltage - prev_out);
-                    found_out_zero = true;
-                }
-            }
-            prev_in = in_voltage;
-            prev_out = out_voltage;
+    ac_solver_free(solver);
+    ac_system_free(sys);
+    return ok;
+}
+
+// Adjoint sensitivity state: the operating point, the linearized circuit
+// with its adjoint and a scratch matrix for re-stamping one component
+struct SimSensitivity {
+    double freq;                // 0: DC operating point
+    int probe_idx;              // Unknown of the output
+    Integrator integrator;      // DC setup the operating point was loaded with
+    Vector *x;                  // Operating point
+    ACSystem *ac;               // Linearized circuit; its solver holds the
+    ACSolver *ac_solver;        // AC response and the adjoint of the output
+    SparseMatrix *stamp;        // One component's load (recorded triplets)
+    Vector *stamp_rhs;
+};
+
+SimSensitivity *simulation_sensitivity_begin(Simulation *sim, int probe_node, double freq) {
+    if (!sim || !sim->circuit) {
+        simulation_set_error(sim, "No circuit");
+        return NULL;
+    }
+
+    Circuit *circuit = sim->circuit;
+    Component *ac_source = NULL;
+    if (freq > 0) {
+        ac_source = simulation_find_ac_source(sim);
+        if (!ac_source) {
+            simulation_set_error(sim, "No AC voltage source found for AC analysis");
+            return NULL;
         }
+    }
+
+    if (!sim->solution || circuit->num_components != sim->num_compiled_components) {
+        if (!simulation_dc_analysis(sim)) return NULL;
+    }
+
+    int probe_idx = simulation_ac_probe_index(sim, probe_node);
+    if (probe_idx < 0) {
+        simulation_set_error(sim, "Sensitivity probe is not on a circuit node");
+        return NULL;
+    }
 
-        // Calculate magnitude and phase
-        double in_pp = in_max - in_min;
-        double out_pp = out_max - out_min;
-
-        double magnitude_ratio = (in_pp > 1e-12) ? (out_pp / in_pp) : 0;
-        double magnitude_db = (magnitude_ratio > 1e-12) ? 20.0 * log10(magnitude_ratio) : -120.0;
-
-        // Phase in degrees
-        double phase_deg = 0;
-        if (found_in_zero && found_out_zero) {
-            double time_diff = out_zero_cross_time - in_zero_cross_time;
-            phase_deg = (time_diff / period) * 360.0;
-            // Normalize to -180 to +180
-            while (phase_deg > 180) phase_deg -= 360;
-            while (phase_deg < -180) phase_deg += 360;
+    SimSensitivity *sens = calloc(1, sizeof(SimSensitivity));
+    if (!sens) {
+        simulation_set_error(sim, "Memory allocation failed");
+        return NULL;
+    }
+    int n = sim->solution->size;
+    sens->freq = freq;
+    sens->probe_idx = probe_idx;
+    sens->x = vector_create(n);
+    sens->stamp = sparse_create(n, 0);
+    sens->stamp_rhs = vector_create(n);
+
+    // The operating point and its Jacobian, as simulation_ac_linearize
+    // takes them. At zero frequency the linearized system is the Jacobian
+    // with capacitors open and inductors shorted (no companion
+    // conductances), so the DC adjoint is solved through it as well; its
+    // excitation is then unused.
+    bool ok = sens->x && sens->stamp && sens->stamp_rhs;
+    if (ok) {
+        Integrator saved = sim->integrator;
+        sim->integrator.points = 0;
+        simulation_integrator_setup(&sim->integrator, 1e9);
+        sens->integrator = sim->integrator;
+
+        bool converged = false;
+        vector_copy(sim->trial, sim->solution);
+        ok = simulation_dc_newton(sim, &converged) &&
+             simulation_load(sim, 0, sim->trial, sim->trial);
+        if (ok) {
+            int num_nodes = circuit->num_matrix_nodes;
+            int excite_row = ac_source ? num_nodes + ac_source->voltage_var_idx : probe_idx;
+            vector_copy(sens->x, sim->trial);
+            sens->ac = ac_system_create(sim->matrix, circuit, num_nodes, excite_row);
+            sens->ac_solver = sens->ac ? ac_solver_create(sens->ac) : NULL;
+            ok = sens->ac_solver && ac_solve(sens->ac, sens->ac_solver, freq) &&
+                 ac_solve_adjoint(sens->ac, sens->ac_solver, probe_idx);
         }
 
-        // Store result
-        sim->freq_response[sim->freq_response_count].frequency = freq;
-        sim->freq_response[sim->freq_response_count].magnitude_db = magnitude_db;
-        sim->freq_response[sim->freq_response_count].phase_deg = phase_deg;
-        sim->freq_response_count++;
+        sim->integrator = saved;
+        simulation_reject(sim);
+        sim->jacobian_ag0 = 0;
     }
 
-    // Restore original frequency
-    ac_source->props.ac_voltage.frequency = orig_freq;
+    if (!ok) {
+        if (!sim->has_error) simulation_set_error(sim, "Matrix solver failed");
+        simulation_sensitivity_end(sim, sens);
+        return NULL;
+    }
+    return sens;
+}
 
-    sim->freq_sweep_running = false;
-    sim->freq_sweep_complete = true;
+void simulation_sensitivity_output(const SimSensitivity *sens, double *re, double *im) {
+    if (sens->freq > 0) {
+        ac_solver_response(sens->ac, sens->ac_solver, sens->probe_idx, re, im);
+    } else {
+        *re = sens->x->data[sens->probe_idx];
+        *im = 0;
+    }
+}
 
+bool simulation_sensitivity_component(Simulation *sim, SimSensitivity *sens,
+                                      Component *comp, double *re, double *im) {
+    int num_nodes = sim->circuit->num_matrix_nodes;
+    SparseMatrix *A = sens->stamp;
+    Vector *b = sens->stamp_rhs;
+
+    sparse_clear(A);
+    vector_zero(b);
+    component_stamp(comp, A, b, num_nodes, 0, sens->x, sens->x, &sens->integrator,
+                    &sim->context);
+    if (A->alloc_failed) return false;
+
+    if (sens->freq > 0) {
+        ac_component_product(A, &comp->reactive, num_nodes, sens->freq,
+                             sens->ac_solver->adjoint, sens->ac_solver->x, re, im);
+        return true;
+    }
+
+    // lambda^T (A_c x - b_c): the component's residual at the operating point
+    const double *x = sens->x->data, *lambda = sens->ac_solver->adjoint->data;
+    int n = sens->x->size;
+    double sum = 0;
+    for (int k = 0; k < A->trip_count; k++) {
+        int row = A->trip_row[k], col = A->trip_col[k];
+        if (row < 0 || col < 0 || row >= n || col >= n) continue;
+        sum += lambda[row] * A->trip_val[k] * x[col];
+    }
+    for (int i = 0; i < n; i++) {
+        sum -= lambda[i] * b->data[i];
+    }
+    *re = sum;
+    *im = 0;
     return true;
 }
 
+void simulation_sensitivity_end(Simulation *sim, SimSensitivity *sens) {
+    if (!sens) return;
+
+    // The re-stamps only touched per-load scratch of the components
+    simulation_reject(sim);
+
+    vector_free(sens->x);
+    sparse_free(sens->stamp);
+    vector_free(sens->stamp_rhs);
+    ac_solver_free(sens->ac_solver);
+    ac_system_free(sens->ac);
+    free(sens);
+}
+
 int simulation_get_freq_response(Simulation *sim, FreqResponsePoint *points, int max_points) {
     if (!sim || !points) return 0;
 
@@ -0,0 +1,1195 @@
+/**
+ * Circuit Playground - Sparse Matrix Implementation
+ *
+ * The LU factorization is a left-looking (Gilbert-Peierls) column LU with
+ * partial pivoting: each column of L and U is computed by a sparse triangular
+ * solve against the columns already factored, so the work is proportional to
+ * the number of floating point operations rather than n^3. Once a pivot
+ * sequence is known, sparse_lu_refactor recomputes the values along the
+ * recorded L/U pattern without any graph traversal or pivot search.
+ *
+ * MNA matrices have structurally zero diagonals on voltage-source branch
+ * rows, so the symbolic phase first finds a row matching that puts a
+ * nonzero on every diagonal, then orders the columns by minimum degree on
+ * the symmetrized, matched pattern. The numeric phase uses threshold
+ * pivoting that prefers the matched row and otherwise the sparsest row.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include "sparse.h"
+
+SparseMatrix *sparse_create(int n, int nnz_hint) {
+    if (n <= 0) return NULL;
+
+    SparseMatrix *A = solver_calloc(1, sizeof(SparseMatrix));
+    if (!A) return NULL;
+
+    A->n = n;
+    A->trip_capacity = (nnz_hint > 0) ? nnz_hint : 4 * n;
+    A->trip_row = solver_malloc(A->trip_capacity * sizeof(int));
+    A->trip_col = solver_malloc(A->trip_capacity * sizeof(int));
+    A->trip_val = solver_malloc(A->trip_capacity * sizeof(double));
+    A->col_ptr = solver_calloc(n + 1, sizeof(int));
+
+    if (!A->trip_row || !A->trip_col || !A->trip_val || !A->col_ptr) {
+        sparse_free(A);
+        return NULL;
+    }
+
+    return A;
+}
+
+void sparse_free(SparseMatrix *A) {
+    if (!A) return;
+
+    free(A->trip_row);
+    free(A->trip_col);
+    free(A->trip_val);
+    free(A->col_ptr);
+    free(A->row_idx);
+    free(A->values);
+    free(A->handles);
+    free(A->extra_row);
+    free(A->extra_col);
+    free(A->extra_val);
+    free(A);
+}
+
+void sparse_clear(SparseMatrix *A) {
+    if (!A) return;
+
+    A->trip_count = 0;
+    A->nnz = 0;
+    A->compressed = false;
+    A->alloc_failed = false;
+    A->compiled = false;
+    A->num_handles = 0;
+    A->cursor = 0;
+    A->extra_count = 0;
+    A->pattern_changed = false;
+}
+
+static bool sparse_grow_triplets(SparseMatrix *A) {
+    int new_cap = A->trip_capacity * 2;
+    int *new_row = solver_realloc(A->trip_row, new_cap * sizeof(int));
+    if (!new_row) return false;
+    A->trip_row = new_row;
+
+    int *new_col = solver_realloc(A->trip_col, new_cap * sizeof(int));
+    if (!new_col) return false;
+    A->trip_col = new_col;
+
+    double *new_val = solver_realloc(A->trip_val, new_cap * sizeof(double));
+    if (!new_val) return false;
+    A->trip_val = new_val;
+
+    A->trip_capacity = new_cap;
+    return true;
+}
+
+// Slot of A(row, col) in the compressed store, or -1
+static int sparse_find_slot(SparseMatrix *A, int row, int col) {
+    int lo = A->col_ptr[col];
+    int hi = A->col_ptr[col + 1] - 1;
+    while (lo <= hi) {
+        int mid = (lo + hi) / 2;
+        if (A->row_idx[mid] == row) return mid;
+        if (A->row_idx[mid] < row) lo = mid + 1;
+        else hi = mid - 1;
+    }
+    return -1;
+}
+
+static void sparse_add_extra(SparseMatrix *A, int row, int col, double val) {
+    if (A->extra_count >= A->extra_capacity) {
+        int new_cap = (A->extra_capacity > 0) ? A->extra_capacity * 2 : 16;
+        int *new_row = solver_realloc(A->extra_row, new_cap * sizeof(int));
+        if (!new_row) { A->alloc_failed = true; return; }
+        A->extra_row = new_row;
+        int *new_col = solver_realloc(A->extra_col, new_cap * sizeof(int));
+        if (!new_col) { A->alloc_failed = true; return; }
+        A->extra_col = new_col;
+        double *new_val = solver_realloc(A->extra_val, new_cap * sizeof(double));
+        if (!new_val) { A->alloc_failed = true; return; }
+        A->extra_val = new_val;
+        A->extra_capacity = new_cap;
+    }
+
+    A->extra_row[A->extra_count] = row;
+    A->extra_col[A->extra_count] = col;
+    A->extra_val[A->extra_count] = val;
+    A->extra_count++;
+    A->pattern_changed = true;
+}
+
+void sparse_add_slow(SparseMatrix *A, int row, int col, double val) {
+    if (!A || row < 0 || row >= A->n || col < 0 || col >= A->n) return;
+
+    if (A->compiled) {
+        // Off the recorded sequence: look the slot up instead
+        int slot = sparse_find_slot(A, row, col);
+        if (slot >= 0) {
+            A->values[slot] += val;
+        } else {
+            sparse_add_extra(A, row, col, val);
+        }
+        return;
+    }
+
+    if (A->trip_count >= A->trip_capacity && !sparse_grow_triplets(A)) {
+        A->alloc_failed = true;
+        return;
+    }
+
+    A->trip_row[A->trip_count] = row;
+    A->trip_col[A->trip_count] = col;
+    A->trip_val[A->trip_count] = val;
+    A->trip_count++;
+    A->compressed = false;
+}
+
+bool sparse_compress(SparseMatrix *A) {
+    if (!A || A->alloc_failed) return false;
+    if (A->compressed) return true;
+
+    int n = A->n;
+    int nt = A->trip_count;
+
+    // Make room for the worst case (no duplicates)
+    if (A->nnz_capacity < nt || !A->row_idx) {
+        int cap = (nt > 0) ? nt : 1;
+        int *new_rows = solver_realloc(A->row_idx, cap * sizeof(int));
+        if (!new_rows) return false;
+        A->row_idx = new_rows;
+        double *new_vals = solver_realloc(A->values, cap * sizeof(double));
+        if (!new_vals) return false;
+        A->values = new_vals;
+        A->nnz_capacity = cap;
+    }
+
+    // Two counting sorts (by row, then stably by column) leave the rows of
+    // each column in ascending order so duplicates end up adjacent
+    int *count = solver_calloc(n + 1, sizeof(int));
+    int *order = solver_malloc((nt > 0 ? nt : 1) * sizeof(int));
+    int *by_row = solver_malloc((nt > 0 ? nt : 1) * sizeof(int));
+    if (!count || !order || !by_row) {
+        free(count);
+        free(order);
+        free(by_row);
+        return false;
+    }
+
+    for (int k = 0; k < nt; k++) count[A->trip_row[k] + 1]++;
+    for (int i = 0; i < n; i++) count[i + 1] += count[i];
+    for (int k = 0; k < nt; k++) by_row[count[A->trip_row[k]]++] = k;
+
+    memset(count, 0, (n + 1) * sizeof(int));
+    for (int k = 0; k < nt; k++) count[A->trip_col[k] + 1]++;
+    for (int j = 0; j < n; j++) count[j + 1] += count[j];
+    for (int k = 0; k < nt; k++) {
+        int t = by_row[k];
+        order[count[A->trip_col[t]]++] = t;
+    }
+
+    // Walk the sorted triplets, summing runs with the same (row, col)
+    int nnz = 0;
+    int t = 0;
+    for (int j = 0; j < n; j++) {
+        A->col_ptr[j] = nnz;
+        while (t < nt && A->trip_col[order[t]] == j) {
+            int row = A->trip_row[order[t]];
+            if (nnz > A->col_ptr[j] && A->row_idx[nnz - 1] == row) {
+                A->values[nnz - 1] += A->trip_val[order[t]];
+            } else {
+                A->row_idx[nnz] = row;
+                A->values[nnz] = A->trip_val[order[t]];
+                nnz++;
+            }
+            t++;
+        }
+    }
+    A->col_ptr[n] = nnz;
+    A->nnz = nnz;
+    A->compressed = true;
+
+    free(count);
+    free(order);
+    free(by_row);
+    return true;
+}
+
+double sparse_get(SparseMatrix *A, int row, int col) {
+    if (!A || !A->compressed || row < 0 || row >= A->n || col < 0 || col >= A->n) {
+        return 0.0;
+    }
+
+    int slot = sparse_find_slot(A, row, col);
+    return (slot >= 0) ? A->values[slot] : 0.0;
+}
+
+bool sparse_residual(SparseMatrix *A, const Vector *x, const Vector *b, Vector *r) {
+    if (!A || !A->compressed || !x || !b || !r ||
+        x->size != A->n || b->size != A->n || r->size != A->n) {
+        return false;
+    }
+
+    memcpy(r->data, b->data, A->n * sizeof(double));
+    for (int col = 0; col < A->n; col++) {
+        double xc = x->data[col];
+        if (xc == 0.0) continue;
+        for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+            r->data[A->row_idx[p]] -= A->values[p] * xc;
+        }
+    }
+    return true;
+}
+
+bool sparse_residual_scale(SparseMatrix *A, const Vector *x, const Vector *b, Vector *m) {
+    if (!A || !A->compressed || !x || !b || !m ||
+        x->size != A->n || b->size != A->n || m->size != A->n) {
+        return false;
+    }
+
+    for (int i = 0; i < A->n; i++) {
+        m->data[i] = fabs(b->data[i]);
+    }
+    for (int col = 0; col < A->n; col++) {
+        double xc = fabs(x->data[col]);
+        if (xc == 0.0) continue;
+        for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+            m->data[A->row_idx[p]] += fabs(A->values[p]) * xc;
+        }
+    }
+    return true;
+}
+
+bool sparse_compile(SparseMatrix *A) {
+    if (!A || !sparse_compress(A)) return false;
+
+    int *handles = solver_realloc(A->handles, (A->trip_count > 0 ? A->trip_count : 1) * sizeof(int));
+    if (!handles) return false;
+    A->handles = handles;
+
+    for (int k = 0; k < A->trip_count; k++) {
+        A->handles[k] = sparse_find_slot(A, A->trip_row[k], A->trip_col[k]);
+    }
+
+    A->num_handles = A->trip_count;
+    A->cursor = 0;
+    A->compiled = true;
+    A->extra_count = 0;
+    A->pattern_changed = false;
+    return true;
+}
+
+void sparse_begin_load(SparseMatrix *A) {
+    if (!A) return;
+
+    if (A->compiled) {
+        memset(A->values, 0, A->nnz * sizeof(double));
+        A->cursor = 0;
+        A->extra_count = 0;
+        A->pattern_changed = false;
+    } else {
+        sparse_clear(A);
+    }
+}
+
+int sparse_get_cursor(SparseMatrix *A) {
+    if (!A) return 0;
+    return A->compiled ? A->cursor : A->trip_count;
+}
+
+void sparse_set_cursor(SparseMatrix *A, int pos) {
+    if (A && A->compiled && pos >= 0 && pos <= A->num_handles) {
+        A->cursor = pos;
+    }
+}
+
+// Grow the compiled pattern by the extra entries of the last load. The new
+// pattern is a superset of the old one, so a device that alternates between
+// stamp branches settles on a fixed pattern instead of changing it back and
+// forth. Existing handles are remapped to their slots in the new store.
+static bool sparse_merge_extra(SparseMatrix *A) {
+    int n = A->n;
+    int old_nnz = A->nnz;
+    int total = old_nnz + A->extra_count;
+
+    int *old_col_ptr = solver_malloc((n + 1) * sizeof(int));
+    int *old_row_idx = A->row_idx;
+    double *old_values = A->values;
+    int *new_col_ptr = solver_calloc(n + 2, sizeof(int));
+    int *new_row_idx = solver_malloc(total * sizeof(int));
+    double *new_values = solver_calloc(total, sizeof(double));
+    int *slot_map = solver_malloc((old_nnz > 0 ? old_nnz : 1) * sizeof(int));
+    if (!old_col_ptr || !new_col_ptr || !new_row_idx || !new_values || !slot_map) {
+        free(old_col_ptr);
+        free(new_col_ptr);
+        free(new_row_idx);
+        free(new_values);
+        free(slot_map);
+        return false;
+    }
+    memcpy(old_col_ptr, A->col_ptr, (n + 1) * sizeof(int));
+
+    // Row marker for dropping duplicate extras within a column
+    int *row_mark = solver_malloc(n * sizeof(int));
+    if (!row_mark) {
+        free(old_col_ptr);
+        free(new_col_ptr);
+        free(new_row_idx);
+        free(new_values);
+        free(slot_map);
+        return false;
+    }
+    for (int i = 0; i < n; i++) row_mark[i] = -1;
+
+    // Bucket extras by column (counting sort)
+    int *extra_start = solver_calloc(n + 1, sizeof(int));
+    int *extra_order = solver_malloc(A->extra_count * sizeof(int));
+    int *fill = solver_malloc(n * sizeof(int));
+    if (!extra_start || !extra_order || !fill) {
+        free(extra_start);
+        free(extra_order);
+        free(fill);
+        free(row_mark);
+        free(old_col_ptr);
+        free(new_col_ptr);
+        free(new_row_idx);
+        free(new_values);
+        free(slot_map);
+        return false;
+    }
+    for (int e = 0; e < A->extra_count; e++) extra_start[A->extra_col[e] + 1]++;
+    for (int j = 0; j < n; j++) extra_start[j + 1] += extra_start[j];
+    memcpy(fill, extra_start, n * sizeof(int));
+    for (int e = 0; e < A->extra_count; e++) {
+        extra_order[fill[A->extra_col[e]]++] = e;
+    }
+    free(fill);
+
+    // Merge each column: old rows (already sorted) plus new rows, then sort
+    int nnz = 0;
+    for (int j = 0; j < n; j++) {
+        int start = nnz;
+        new_col_ptr[j] = start;
+        for (int p = old_col_ptr[j]; p < old_col_ptr[j + 1]; p++) {
+            row_mark[old_row_idx[p]] = j;
+            new_row_idx[nnz++] = old_row_idx[p];
+        }
+        for (int q = extra_start[j]; q < extra_start[j + 1]; q++) {
+            int row = A->extra_row[extra_order[q]];
+            if (row_mark[row] == j) continue;
+            row_mark[row] = j;
+            new_row_idx[nnz++] = row;
+        }
+        // Insertion sort: columns are short and mostly sorted already
+        for (int a = start + 1; a < nnz; a++) {
+            int r = new_row_idx[a];
+            int b = a - 1;
+            while (b >= start && new_row_idx[b] > r) {
+                new_row_idx[b + 1] = new_row_idx[b];
+                b--;
+            }
+            new_row_idx[b + 1] = r;
+        }
+    }
+    new_col_ptr[n] = nnz;
+
+    free(A->col_ptr);
+    A->col_ptr = new_col_ptr;
+    A->row_idx = new_row_idx;
+    A->values = new_values;
+    A->nnz = nnz;
+    A->nnz_capacity = total;
+
+    // Carry the values of this load over and remap the handles
+    for (int j = 0; j < n; j++) {
+        for (int p = old_col_ptr[j]; p < old_col_ptr[j + 1]; p++) {
+            slot_map[p] = sparse_find_slot(A, old_row_idx[p], j);
+            A->values[slot_map[p]] = old_values[p];
+        }
+    }
+    for (int k = 0; k < A->num_handles; k++) {
+        A->handles[k] = slot_map[A->handles[k]];
+    }
+    for (int e = 0; e < A->extra_count; e++) {
+        A->values[sparse_find_slot(A, A->extra_row[e], A->extra_col[e])] += A->extra_val[e];
+    }
+
+    A->extra_count = 0;
+    free(extra_start);
+    free(extra_order);
+    free(row_mark);
+    free(old_col_ptr);
+    free(old_row_idx);
+    free(old_values);
+    free(slot_map);
+    return !A->alloc_failed;
+}
+
+bool sparse_end_load(SparseMatrix *A) {
+    if (!A || A->alloc_failed) return false;
+
+    if (!A->compiled) {
+        return sparse_compile(A);
+    }
+    if (A->extra_count > 0) {
+        return sparse_merge_extra(A);
+    }
+    return true;
+}
+
+SparseLU *sparse_lu_create(void) {
+    return solver_calloc(1, sizeof(SparseLU));
+}
+
+static void sparse_lu_release(SparseLU *lu) {
+    free(lu->col_perm);
+    free(lu->pref_row);
+    free(lu->row_count);
+    free(lu->pattern_col_ptr);
+    free(lu->pattern_row_idx);
+    free(lu->Lp); free(lu->Li); free(lu->Lx);
+    free(lu->Up); free(lu->Ui); free(lu->Ux);
+    free(lu->pinv);
+    free(lu->perm);
+    free(lu->factor_values);
+    free(lu->x);
+    free(lu->xi);
+    free(lu->stack);
+    free(lu->pstack);
+    free(lu->mark);
+}
+
+void sparse_lu_free(SparseLU *lu) {
+    if (!lu) return;
+    sparse_lu_release(lu);
+    free(lu);
+}
+
+void sparse_lu_invalidate(SparseLU *lu) {
+    if (!lu) return;
+
+    int factor_count = lu->factor_count;
+    int refactor_count = lu->refactor_count;
+    int reuse_count = lu->reuse_count;
+    sparse_lu_release(lu);
+    memset(lu, 0, sizeof(SparseLU));
+    lu->factor_count = factor_count;
+    lu->refactor_count = refactor_count;
+    lu->reuse_count = reuse_count;
+}
+
+bool sparse_lu_pattern_matches(SparseLU *lu, SparseMatrix *A) {
+    if (!lu || !A || !lu->analyzed || !A->compressed) return false;
+    if (lu->n != A->n || lu->pattern_nnz != A->nnz) return false;
+
+    return memcmp(lu->pattern_col_ptr, A->col_ptr, (A->n + 1) * sizeof(int)) == 0 &&
+           memcmp(lu->pattern_row_idx, A->row_idx, A->nnz * sizeof(int)) == 0;
+}
+
+bool sparse_lu_values_match(SparseLU *lu, SparseMatrix *A) {
+    if (!lu || !lu->factored || !sparse_lu_pattern_matches(lu, A)) return false;
+    return memcmp(lu->factor_values, A->values, A->nnz * sizeof(double)) == 0;
+}
+
+static bool sparse_grow_factor(int **idx, double **val, int *cap, int needed) {
+    if (needed <= *cap) return true;
+    int new_cap = *cap * 2;
+    if (new_cap < needed) new_cap = needed;
+    int *new_idx = solver_realloc(*idx, new_cap * sizeof(int));
+    if (!new_idx) return false;
+    *idx = new_idx;
+    double *new_val = solver_realloc(*val, new_cap * sizeof(double));
+    if (!new_val) return false;
+    *val = new_val;
+    *cap = new_cap;
+    return true;
+}
+
+// Augmenting-path search for the maximum transversal: tries to give column
+// j a row, re-matching already matched columns along the way
+static bool sparse_augment(SparseMatrix *A, int j, int *row_match, int *visited,
+                           int stamp) {
+    for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+        int i = A->row_idx[p];
+        if (visited[i] == stamp) continue;
+        visited[i] = stamp;
+        if (row_match[i] < 0 || sparse_augment(A, row_match[i], row_match, visited, stamp)) {
+            row_match[i] = j;
+            return true;
+        }
+    }
+    return false;
+}
+
+// Maximum transversal: col_match[j] = row giving column j a structurally
+// nonzero diagonal, or -1 if the matrix is structurally singular there
+static bool sparse_max_transversal(SparseMatrix *A, int *col_match) {
+    int n = A->n;
+    int *row_match = solver_malloc(n * sizeof(int));
+    int *visited = solver_calloc(n, sizeof(int));
+    if (!row_match || !visited) {
+        free(row_match);
+        free(visited);
+        return false;
+    }
+
+    for (int i = 0; i < n; i++) row_match[i] = -1;
+
+    for (int j = 0; j < n; j++) {
+        // Cheap assignment first (the diagonal when present), then search
+        bool matched = false;
+        for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1] && !matched; p++) {
+            if (A->row_idx[p] == j && row_match[j] < 0) {
+                row_match[j] = j;
+                matched = true;
+            }
+        }
+        for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1] && !matched; p++) {
+            int i = A->row_idx[p];
+            if (row_match[i] < 0) {
+                row_match[i] = j;
+                matched = true;
+            }
+        }
+        if (!matched) {
+            sparse_augment(A, j, row_match, visited, j + 1);
+        }
+    }
+
+    for (int j = 0; j < n; j++) col_match[j] = -1;
+    for (int i = 0; i < n; i++) {
+        if (row_match[i] >= 0) col_match[row_match[i]] = i;
+    }
+
+    free(row_match);
+    free(visited);
+    return true;
+}
+
+// Minimum-degree ordering of the symmetric pattern of B + B^T, where B is A
+// with its rows permuted so that row row_pos[i] of B is row i of A.
+// This is the greedy heuristic that AMD approximates; circuit matrices are
+// small enough that exact degrees on an explicit elimination graph are
+// cheap. As in AMD, very dense rows (supply rails, ground-like nets) are
+// taken out of the graph and ordered last.
+static bool sparse_min_degree_order(SparseMatrix *A, const int *row_pos, int *order) {
+    int n = A->n;
+    bool ok = true;
+
+    int **adj = solver_calloc(n, sizeof(int *));
+    int *adj_len = solver_calloc(n, sizeof(int));
+    int *adj_cap = solver_calloc(n, sizeof(int));
+    int *mark = solver_calloc(n, sizeof(int));
+    int *head = solver_malloc((n + 1) * sizeof(int));
+    int *next = solver_malloc(n * sizeof(int));
+    int *prev = solver_malloc(n * sizeof(int));
+    int *degree = solver_malloc(n * sizeof(int));
+    bool *gone = solver_calloc(n, sizeof(bool));
+    int *nb = solver_malloc(n * sizeof(int));
+
+    if (!adj || !adj_len || !adj_cap || !mark || !head || !next || !prev ||
+        !degree || !gone || !nb) {
+        ok = false;
+        goto cleanup;
+    }
+
+    // Build the symmetric adjacency lists (no self loops, no duplicates)
+    int stamp = 0;
+    for (int pass = 0; pass < 2 && ok; pass++) {
+        for (int j = 0; j < n && ok; j++) {
+            for (int p = A->col_ptr[j]; p < A->col_ptr[j + 1]; p++) {
+                int u = row_pos[A->row_idx[p]];
+                int v = j;
+                if (u == v) continue;
+                if (pass == 1) {
+                    // Append u to v and v to u
+                    int ends[2][2] = {{v, u}, {u, v}};
+                    for (int e = 0; e < 2; e++) {
+                        int a = ends[e][0], b = ends[e][1];
+                        adj[a][adj_len[a]++] = b;
+                    }
+                } else {
+                    adj_cap[u]++;
+                    adj_cap[v]++;
+                }
+            }
+        }
+        if (pass == 0) {
+            for (int v = 0; v < n; v++) {
+                adj[v] = solver_malloc((adj_cap[v] > 0 ? adj_cap[v] : 1) * sizeof(int));
+                if (!adj[v]) ok = false;
+            }
+        }
+    }
+    if (!ok) goto cleanup;
+
+    for (int v = 0; v < n; v++) {
+        stamp++;
+        mark[v] = stamp;
+        int len = 0;
+        for (int p = 0; p < adj_len[v]; p++) {
+            int u = adj[v][p];
+            if (mark[u] != stamp) {
+                mark[u] = stamp;
+                adj[v][len++] = u;
+            }
+        }
+        adj_len[v] = len;
+    }
+
+    // Dense rows are postponed to the end of the ordering
+    int dense_limit = (int)(10.0 * sqrt((double)n));
+    if (dense_limit < 16) dense_limit = 16;
+    int num_dense = 0;
+    for (int v = 0; v < n; v++) {
+        if (adj_len[v] > dense_limit) {
+            gone[v] = true;
+            order[n - 1 - num_dense++] = v;
+        }
+    }
+
+    // Degree buckets (doubly linked lists)
+    for (int d = 0; d <= n; d++) head[d] = -1;
+    int min_degree = n;
+    for (int v = 0; v < n; v++) {
+        if (gone[v]) continue;
+        int d = 0;
+        for (int p = 0; p < adj_len[v]; p++) {
+            if (!gone[adj[v][p]]) d++;
+        }
+        degree[v] = d;
+        prev[v] = -1;
+        next[v] = head[d];
+        if (head[d] >= 0) prev[head[d]] = v;
+        head[d] = v;
+        if (d < min_degree) min_degree = d;
+    }
+
+    for (int k = 0; k < n - num_dense; k++) {
+        while (min_degree < n && head[min_degree] < 0) min_degree++;
+        int v = head[min_degree];
+
+        // Eliminate v
+        head[min_degree] = next[v];
+        if (next[v] >= 0) prev[next[v]] = -1;
+        gone[v] = true;
+        order[k] = v;
+
+        int num_nb = 0;
+        for (int p = 0; p < adj_len[v]; p++) {
+            int u = adj[v][p];
+            if (!gone[u]) nb[num_nb++] = u;
+        }
+
+        // Each neighbour becomes adjacent to all the others (fill edges)
+        for (int a = 0; a < num_nb && ok; a++) {
+            int u = nb[a];
+
+            if (prev[u] >= 0) next[prev[u]] = next[u];
+            else head[degree[u]] = next[u];
+            if (next[u] >= 0) prev[next[u]] = prev[u];
+
+            stamp++;
+            mark[u] = stamp;
+            int len = 0;
+            for (int p = 0; p < adj_len[u]; p++) {
+                int w = adj[u][p];
+                if (!gone[w] && mark[w] != stamp) {
+                    mark[w] = stamp;
+                    adj[u][len++] = w;
+                }
+            }
+            for (int b = 0; b < num_nb; b++) {
+                int w = nb[b];
+                if (mark[w] == stamp) continue;
+                if (len >= adj_cap[u]) {
+                    int new_cap = adj_cap[u] * 2 + 4;
+                    int *grown = solver_realloc(adj[u], new_cap * sizeof(int));
+                    if (!grown) {
+                        ok = false;
+                        break;
+                    }
+                    adj[u] = grown;
+                    adj_cap[u] = new_cap;
+                }
+                mark[w] = stamp;
+                adj[u][len++] = w;
+            }
+            adj_len[u] = len;
+
+            degree[u] = len;
+            prev[u] = -1;
+            next[u] = head[len];
+            if (head[len] >= 0) prev[head[len]] = u;
+            head[len] = u;
+            if (len < min_degree) min_degree = len;
+        }
+        if (!ok) break;
+    }
+
+cleanup:
+    if (adj) {
+        for (int v = 0; v < n; v++) free(adj[v]);
+    }
+    free(adj);
+    free(adj_len);
+    free(adj_cap);
+    free(mark);
+    free(head);
+    free(next);
+    free(prev);
+    free(degree);
+    free(gone);
+    free(nb);
+    return ok;
+}
+
+bool sparse_lu_analyze(SparseLU *lu, SparseMatrix *A) {
+    if (!lu || !A || !sparse_compress(A)) return false;
+
+    sparse_lu_invalidate(lu);
+
+    int n = A->n;
+    int nnz = A->nnz;
+    lu->n = n;
+
+    lu->col_perm = solver_malloc(n * sizeof(int));
+    lu->pref_row = solver_malloc(n * sizeof(int));
+    lu->row_count = solver_calloc(n, sizeof(int));
+    lu->pattern_col_ptr = solver_malloc((n + 1) * sizeof(int));
+    lu->pattern_row_idx = solver_malloc((nnz > 0 ? nnz : 1) * sizeof(int));
+    lu->Lp = solver_malloc((n + 1) * sizeof(int));
+    lu->Up = solver_malloc((n + 1) * sizeof(int));
+    lu->pinv = solver_malloc(n * sizeof(int));
+    lu->perm = solver_malloc(n * sizeof(int));
+    lu->factor_values = solver_malloc((nnz > 0 ? nnz : 1) * sizeof(double));
+    lu->x = solver_calloc(n, sizeof(double));
+    lu->xi = solver_malloc(n * sizeof(int));
+    lu->stack = solver_malloc(n * sizeof(int));
+    lu->pstack = solver_malloc(n * sizeof(int));
+    lu->mark = solver_calloc(n, sizeof(int));
+
+    // Initial guess for the fill; the factorization grows it if needed
+    lu->lnz_capacity = 4 * nnz + n;
+    lu->unz_capacity = 4 * nnz + n;
+    lu->Li = solver_malloc(lu->lnz_capacity * sizeof(int));
+    lu->Lx = solver_malloc(lu->lnz_capacity * sizeof(double));
+    lu->Ui = solver_malloc(lu->unz_capacity * sizeof(int));
+    lu->Ux = solver_malloc(lu->unz_capacity * sizeof(double));
+
+    if (!lu->col_perm || !lu->pref_row || !lu->row_count || !lu->pattern_col_ptr || !lu->pattern_row_idx ||
+        !lu->Lp || !lu->Up || !lu->pinv || !lu->perm || !lu->factor_values || !lu->x || !lu->xi ||
+        !lu->stack || !lu->pstack || !lu->mark ||
+        !lu->Li || !lu->Lx || !lu->Ui || !lu->Ux) {
+        sparse_lu_invalidate(lu);
+        return false;
+    }
+
+    memcpy(lu->pattern_col_ptr, A->col_ptr, (n + 1) * sizeof(int));
+    memcpy(lu->pattern_row_idx, A->row_idx, nnz * sizeof(int));
+    lu->pattern_nnz = nnz;
+
+    for (int p = 0; p < nnz; p++) {
+        lu->row_count[A->row_idx[p]]++;
+    }
+
+    // Match every column with a structurally nonzero row. Voltage-source
+    // branch columns get one of their node rows instead of their own
+    // (structurally zero) diagonal. Rows left over by a structurally
+    // singular matrix are paired with the leftover columns.
+    int *col_match = lu->pref_row;
+    int *row_pos = lu->perm;  // Borrowed as scratch until the first factor
+    bool ordered = sparse_max_transversal(A, col_match);
+    if (ordered) {
+        for (int i = 0; i < n; i++) row_pos[i] = -1;
+        for (int j = 0; j < n; j++) {
+            if (col_match[j] >= 0) row_pos[col_match[j]] = j;
+        }
+        int free_col = 0;
+        for (int i = 0; i < n; i++) {
+            if (row_pos[i] >= 0) continue;
+            while (col_match[free_col] >= 0) free_col++;
+            row_pos[i] = free_col++;
+        }
+
+        // Fill-reducing column order on the matched pattern
+        ordered = sparse_min_degree_order(A, row_pos, lu->col_perm);
+    }
+
+    if (!ordered) {
+        // Out of memory for the ordering: natural order still works
+        for (int k = 0; k < n; k++) {
+            lu->col_perm[k] = k;
+            col_match[k] = -1;
+        }
+    }
+
+    // pref_row is indexed by pivot step
+    for (int k = 0; k < n; k++) {
+        row_pos[k] = col_match[k];
+    }
+    for (int k = 0; k < n; k++) {
+        lu->pref_row[k] = row_pos[lu->col_perm[k]];
+    }
+
+    lu->analyzed = true;
+    return true;
+}
+
+// Depth-first search from row j through the columns of L already computed.
+// Rows reached are pushed onto xi[top-1], xi[top-2], ... in topological order.
+static int sparse_lu_dfs(SparseLU *lu, int j, int top, int stamp) {
+    int *xi = lu->xi;
+    int *stack = lu->stack;
+    int *pstack = lu->pstack;
+    int *mark = lu->mark;
+    int head = 0;
+    stack[0] = j;
+
+    while (head >= 0) {
+        j = stack[head];
+        int jnew = lu->pinv[j];
+        if (mark[j] != stamp) {
+            mark[j] = stamp;
+            pstack[head] = (jnew < 0) ? 0 : lu->Lp[jnew];
+        }
+
+        bool done = true;
+        int p2 = (jnew < 0) ? 0 : lu->Lp[jnew + 1];
+        for (int p = pstack[head]; p < p2; p++) {
+            int i = lu->Li[p];
+            if (mark[i] == stamp) continue;
+            pstack[head] = p;
+            stack[++head] = i;
+            done = false;
+            break;
+        }
+
+        if (done) {
+            head--;
+            xi[--top] = j;
+        }
+    }
+
+    return top;
+}
+
+bool sparse_lu_factor(SparseLU *lu, SparseMatrix *A) {
+    if (!lu || !A || !sparse_compress(A)) return false;
+    if (!lu->analyzed || !sparse_lu_pattern_matches(lu, A)) {
+        if (!sparse_lu_analyze(lu, A)) return false;
+    }
+
+    int n = lu->n;
+    double *x = lu->x;
+    int *xi = lu->xi;
+    int lnz = 0, unz = 0;
+    int free_row = 0;  // All rows below this one have been pivoted
+
+    lu->factored = false;
+    for (int i = 0; i < n; i++) {
+        lu->pinv[i] = -1;
+        lu->mark[i] = 0;
+    }
+
+    for (int k = 0; k < n; k++) {
+        int col = lu->col_perm[k];
+        lu->Lp[k] = lnz;
+        lu->Up[k] = unz;
+
+        if (!sparse_grow_factor(&lu->Li, &lu->Lx, &lu->lnz_capacity, lnz + n) ||
+            !sparse_grow_factor(&lu->Ui, &lu->Ux, &lu->unz_capacity, unz + n)) {
+            return false;
+        }
+
+        // Symbolic: rows reachable from the nonzeros of A(:,col) through L
+        int stamp = k + 1;
+        int top = n;
+        for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+            int i = A->row_idx[p];
+            if (lu->mark[i] != stamp) {
+                top = sparse_lu_dfs(lu, i, top, stamp);
+            }
+        }
+
+        // Numeric: x = L \ A(:,col)
+        for (int p = top; p < n; p++) x[xi[p]] = 0.0;
+        for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+            x[A->row_idx[p]] = A->values[p];
+        }
+        for (int px = top; px < n; px++) {
+            int j = xi[px];
+            int jnew = lu->pinv[j];
+            if (jnew < 0) continue;
+            double xj = x[j];
+            for (int p = lu->Lp[jnew] + 1; p < lu->Lp[jnew + 1]; p++) {
+                x[lu->Li[p]] -= lu->Lx[p] * xj;
+            }
+        }
+
+        // Rows already pivoted form column k of U, kept in topological order
+        // so sparse_lu_refactor can replay the elimination without a DFS
+        double col_max = 0.0;
+        for (int p = top; p < n; p++) {
+            int i = xi[p];
+            if (lu->pinv[i] < 0) {
+                double t = fabs(x[i]);
+                if (t > col_max) col_max = t;
+            } else {
+                lu->Ui[unz] = lu->pinv[i];
+                lu->Ux[unz++] = x[i];
+            }
+        }
+
+        // Threshold pivoting: keep the matched row if it is large enough,
+        // otherwise take the acceptable row with the fewest nonzeros
+        // (Markowitz cost), breaking ties on magnitude
+        int ipiv = -1;
+        double threshold = SPARSE_PIVOT_THRESHOLD * col_max;
+        int pref = lu->pref_row[k];
+        if (col_max > 0.0 && pref >= 0 && lu->pinv[pref] < 0 &&
+            fabs(x[pref]) >= threshold && fabs(x[pref]) > 0.0) {
+            ipiv = pref;
+        } else if (col_max > 0.0) {
+            int best_count = 0;
+            double best_val = 0.0;
+            for (int p = top; p < n; p++) {
+                int i = xi[p];
+                if (lu->pinv[i] >= 0) continue;
+                double t = fabs(x[i]);
+                if (t < threshold || t == 0.0) continue;
+                if (ipiv < 0 || lu->row_count[i] < best_count ||
+                    (lu->row_count[i] == best_count && t > best_val)) {
+                    ipiv = i;
+                    best_count = lu->row_count[i];
+                    best_val = t;
+                }
+            }
+        }
+
+        // All-zero column: take any candidate row and treat it as singular
+        if (ipiv < 0) {
+            for (int p = top; p < n && ipiv < 0; p++) {
+                if (lu->pinv[xi[p]] < 0) ipiv = xi[p];
+            }
+        }
+
+        // Structurally empty column (e.g. an unused reserved row): borrow the
+        // matched row, or the first free row, and treat it as singular
+        if (ipiv < 0) {
+            if (pref >= 0 && lu->pinv[pref] < 0) {
+                ipiv = pref;
+            } else if (lu->pinv[col] < 0) {
+                ipiv = col;
+            } else {
+                while (free_row < n && lu->pinv[free_row] >= 0) free_row++;
+                ipiv = free_row;
+            }
+            x[ipiv] = 0.0;
+        }
+
+        double pivot = x[ipiv];
+        if (fabs(pivot) < SPARSE_PIVOT_EPS) {
+            // Singular column, same treatment as the dense solver
+            pivot = SPARSE_PIVOT_EPS;
+        }
+
+        lu->Ui[unz] = k;
+        lu->Ux[unz++] = pivot;
+        lu->pinv[ipiv] = k;
+        lu->perm[k] = ipiv;
+        lu->Li[lnz] = ipiv;
+        lu->Lx[lnz++] = 1.0;
+
+        for (int p = top; p < n; p++) {
+            int i = xi[p];
+            if (lu->pinv[i] < 0) {
+                lu->Li[lnz] = i;
+                lu->Lx[lnz++] = x[i] / pivot;
+            }
+            x[i] = 0.0;
+        }
+        x[ipiv] = 0.0;
+    }
+
+    lu->Lp[n] = lnz;
+    lu->Up[n] = unz;
+    lu->fill_nnz = lnz + unz;
+
+    // Renumber L rows into pivot order
+    for (int p = 0; p < lnz; p++) {
+        lu->Li[p] = lu->pinv[lu->Li[p]];
+    }
+
+    // Work of a numeric refactor on this pattern: every off-diagonal entry
+    // of U applies one column of L
+    int ops = 0;
+    for (int k = 0; k < n; k++) {
+        for (int p = lu->Up[k]; p < lu->Up[k + 1] - 1; p++) {
+            int j = lu->Ui[p];
+            ops += lu->Lp[j + 1] - lu->Lp[j] - 1;
+        }
+    }
+    lu->refactor_ops = ops;
+
+    memcpy(lu->factor_values, A->values, A->nnz * sizeof(double));
+    lu->factored = true;
+    lu->factor_count++;
+    return true;
+}
+
+bool sparse_lu_refactor(SparseLU *lu, SparseMatrix *A) {
+    if (!lu || !A || !lu->factored || !sparse_compress(A)) return false;
+    if (!sparse_lu_pattern_matches(lu, A)) return false;
+
+    int n = lu->n;
+    double *x = lu->x;  // Indexed by pivot step
+
+    for (int k = 0; k < n; k++) {
+        int col = lu->col_perm[k];
+
+        // Clear the pattern of column k, then scatter A(:,col) in pivot order
+        for (int p = lu->Up[k]; p < lu->Up[k + 1]; p++) x[lu->Ui[p]] = 0.0;
+        for (int p = lu->Lp[k]; p < lu->Lp[k + 1]; p++) x[lu->Li[p]] = 0.0;
+        for (int p = A->col_ptr[col]; p < A->col_ptr[col + 1]; p++) {
+            x[lu->pinv[A->row_idx[p]]] = A->values[p];
+        }
+
+        // Replay the elimination along the recorded U pattern
+        int udiag = lu->Up[k + 1] - 1;
+        for (int p = lu->Up[k]; p < udiag; p++) {
+            int j = lu->Ui[p];
+            double ujk = x[j];
+            lu->Ux[p] = ujk;
+            for (int q = lu->Lp[j] + 1; q < lu->Lp[j + 1]; q++) {
+                x[lu->Li[q]] -= lu->Lx[q] * ujk;
+            }
+        }
+
+        // Reject the old pivot if it has become small relative to its column
+        double pivot = x[k];
+        double col_max = fabs(pivot);
+        for (int p = lu->Lp[k] + 1; p < lu->Lp[k + 1]; p++) {
+            double t = fabs(x[lu->Li[p]]);
+            if (t > col_max) col_max = t;
+        }
+        if (col_max > 0.0 && fabs(pivot) < SPARSE_REFACTOR_PIVOT_TOL * col_max) {
+            lu->factored = false;
+            return false;
+        }
+        if (fabs(pivot) < SPARSE_PIVOT_EPS) pivot = SPARSE_PIVOT_EPS;
+
+        lu->Ux[udiag] = pivot;
+        for (int p = lu->Lp[k] + 1; p < lu->Lp[k + 1]; p++) {
+            lu->Lx[p] = x[lu->Li[p]] / pivot;
+        }
+    }
+
+    memcpy(lu->factor_values, A->values, A->nnz * sizeof(double));
+    lu->refactor_count++;
+    return true;
+}
+
+bool sparse_lu_solve(SparseLU *lu, Vector *b, Vector *x) {
+    if (!lu || !lu->factored || !b || !x || b->size != lu->n || x->size != lu->n) {
+        return false;
+    }
+
+    int n = lu->n;
+    double *y = lu->x;
+
+    // y = P b
+    for (int k = 0; k < n; k++) {
+        y[k] = b->data[lu->perm[k]];
+    }
+
+    // Forward substitution with unit lower L
+    for (int j = 0; j < n; j++) {
+        double yj = y[j];
+        if (yj == 0.0) continue;
+        for (int p = lu->Lp[j] + 1; p < lu->Lp[j + 1]; p++) {
+            y[lu->Li[p]] -= lu->Lx[p] * yj;
+        }
+    }
+
+    // Back substitution with U (diagonal is the last entry of each column)
+    for (int j = n - 1; j >= 0; j--) {
+        double diag = lu->Ux[lu->Up[j + 1] - 1];
+        y[j] = (fabs(diag) > SPARSE_PIVOT_EPS) ? y[j] / diag : 0.0;
+        double yj = y[j];
+        if (yj == 0.0) continue;
+        for (int p = lu->Up[j]; p < lu->Up[j + 1] - 1; p++) {
+            y[lu->Ui[p]] -= lu->Ux[p] * yj;
+        }
+    }
+
+    // x = Q y
+    for (int k = 0; k < n; k++) {
+        x->data[lu->col_perm[k]] = y[k];
+    }
+
+    // Leave the workspace zeroed for the next factorization
+    memset(y, 0, n * sizeof(double));
+    return true;
+}
+
+bool sparse_lu_solve_transpose(SparseLU *lu, Vector *b, Vector *x) {
+    if (!lu || !lu->factored || !b || !x || b->size != lu->n || x->size != lu->n) {
+        return false;
+    }
+
+    int n = lu->n;
+    double *y = lu->x;
+
+    // A^T = Q U^T L^T P: y = Q^T b
+    for (int k = 0; k < n; k++) {
+        y[k] = b->data[lu->col_perm[k]];
+    }
+
+    // Forward substitution with U^T (column j of U is row j of U^T)
+    for (int j = 0; j < n; j++) {
+        double sum = y[j];
+        for (int p = lu->Up[j]; p < lu->Up[j + 1] - 1; p++) {
+            sum -= lu->Ux[p] * y[lu->Ui[p]];
+        }
+        double diag = lu->Ux[lu->Up[j + 1] - 1];
+        y[j] = (fabs(diag) > SPARSE_PIVOT_EPS) ? sum / diag : 0.0;
+    }
+
+    // Back substitution with unit upper L^T
+    for (int j = n - 1; j >= 0; j--) {
+        double sum = y[j];
+        for (int p = lu->Lp[j] + 1; p < lu->Lp[j + 1]; p++) {
+            sum -= lu->Lx[p] * y[lu->Li[p]];
+        }
+        y[j] = sum;
+    }
+
+    // x = P^T y
+    for (int k = 0; k < n; k++) {
+        x->data[lu->perm[k]] = y[k];
+    }
+
+    memset(y, 0, n * sizeof(double));
+    return true;
+}
+
+Vector *sparse_solve(SparseMatrix *A, Vector *b) {
+    if (!A || !b || A->n != b->size) return NULL;
+
+    SparseLU *lu = sparse_lu_create();
+    Vector *x = vector_create(A->n);
+    if (!lu || !x || !sparse_lu_factor(lu, A) || !sparse_lu_solve(lu, b, x)) {
+        sparse_lu_free(lu);
+        vector_free(x);
+        return NULL;
+    }
+
+    sparse_lu_free(lu);
+    return x;
+}
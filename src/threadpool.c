@@ -82,6 +82,8 @@ static void thread_join(thread_t thread) {
 
 #else // POSIX
 
+#include <unistd.h>
+
 static void* worker_thread(void* arg);
 
 int threadpool_get_optimal_threads(void) {
@@ -126,7 +128,8 @@ static void cond_broadcast(cond_t* cond) {
 }
 
 static bool thread_create(thread_t* thread, void* (*func)(void*), void* arg) {
-    return pthread_create(thread, NULL, func, arg) == 0;
+    (void)func;
+    return pthread_create(thread, NULL, worker_thread, arg) == 0;
 }
 
 static void thread_join(thread_t thread) {
@@ -151,10 +154,10 @@ static void* worker_thread(void* arg)
 {
     ThreadPool* pool = (ThreadPool*)arg;
 
-    // Get thread ID from the pool (count active threads at start)
+    // Get thread ID from the pool (count its threads at start), so each
+    // pool numbers its workers from 0
     mutex_lock(&pool->mutex);
-    static int thread_counter = 0;
-    tls_thread_id = thread_counter++;
+    tls_thread_id = pool->next_thread_id++;
     mutex_unlock(&pool->mutex);
 
     while (1) {
@@ -221,6 +224,7 @@ bool threadpool_init(ThreadPool* pool, int num_threads) {
     pool->queue_head = 0;
     pool->queue_tail = 0;
     pool->queue_size = 0;
+    pool->next_thread_id = 0;
     atomic_store(&pool->active_tasks, 0);
     atomic_store(&pool->pending_tasks, 0);
     pool->shutdown = false;
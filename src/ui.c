@@ -198,7 +198,10 @@ void ui_init(UIState *ui) {
     ui->display_time_step = 1e-7;  // Default 100 nanoseconds (will be updated from simulation)
 
     // Environment sliders (positioned in status bar area - will be updated in ui_update_layout)
-    // These control global light/temperature for LDR and thermistor components
+    // These control the light/temperature of the simulation for LDR and
+    // thermistor components
+    ui->environment.light_level = ENVIRONMENT_DEFAULT_LIGHT;
+    ui->environment.temperature = ENVIRONMENT_DEFAULT_TEMPERATURE;
     ui->env_light_slider = (Rect){0, 0, 80, 14};   // Will be positioned in render
     ui->env_temp_slider = (Rect){0, 0, 80, 14};    // Will be positioned in render
     ui->dragging_light = false;
@@ -528,6 +531,12 @@ void ui_init(UIState *ui) {
     ui->circuit_items[ui->num_circuit_items++] = (CircuitPaletteItem){
         {10 + col*70, pal_y, 60, pal_h}, CIRCUIT_PHASE_SHIFT_OSC, "PhOsc", false, false
     };
+    // Large Networks
+    col = 0;
+    pal_y += pal_h + 5;
+    ui->circuit_items[ui->num_circuit_items++] = (CircuitPaletteItem){
+        {10 + col*70, pal_y, 60, pal_h}, CIRCUIT_RC_MESH, "Mesh", false, false
+    };
 
     // Calculate palette content height (from toolbar to last item + padding)
     ui->palette_content_height = pal_y + pal_h + 10 - TOOLBAR_HEIGHT;
@@ -684,6 +693,8 @@ void ui_update(UIState *ui, Circuit *circuit, Simulation *sim) {
         ui->display_time_step = sim->time_step;
         // Sync speed slider value to simulation speed
         sim->speed = (double)ui->speed_value;
+        // Sync environment sliders to the simulation's environment
+        sim->context.environment = ui->environment;
 
         // Copy adaptive time-stepping status for UI display
         ui->adaptive_enabled = sim->adaptive_enabled;
@@ -4583,7 +4594,7 @@ void ui_render_statusbar(UIState *ui, SDL_Renderer *renderer) {
     SDL_RenderDrawRect(renderer, &light_bg);
 
     // Light slider fill (0-100%)
-    int light_fill = (int)(slider_w * g_environment.light_level);
+    int light_fill = (int)(slider_w * ui->environment.light_level);
     light_fill = CLAMP(light_fill, 0, slider_w);
     SDL_SetRenderDrawColor(renderer, SYNTH_YELLOW, 0xff);
     SDL_Rect light_fill_rect = {env_x + text_w, slider_y, light_fill, slider_h};
@@ -4591,7 +4602,7 @@ void ui_render_statusbar(UIState *ui, SDL_Renderer *renderer) {
 
     // Light value text
     char light_text[16];
-    snprintf(light_text, sizeof(light_text), "%d%%", (int)(g_environment.light_level * 100));
+    snprintf(light_text, sizeof(light_text), "%d%%", (int)(ui->environment.light_level * 100));
     SDL_SetRenderDrawColor(renderer, SYNTH_YELLOW, 0xff);
     ui_draw_text(renderer, light_text, env_x + text_w + slider_w + 4, y + 8);
 
@@ -4613,7 +4624,7 @@ void ui_render_statusbar(UIState *ui, SDL_Renderer *renderer) {
     // Temperature slider fill (map -40°C to 125°C to 0-1)
     // Normalize: (temp - min) / (max - min)
     double temp_min = -40.0, temp_max = 125.0;
-    double temp_norm = (g_environment.temperature - temp_min) / (temp_max - temp_min);
+    double temp_norm = (ui->environment.temperature - temp_min) / (temp_max - temp_min);
     temp_norm = CLAMP(temp_norm, 0.0, 1.0);
     int temp_fill = (int)(slider_w * temp_norm);
     SDL_SetRenderDrawColor(renderer, SYNTH_ORANGE, 0xff);
@@ -4622,7 +4633,7 @@ void ui_render_statusbar(UIState *ui, SDL_Renderer *renderer) {
 
     // Temperature value text
     char temp_text[16];
-    snprintf(temp_text, sizeof(temp_text), "%.0fC", g_environment.temperature);
+    snprintf(temp_text, sizeof(temp_text), "%.0fC", ui->environment.temperature);
     SDL_SetRenderDrawColor(renderer, SYNTH_ORANGE, 0xff);
     ui_draw_text(renderer, temp_text, temp_x + text_w + slider_w + 4, y + 8);
     }  // End of else block (sliders have room)
@@ -5901,7 +5912,7 @@ int ui_handle_click(UIState *ui, int x, int y, bool is_down) {
             // Map click position to light level (0 to 1)
             float normalized = (float)(x - ui->env_light_slider.x) / ui->env_light_slider.w;
             normalized = CLAMP(normalized, 0.0f, 1.0f);
-            g_environment.light_level = normalized;
+            ui->environment.light_level = normalized;
             ui->dragging_light = true;
             return UI_ACTION_NONE;
         }
@@ -5911,7 +5922,7 @@ int ui_handle_click(UIState *ui, int x, int y, bool is_down) {
             // Map click position to temperature (-40°C to 125°C)
             float normalized = (float)(x - ui->env_temp_slider.x) / ui->env_temp_slider.w;
             normalized = CLAMP(normalized, 0.0f, 1.0f);
-            g_environment.temperature = -40.0 + normalized * 165.0;  // -40 + (0-1) * 165 = -40 to 125
+            ui->environment.temperature = -40.0 + normalized * 165.0;  // -40 + (0-1) * 165 = -40 to 125
             ui->dragging_temp = true;
             return UI_ACTION_NONE;
         }
@@ -6359,7 +6370,7 @@ int ui_handle_motion(UIState *ui, int x, int y, bool popup_mode) {
     if (ui->dragging_light) {
         float normalized = (float)(x - ui->env_light_slider.x) / ui->env_light_slider.w;
         normalized = CLAMP(normalized, 0.0f, 1.0f);
-        g_environment.light_level = normalized;
+        ui->environment.light_level = normalized;
         return UI_ACTION_NONE;
     }
 
@@ -6367,7 +6378,7 @@ int ui_handle_motion(UIState *ui, int x, int y, bool popup_mode) {
     if (ui->dragging_temp) {
         float normalized = (float)(x - ui->env_temp_slider.x) / ui->env_temp_slider.w;
         normalized = CLAMP(normalized, 0.0f, 1.0f);
-        g_environment.temperature = -40.0 + normalized * 165.0;  // -40 to 125
+        ui->environment.temperature = -40.0 + normalized * 165.0;  // -40 to 125
         return UI_ACTION_NONE;
     }
 